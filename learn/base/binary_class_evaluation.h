@@ -1,7 +1,8 @@
 #pragma once
+#include <math.h>
 #include <algorithm>
 #include <dmlc/logging.h>
-#include <dmlc/omp.h>
+#include "base/thread_pool.h"
 namespace dmlc {
 
 template <typename V>
@@ -10,8 +11,8 @@ class BinClassEval {
   BinClassEval(const V* const label,
              const V* const predict,
              size_t n,
-             int num_threads = 2)
-      : label_(label), predict_(predict), size_(n), nt_(num_threads) { }
+             ThreadPool* pool)
+      : label_(label), predict_(predict), size_(n), pool_(pool) { }
   ~BinClassEval() { }
 
   V AUC() {
@@ -38,57 +39,58 @@ class BinClassEval {
   }
 
   V Accuracy(V threshold) {
-    V correct = 0;
     size_t n = size_;
-#pragma omp parallel for reduction(+:correct) num_threads(nt_)
-    for (size_t i = 0; i < n; ++i) {
-      if ((label_[i] > 0 && predict_[i] > threshold) ||
-          (label_[i] <= 0 && predict_[i] <= threshold))
-        correct += 1;
-    }
+    V correct = Sum([this, threshold](size_t i) -> V {
+        return (label_[i] > 0 && predict_[i] > threshold) ||
+            (label_[i] <= 0 && predict_[i] <= threshold);
+      });
     V acc = correct / (V) n;
     return acc > 0.5 ? acc : 1 - acc;
   }
 
   V LogLoss() {
-    V loss = 0;
-    size_t n = size_;
-#pragma omp parallel for reduction(+:loss) num_threads(nt_)
-    for (size_t i = 0; i < n; ++i) {
-      V y = label_[i] > 0;
-      V p = 1 / (1 + exp(- predict_[i]));
-      p = p < 1e-10 ? 1e-10 : p;
-      loss += y * log(p) + (1 - y) * log(1 - p);
-    }
+    V loss = Sum([this](size_t i) -> V {
+        V y = label_[i] > 0;
+        V p = 1 / (1 + exp(- predict_[i]));
+        p = p < 1e-10 ? 1e-10 : p;
+        return y * log(p) + (1 - y) * log(1 - p);
+      });
     return - loss;
   }
 
   V LogitObjv() {
-    V objv = 0;
-#pragma omp parallel for reduction(+:objv) num_threads(nt_)
-    for (size_t i = 0; i < size_; ++i) {
-      V y = label_[i] > 0 ? 1 : -1;
-      objv += log( 1 + exp( - y * predict_[i] ));
-    }
-    return objv;
+    return Sum([this](size_t i) -> V {
+        V y = label_[i] > 0 ? 1 : -1;
+        return log( 1 + exp( - y * predict_[i] ));
+      });
   }
-  
+
   V Copc(){
-    V clk = 0;
-    V clk_exp = 0.0;
-#pragma omp parallel for reduction(+:clk,clk_exp) num_threads(nt_)
-    for (size_t i = 0; i < size_; ++i) {
-      if (label_[i] > 0) clk += 1;
-      clk_exp += 1.0 / ( 1.0 + exp( - predict_[i] ));
-    }
+    V clk = Sum([this](size_t i) -> V { return label_[i] > 0; });
+    V clk_exp = Sum([this](size_t i) -> V {
+        return 1.0 / ( 1.0 + exp( - predict_[i] )); });
     return clk / clk_exp;
   }
 
  private:
+  // returns sum_i fn(i) for i in [0, size_)
+  template <typename Fn>
+  V Sum(const Fn& fn) {
+    std::vector<V> sum(pool_->num_threads(), 0);
+    pool_->ParallelFor(size_, [&sum, &fn](int tid, const Range& rg) {
+        V s = 0;
+        for (size_t i = rg.begin; i < rg.end; ++i) s += fn(i);
+        sum[tid] = s;
+      });
+    V res = 0;
+    for (V s : sum) res += s;
+    return res;
+  }
+
   V const* label_;
   V const* predict_;
   size_t size_;
-  int nt_;
+  ThreadPool* pool_;
 };
 
 
@@ -0,0 +1,116 @@
+/**
+ * @file   concurrency_controller.h
+ * @brief  Adapts the number of concurrent tasks to the measured latency
+ */
+#pragma once
+#include <mutex>
+#include <algorithm>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief Adapts the number of concurrent tasks, such as the minibatches being
+ * processed by a worker, with additive increase and multiplicative decrease
+ * (AIMD)
+ *
+ * A task consists of waiting for remote nodes (the round trip time, RTT) and of
+ * local computation. The controller collects both for a window of as many tasks
+ * as the current limit, and then compares the window averages with the best
+ * ones seen recently:
+ *
+ * - If either grows by more than \ref kTolerance, the servers, the network or
+ *   the local cores are over-subscribed, the limit is multiplied by \ref
+ *   kDecrease.
+ * - Otherwise more tasks can be pipelined. The limit is doubled before the
+ *   first congestion (slow start), and increased by one after that.
+ *
+ * The limit always stays in [min, max]. It is thread-safe.
+ */
+class ConcurrencyController {
+ public:
+  ConcurrencyController() { }
+  ~ConcurrencyController() { }
+
+  /**
+   * \brief init
+   *
+   * @param min the minimal limit
+   * @param max the maximal limit
+   */
+  void Init(int min, int max) {
+    std::lock_guard<std::mutex> lk(mu_);
+    CHECK_GE(min, 1); CHECK_GE(max, min);
+    min_ = min; max_ = max; limit_ = min;
+    slow_start_ = true;
+    base_rtt_ = base_comp_ = -1;
+    ResetWindow(); num_window_ = 0;
+  }
+
+  /**
+   * \brief Feed a finished task
+   *
+   * @param rtt the time waiting for remote nodes
+   * @param compute the time of local computation
+   * @return the change of the limit
+   */
+  int Update(double rtt, double compute) {
+    std::lock_guard<std::mutex> lk(mu_);
+    rtt_ += rtt; comp_ += compute;
+    if (++ cnt_ < limit_) return 0;
+
+    rtt = rtt_ / cnt_; compute = comp_ / cnt_;
+    ResetWindow();
+
+    // the baselines are the best window averages. restart them periodically so
+    // that a permanent change of the environment is picked up
+    if (base_rtt_ < 0 || ++ num_window_ >= kRestart) {
+      base_rtt_ = rtt; base_comp_ = compute; num_window_ = 0;
+      return 0;
+    }
+    base_rtt_ = std::min(base_rtt_, rtt);
+    base_comp_ = std::min(base_comp_, compute);
+
+    int old = limit_;
+    if (rtt > base_rtt_ * (1 + kTolerance) + kMinDelay ||
+        compute > base_comp_ * (1 + kTolerance) + kMinDelay) {
+      slow_start_ = false;
+      limit_ = std::max(min_, (int)(limit_ * kDecrease));
+    } else {
+      limit_ = std::min(max_, slow_start_ ? limit_ * 2 : limit_ + 1);
+    }
+    return limit_ - old;
+  }
+
+  /**
+   * \brief returns the current limit
+   */
+  int limit() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return limit_;
+  }
+
+  /// \brief the relative growth of latency treated as a congestion
+  static constexpr double kTolerance = .5;
+  /// \brief the absolute growth of latency (sec) always tolerated, so that
+  /// jitters of very short tasks are not seen as congestions
+  static constexpr double kMinDelay = 1e-3;
+  /// \brief the multiplier of the limit on congestion
+  static constexpr double kDecrease = .75;
+  /// \brief restart the baselines for every k windows
+  static const int kRestart = 50;
+
+ private:
+  void ResetWindow() { rtt_ = comp_ = 0; cnt_ = 0; }
+
+  std::mutex mu_;
+  int min_ = 1, max_ = 1, limit_ = 1;
+  bool slow_start_ = true;
+  // the current window
+  double rtt_ = 0, comp_ = 0;
+  int cnt_ = 0;
+  // baselines
+  double base_rtt_ = -1, base_comp_ = -1;
+  int num_window_ = 0;
+};
+
+}  // namespace dmlc
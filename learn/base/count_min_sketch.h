@@ -0,0 +1,89 @@
+/**
+ * @file   count_min_sketch.h
+ * @brief  Approximate counting of key frequencies
+ */
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief A count-min sketch with conservative update
+ *
+ * It estimates the number of times a key has been added using a fixed amount of
+ * memory: depth rows of width counters. A key is hashed into one counter per
+ * row, and the estimation is the minimum of these counters, which never
+ * underestimates. With conservative update, only the counters equal to the
+ * minimum are increased, which reduces the overestimation.
+ *
+ * The counters are 16-bit and saturate at 65535. It is not thread-safe.
+ */
+class CountMinSketch {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param size the total number of counters, rounded up to depth times a
+   * power of 2
+   * @param depth the number of rows
+   */
+  CountMinSketch(size_t size, int depth = 4) : depth_(depth) {
+    CHECK(depth > 0 && depth <= kMaxDepth) << "invalid depth " << depth;
+    size_t width = 1;
+    while (width * depth < size) width <<= 1;
+    mask_ = width - 1;
+    cnt_.resize(width * depth, 0);
+  }
+  ~CountMinSketch() { }
+
+  /**
+   * \brief adds a key once, returns the estimated count after adding
+   */
+  int Add(uint64_t key) {
+    size_t pos[kMaxDepth];
+    uint16_t min = kMax;
+    for (int i = 0; i < depth_; ++i) {
+      pos[i] = Pos(key, i);
+      min = std::min(min, cnt_[pos[i]]);
+    }
+    if (min == kMax) return min;
+    ++ min;
+    for (int i = 0; i < depth_; ++i) {
+      cnt_[pos[i]] = std::max(cnt_[pos[i]], min);
+    }
+    return min;
+  }
+
+  /**
+   * \brief returns the estimated count of a key
+   */
+  int Count(uint64_t key) const {
+    uint16_t min = kMax;
+    for (int i = 0; i < depth_; ++i) min = std::min(min, cnt_[Pos(key, i)]);
+    return min;
+  }
+
+  /**
+   * \brief resets all counters to 0
+   */
+  void Clear() { std::fill(cnt_.begin(), cnt_.end(), 0); }
+
+ private:
+  static const int kMaxDepth = 16;
+  static const uint16_t kMax = 65535;
+
+  inline size_t Pos(uint64_t key, int row) const {
+    // a different odd multiplier for each row
+    uint64_t h = (key ^ (0x9E3779B97F4A7C15ULL * (row + 1))) *
+                 (0xBF58476D1CE4E5B9ULL + 2 * row);
+    return (size_t)row * (mask_ + 1) + ((h ^ (h >> 31)) & mask_);
+  }
+
+  int depth_;
+  size_t mask_;
+  std::vector<uint16_t> cnt_;
+};
+
+}  // namespace dmlc
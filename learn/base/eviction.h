@@ -0,0 +1,108 @@
+/**
+ * @file   eviction.h
+ * @brief  The policy to evict stale and zero entries from a server
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "dmlc/logging.h"
+#include "dmlc/timer.h"
+namespace dmlc {
+
+/**
+ * \brief Decides which entries of a server store are evicted
+ *
+ * Each entry carries a 1-byte mark: the lower 7 bits are the clock when it was
+ * last pushed, and the highest bit is set if it was zero at the last sweep.
+ * The clock advances either once per training data pass, or every ttl_sec / 8
+ * seconds. Every time the clock advances, the store sweeps all entries, and an
+ * entry is evicted if
+ *
+ * - it has not been pushed for more than ttl_pass data passes or ttl_sec
+ *   seconds, or
+ * - evict_zero is set, and it was zero in two consecutive sweeps, namely it
+ *   stayed zero for a whole clock period
+ *
+ * The clock is 7 bits, and a full sweep is done once per clock period, so an
+ * entry is always checked before its mark wraps around.
+ */
+class EvictionPolicy {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param ttl_pass if > 0, the data passes an entry can live without pushes
+   * @param ttl_sec if > 0, the seconds an entry can live without pushes
+   * @param evict_zero evict the entries which stayed zero
+   */
+  EvictionPolicy(int ttl_pass, double ttl_sec, bool evict_zero)
+      : by_pass_(ttl_pass > 0), evict_zero_(evict_zero) {
+    CHECK(!(ttl_pass > 0 && ttl_sec > 0))
+        << "set either ttl_pass or ttl_sec, but not both";
+    if (by_pass_) {
+      CHECK(ttl_pass <= kMaxTTL) << "ttl_pass is too large: " << ttl_pass;
+      ttl_ = ttl_pass;
+    } else if (ttl_sec > 0) {
+      ttl_ = 8; period_ = ttl_sec / ttl_;
+    }
+    start_ = GetTime();
+  }
+
+  /**
+   * \brief returns true if entries may be evicted
+   */
+  bool enabled() const { return ttl_ > 0 || evict_zero_; }
+
+  /**
+   * \brief a training data pass starts. it is thread-safe
+   */
+  void StartIter() { if (by_pass_ || ttl_ == 0) ++ pending_; }
+
+  /**
+   * \brief advances the clock if it is time. returns true if the clock
+   * advanced, then a new sweep should start
+   */
+  bool Tick() {
+    int n = pending_.exchange(0);
+    if (period_ > 0) {
+      double now = GetTime();
+      if (now - start_ >= period_) { start_ = now; n = 1; }
+    }
+    if (n == 0) return false;
+    clock_ = (clock_ + 1) & kStampMask;
+    return true;
+  }
+
+  /**
+   * \brief returns the new mark of an entry just pushed
+   */
+  uint8_t Touch(uint8_t mark) const { return clock_ | (mark & kZero); }
+
+  /**
+   * \brief checks an entry in a sweep, returns true if it should be evicted
+   *
+   * @param mark the mark of the entry, will be updated
+   * @param zero whether the entry is zero now
+   */
+  bool Sweep(uint8_t* mark, bool zero) const {
+    if (ttl_ > 0 && ((clock_ - *mark) & kStampMask) > ttl_) return true;
+    if (!evict_zero_) return false;
+    if (zero && (*mark & kZero)) return true;
+    *mark = zero ? (*mark | kZero) : (*mark & kStampMask);
+    return false;
+  }
+
+ private:
+  static const int kMaxTTL = 100;
+  static const uint8_t kStampMask = 0x7F;
+  static const uint8_t kZero = 0x80;
+
+  bool by_pass_;
+  bool evict_zero_;
+  int ttl_ = 0;
+  double period_ = 0, start_ = 0;
+  uint8_t clock_ = 0;
+  std::atomic<int> pending_{0};
+};
+
+}  // namespace dmlc
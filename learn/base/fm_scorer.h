@@ -0,0 +1,87 @@
+/**
+ * @file   fm_scorer.h
+ * @brief  Score examples with a linear or difacto model for online serving
+ */
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "base/simd.h"
+#include "base/reverse_bytes.h"
+#include "base/serving_model.h"
+namespace dmlc {
+
+/**
+ * \brief Scores sparse examples with a ServingModel
+ *
+ * The score of an example x is
+ *
+ *   <x, w> + .5 * sum_k ((x V)_k^2 - sum_i x_i^2 V_ik^2)
+ *
+ * the same as difacto::Loss, where the second term is 0 for a linear model.
+ * The loops over the embedding dimension are vectorized by \ref VecAxpy and
+ * \ref VecDot.
+ *
+ * The model, such as a mapped file, is read-only and can be shared by all
+ * threads. A scorer owns a workspace allocated by the constructor, so \ref
+ * Score does not allocate memory, but a scorer should be used by a single
+ * thread.
+ */
+class FMScorer {
+ public:
+  explicit FMScorer(const ServingModel& model)
+      : model_(model), dim_(model.dim()), xv_(dim_), buf_(dim_) { }
+
+  /**
+   * \brief returns the score of an example
+   *
+   * @param key the keys of the features, see \ref Key
+   * @param val the feature values, or NULL if all of them are 1
+   * @param n the number of features
+   */
+  float Score(const uint64_t* key, const float* val, size_t n) {
+    double p = 0, xxvv = 0;
+    std::fill(xv_.begin(), xv_.end(), 0);
+    for (size_t i = 0; i < n; ++i) {
+      float x = val ? val[i] : 1;
+      p += x * model_.w(key[i]);
+      if (dim_ == 0) continue;
+      const float* v = model_.V(key[i], buf_.data());
+      if (v == NULL) continue;
+      VecAxpy(x, v, dim_, xv_.data());
+      xxvv += x * x * VecDot(v, v, dim_);
+    }
+    if (dim_) p += .5 * (VecDot(xv_.data(), xv_.data(), dim_) - xxvv);
+    return p;
+  }
+
+  /**
+   * \brief returns the probability of the positive label of a score
+   */
+  static float Prob(float score) { return 1.0 / (1.0 + exp(-score)); }
+
+  /**
+   * \brief maps a feature id into the key stored in the model, the same as
+   * Localizer
+   *
+   * @param id the feature id
+   * @param max_key the max_key used by training if it was set
+   */
+  static uint64_t Key(uint64_t id, uint64_t max_key =
+                      std::numeric_limits<uint64_t>::max()) {
+    return max_key < std::numeric_limits<uint64_t>::max() ?
+        id % max_key : ReverseBytes(id);
+  }
+
+ private:
+  const ServingModel& model_;
+  int dim_;
+  /** \brief x * V */
+  std::vector<float> xv_;
+  /** \brief the decoded embedding of a fp16 model */
+  std::vector<float> buf_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,135 @@
+/**
+ * @file   grad_aggregator.h
+ * @brief  Aggregates the sparse gradients of several minibatches
+ */
+#pragma once
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "dmlc/logging.h"
+#include "dmlc/timer.h"
+namespace dmlc {
+
+/**
+ * \brief Aggregates the sparse gradients of consecutive minibatches on a
+ * worker, so they are pushed by a single message
+ *
+ * The gradients are summed per key. It is equivalent to use a k times larger
+ * minibatch whose gradient is computed on weights pulled at different times,
+ * so both the effective minibatch size and the delay grow with k.
+ *
+ * A gradient is given by a list of sorted unique keys and the values. Each key
+ * has either one value or a variable number of values specified by a size
+ * list. For the latter, if a key comes with different sizes, the shorter values
+ * are padded with 0.
+ *
+ * It is thread-safe.
+ *
+ * \tparam K the key type
+ * \tparam V the value type
+ */
+template <typename K, typename V>
+class GradAggregator {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param num_mb if > 0, the aggregated gradient is ready once it contains
+   * num_mb minibatches
+   * @param sec if > 0, it is ready once the oldest minibatch in it was added
+   * sec seconds ago
+   */
+  GradAggregator(int num_mb, double sec) : num_mb_(num_mb), sec_(sec) {
+    CHECK(num_mb_ > 0 || sec_ > 0) << "the aggregation is not bounded";
+  }
+  ~GradAggregator() { }
+
+  /**
+   * \brief add the gradient of a minibatch.
+   *
+   * If the aggregated gradient is ready, then moves it into agg_key, agg_val
+   * and agg_siz, and returns the number of minibatches in it. Otherwise
+   * returns 0.
+   *
+   * @param key the sorted unique keys
+   * @param val the values
+   * @param siz the number of values of each key. NULL means 1 for all
+   */
+  int Add(const std::vector<K>& key, const std::vector<V>& val,
+           const std::vector<int>* siz,
+           std::vector<K>* agg_key, std::vector<V>* agg_val,
+           std::vector<int>* agg_siz = NULL) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (num_ == 0) start_ = GetTime();
+    Merge(key, val, siz);
+    ++ num_;
+    bool full = num_mb_ > 0 && num_ >= num_mb_;
+    bool due = sec_ > 0 && GetTime() - start_ >= sec_;
+    if (!full && !due) return 0;
+    return Move(agg_key, agg_val, agg_siz);
+  }
+
+  /**
+   * \brief moves the aggregated gradient out no matter whether it is ready.
+   * returns the number of minibatches in it, 0 if it is empty
+   */
+  int Flush(std::vector<K>* agg_key, std::vector<V>* agg_val,
+             std::vector<int>* agg_siz = NULL) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (num_ == 0) return 0;
+    return Move(agg_key, agg_val, agg_siz);
+  }
+
+ private:
+  int Move(std::vector<K>* agg_key, std::vector<V>* agg_val,
+           std::vector<int>* agg_siz) {
+    int n = num_;
+    CHECK_NOTNULL(agg_key)->swap(key_);
+    CHECK_NOTNULL(agg_val)->swap(val_);
+    if (agg_siz) agg_siz->swap(siz_);
+    key_.clear(); val_.clear(); siz_.clear(); num_ = 0;
+    return n;
+  }
+
+  // merge (key, val, siz) into (key_, val_, siz_) with a two-way merge
+  void Merge(const std::vector<K>& key, const std::vector<V>& val,
+             const std::vector<int>* siz) {
+    if (siz) CHECK_EQ(siz->size(), key.size());
+    std::vector<K> k; k.reserve(key_.size() + key.size());
+    std::vector<V> v; v.reserve(val_.size() + val.size());
+    std::vector<int> s;
+    size_t i = 0, j = 0, pi = 0, pj = 0;
+    while (i < key_.size() || j < key.size()) {
+      int si = i < key_.size() ? (siz ? siz_[i] : 1) : 0;
+      int sj = j < key.size() ? (siz ? (*siz)[j] : 1) : 0;
+      bool ti = j == key.size() || (i < key_.size() && key_[i] <= key[j]);
+      bool tj = i == key_.size() || (j < key.size() && key[j] <= key_[i]);
+      int n = std::max(ti ? si : 0, tj ? sj : 0);
+      size_t p = v.size();
+      v.resize(p + n, 0);
+      if (ti) {
+        for (int l = 0; l < si; ++l) v[p+l] += val_[pi+l];
+        pi += si; k.push_back(key_[i++]);
+      }
+      if (tj) {
+        for (int l = 0; l < sj; ++l) v[p+l] += val[pj+l];
+        pj += sj; if (!ti) k.push_back(key[j]);
+        ++ j;
+      }
+      if (siz) s.push_back(n);
+    }
+    CHECK_EQ(pj, val.size());
+    key_.swap(k); val_.swap(v); siz_.swap(s);
+  }
+
+  std::mutex mu_;
+  int num_mb_;
+  double sec_;
+  int num_ = 0;
+  double start_ = 0;
+  std::vector<K> key_;
+  std::vector<V> val_;
+  std::vector<int> siz_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,179 @@
+/**
+ * @file   latency_histogram.h
+ * @brief  Lock-free latency histograms
+ */
+#pragma once
+#include <atomic>
+#include <array>
+#include <string>
+#include <vector>
+#include "dmlc/logging.h"
+#include "dmlc/timer.h"
+namespace dmlc {
+
+/**
+ * \brief A lock-free histogram of latencies
+ *
+ * The buckets are in the style of HDR histograms: each power of two of
+ * microseconds is divided into \ref kSub linear sub-buckets, so the relative
+ * error is bounded by 1 / \ref kSub for latencies from 1 usec to about 7500
+ * sec (7 * 2^30 usec), the lower bound of the last bucket.
+ * \ref Add is a single atomic increment, so it can be called from any
+ * thread.
+ */
+class LatencyHistogram {
+ public:
+  /// \brief number of sub-buckets per power of two
+  static const int kSub = 4;
+  /// \brief number of buckets
+  static const int kNumBuckets = 128;
+
+  LatencyHistogram() { for (auto& c : cnt_) c = 0; }
+  ~LatencyHistogram() { }
+
+  /**
+   * \brief record a latency
+   * @param sec the latency in sec
+   */
+  void Add(double sec) {
+    cnt_[Bucket(sec)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief move the counts into buf, which has \ref kNumBuckets elements, and
+   * reset them to 0
+   */
+  void Flush(double* buf) {
+    for (int i = 0; i < kNumBuckets; ++i) {
+      buf[i] += cnt_[i].exchange(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * \brief returns the q-quantile in sec of the counts in buf, or -1 if empty
+   */
+  static double Quantile(const double* buf, double q) {
+    double total = 0;
+    for (int i = 0; i < kNumBuckets; ++i) total += buf[i];
+    if (total == 0) return -1;
+    double cum = 0;
+    for (int i = 0; i < kNumBuckets; ++i) {
+      cum += buf[i];
+      if (cum >= q * total) return (Lower(i) + Lower(i+1)) * .5e-6;
+    }
+    return Lower(kNumBuckets) * 1e-6;
+  }
+
+ private:
+  // the bucket of a latency
+  static int Bucket(double sec) {
+    double us = sec * 1e6;
+    if (!(us >= kSub)) return us > 0 ? (int)us : 0;
+    if (us >= Lower(kNumBuckets - 1)) return kNumBuckets - 1;
+    uint64_t v = (uint64_t)us;
+    int e = 63 - __builtin_clzll(v);  // v in [2^e, 2^(e+1))
+    return (e - 1) * kSub + (int)((v >> (e - 2)) & (kSub - 1));
+  }
+
+  // the lower bound of the i-th bucket in usec
+  static double Lower(int i) {
+    if (i < kSub) return i;
+    return (double)((uint64_t)(kSub + i % kSub) << (i / kSub - 1));
+  }
+
+  std::array<std::atomic<uint64_t>, kNumBuckets> cnt_;
+};
+
+/**
+ * \brief The latency histograms of all stages of a node
+ *
+ * The histograms are sent to the scheduler through the progress. They are
+ * appended to the application's progress vector starting at \a offset, so they
+ * are aggregated over all nodes by the same summation.
+ */
+class LatencyMonitor {
+ public:
+  /// \brief the stages
+  enum Stage {
+    /// \brief worker: waiting for the parser to return a minibatch
+    kParse,
+    /// \brief worker: waiting for a free slot before processing a minibatch
+    kQueue,
+    /// \brief worker: finding the unique feature ids
+    kLocalize,
+    /// \brief worker: pull round trip
+    kPull,
+    /// \brief worker: evaluating and computing the gradients
+    kCompute,
+    /// \brief worker: push round trip
+    kPush,
+    /// \brief server: handling a push request
+    kServerPush,
+    /// \brief server: handling a pull request
+    kServerPull,
+    kNumStages
+  };
+
+  /**
+   * \brief constructor
+   *
+   * @param offset the position of the histograms in the progress vector, namely
+   * the length of the application's progress
+   * @param interval the minimal interval in sec between two reports
+   */
+  LatencyMonitor(size_t offset, double interval)
+      : offset_(offset), interval_(interval), last_(GetTime()) { }
+  ~LatencyMonitor() { }
+
+  /**
+   * \brief record a latency in sec
+   */
+  void Add(Stage s, double sec) { hist_[s].Add(sec); }
+
+  /**
+   * \brief move the histograms into the progress if at least interval sec have
+   * passed since the last report or force is true. Returns false if nothing is
+   * moved
+   */
+  bool Report(std::vector<double>* prog, bool force = false) {
+    double now = GetTime(), last = last_.load();
+    if (!force && now - last < interval_) return false;
+    if (!last_.compare_exchange_strong(last, now) && !force) return false;
+    int n = LatencyHistogram::kNumBuckets;
+    prog->resize(offset_ + kNumStages * n, 0);
+    for (int i = 0; i < kNumStages; ++i) {
+      hist_[i].Flush(prog->data() + offset_ + i * n);
+    }
+    return true;
+  }
+
+  /**
+   * \brief returns p50/p99 in msec of the stages present in the aggregated
+   * progress, or an empty string if there is none
+   */
+  std::string PrintStr(const std::vector<double>& prog) const {
+    int n = LatencyHistogram::kNumBuckets;
+    if (prog.size() < offset_ + kNumStages * n) return "";
+    static const char* names[] = {"parse", "queue", "localize", "pull",
+                                  "compute", "push", "srv_push", "srv_pull"};
+    std::string str;
+    for (int i = 0; i < kNumStages; ++i) {
+      const double* buf = prog.data() + offset_ + i * n;
+      double p50 = LatencyHistogram::Quantile(buf, .5);
+      if (p50 < 0) continue;
+      double p99 = LatencyHistogram::Quantile(buf, .99);
+      char tmp[64];
+      snprintf(tmp, 64, "  %s %.3g/%.3g", names[i], p50 * 1e3, p99 * 1e3);
+      str += tmp;
+    }
+    return str.empty() ? str : "latency p50/p99 (ms):" + str;
+  }
+
+ private:
+  size_t offset_;
+  double interval_;
+  std::atomic<double> last_;
+  LatencyHistogram hist_[kNumStages];
+};
+
+}  // namespace dmlc
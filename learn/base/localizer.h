@@ -2,9 +2,9 @@
 #include <type_traits>
 #include <limits>
 #include "dmlc/data.h"
-#include "dmlc/omp.h"
 #include "data/row_block.h"
 #include "base/parallel_sort.h"
+#include "base/reverse_bytes.h"
 
 namespace ps {
 DECLARE_uint64(max_key);
@@ -12,19 +12,6 @@ DECLARE_uint64(max_key);
 
 namespace dmlc {
 
-/// \brief reverse the bytes of x to make it more uniformly spanning the space
-inline uint64_t ReverseBytes(uint64_t x) {
-  // return x;
-  x = x << 32 | x >> 32;
-  x = (x & 0x0000FFFF0000FFFFULL) << 16 |
-      (x & 0xFFFF0000FFFF0000ULL) >> 16;
-  x = (x & 0x00FF00FF00FF00FFULL) << 8 |
-      (x & 0xFF00FF00FF00FF00ULL) >> 8;
-  x = (x & 0x0F0F0F0F0F0F0F0FULL) << 4 |
-      (x & 0xF0F0F0F0F0F0F0F0ULL) >> 4;
-  return x;
-}
-
 /**
  * @brief Mapping a RowBlock with general indices into continuous indices
  * starting from 0
@@ -33,7 +20,10 @@ inline uint64_t ReverseBytes(uint64_t x) {
 template<typename I>
 class Localizer {
  public:
-  Localizer(int nthreads = 2) : nt_(nthreads) { }
+  /**
+   * @param pool the thread pool for computation
+   */
+  Localizer(ThreadPool* pool) : pool_(pool) { }
   ~Localizer() { }
   /**
    * @brief Localize a Rowblock
@@ -83,7 +73,7 @@ class Localizer {
   void Clear() { pair_.clear(); }
 
  private:
-  int nt_;
+  ThreadPool* pool_;
 #pragma pack(push)
 #pragma pack(4)
   struct Pair {
@@ -108,26 +98,30 @@ void Localizer<I>:: CountUniqIndex(
   if (ps::FLAGS_max_key < (uint64_t)max_index) {
     // hash kernel
     max_index = (I) ps::FLAGS_max_key;
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < idx_size; ++i) {
-      pair_[i].k = blk.index[i] % max_index;
-      pair_[i].i = i;
-    }
+    pool_->ParallelFor(idx_size, [this, &blk, max_index](
+        int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          pair_[i].k = blk.index[i] % max_index;
+          pair_[i].i = i;
+        }
+      });
   } else if (sizeof(I) == 8) {
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < idx_size; ++i) {
-      pair_[i].k = ReverseBytes(blk.index[i]);
-      pair_[i].i = i;
-    }
+    pool_->ParallelFor(idx_size, [this, &blk](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          pair_[i].k = ReverseBytes(blk.index[i]);
+          pair_[i].i = i;
+        }
+      });
   } else {
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < idx_size; ++i) {
-      pair_[i].k = blk.index[i];
-      pair_[i].i = i;
-    }
+    pool_->ParallelFor(idx_size, [this, &blk](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          pair_[i].k = blk.index[i];
+          pair_[i].i = i;
+        }
+      });
   }
 
-  ParallelSort(&pair_, nt_,
+  ParallelSort(&pair_, pool_,
                [](const Pair& a, const Pair& b) {return a.k < b.k; });
 
   // save data
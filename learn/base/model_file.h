@@ -0,0 +1,456 @@
+/**
+ * @file   model_file.h
+ * @brief  A sharded binary format of the model on a server node
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief A column of a model chunk, such as the weights or the embeddings.
+ * Each key has width floats, or a variable number of floats if width is 0
+ */
+struct ModelColumn {
+  ModelColumn(const char* _name, int _width) : name(_name), width(_width) {
+    CHECK_LT(name.size(), (size_t)8) << "column name too long: " << name;
+    CHECK_GE(width, 0);
+  }
+  /** \brief appends a value of a column with width 1 */
+  inline void Add(float v) { val.push_back(v); }
+  /** \brief appends n values, it records n if the width is variable */
+  inline void Add(const float* v, uint32_t n) {
+    if (width == 0) len.push_back(n);
+    val.insert(val.end(), v, v + n);
+  }
+  inline void Clear() { val.clear(); len.clear(); }
+
+  std::string name;
+  int width;
+  /** \brief the number of values of each key, only for variable width */
+  std::vector<uint32_t> len;
+  std::vector<float> val;
+};
+
+/**
+ * \brief A read-only file in memory. A local file is mapped by mmap, others such
+ * as on HDFS are read into memory
+ */
+class MappedFile {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param file the filename
+   * @param sequential if true, the file will be read sequentially, otherwise
+   * randomly, as a hint for the page cache
+   */
+  MappedFile(const std::string& file, bool sequential) {
+    if (Local(file)) {
+      const char* path = file.compare(0, 7, "file://") == 0 ?
+                         file.c_str() + 7 : file.c_str();
+      int fd = open(path, O_RDONLY);
+      CHECK_GE(fd, 0) << "failed to open " << file;
+      struct stat st;
+      CHECK_EQ(fstat(fd, &st), 0);
+      size_ = st.st_size;
+      if (size_ > 0) {
+        void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        CHECK(p != MAP_FAILED) << "failed to mmap " << file;
+        madvise(p, size_, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        data_ = static_cast<const char*>(p);
+        mapped_ = true;
+      }
+      close(fd);
+    } else {
+      Stream* fi = CHECK_NOTNULL(Stream::Create(file.c_str(), "r"));
+      std::string buf(1 << 20, 0);
+      size_t n;
+      while ((n = fi->Read(&buf[size_], buf.size() - size_)) > 0) {
+        size_ += n;
+        if (size_ == buf.size()) buf.resize(buf.size() * 2);
+      }
+      delete fi;
+      buf.resize(size_);
+      buf_.swap(buf);
+      data_ = buf_.data();
+    }
+  }
+  /**
+   * \brief takes the content of a buffer in memory
+   */
+  explicit MappedFile(std::string&& buf) : buf_(std::move(buf)) {
+    data_ = buf_.data();
+    size_ = buf_.size();
+  }
+  ~MappedFile() { if (mapped_) munmap(const_cast<char*>(data_), size_); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  static bool Local(const std::string& file) {
+    return file.find("://") == std::string::npos ||
+        file.compare(0, 7, "file://") == 0;
+  }
+
+ private:
+  const char* data_ = NULL;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::string buf_;
+};
+
+/**
+ * \brief A chunk file mapped into memory for reading
+ *
+ * A chunk stores the entries of a range of keys in the column layout:
+ *
+ * - header: magic, version, the number of keys n, the number of columns m
+ * - m column descriptions: an 8-byte name and the width
+ * - n sorted keys as uint64
+ * - m columns, each of them has n * width floats. A column with variable width
+ *   starts with n uint32 lengths. Each part is padded to 8 bytes.
+ *
+ * All numbers are little-endian. Local files are mapped by mmap, others such
+ * as on HDFS are read into memory.
+ */
+class ModelChunk {
+ public:
+  explicit ModelChunk(const std::string& file) : file_(file, true) {
+    CHECK(LittleEndian()) << "only little-endian machines are supported";
+    data_ = file_.data(); size_ = file_.size();
+    Parse(file);
+  }
+
+  /** \brief the number of keys */
+  size_t size() const { return num_keys_; }
+  /** \brief the sorted keys */
+  const uint64_t* key() const { return key_; }
+  /** \brief the number of columns */
+  int num_cols() const { return (int)col_.size(); }
+  /** \brief the index of a column, -1 if not found */
+  int Find(const std::string& name) const {
+    for (size_t i = 0; i < col_.size(); ++i) {
+      if (col_[i].name == name) return (int)i;
+    }
+    return -1;
+  }
+  int width(int c) const { return col_[c].width; }
+  const float* val(int c) const { return col_[c].val; }
+  /** \brief the lengths, NULL if the width is fixed */
+  const uint32_t* len(int c) const { return col_[c].len; }
+
+  static bool LittleEndian() { uint16_t x = 1; return *(uint8_t*)&x == 1; }
+
+  static const uint32_t kMagic = 0x4B43444D;  // "MDCK"
+  static const uint32_t kVersion = 1;
+
+ private:
+  struct Col {
+    std::string name;
+    int width;
+    const uint32_t* len;
+    const float* val;
+  };
+
+  void Parse(const std::string& file) {
+    size_t p = 0;
+    auto get = [this, &p, &file](size_t n) {
+      CHECK_LE(p + n, size_) << file << " is truncated";
+      const char* d = data_ + p; p += n;
+      return d;
+    };
+    uint32_t head[4];
+    memcpy(head, get(sizeof(head)), sizeof(head));
+    CHECK_EQ(head[0], (uint32_t)kMagic) << file << " is not a model chunk";
+    CHECK_LE(head[1], (uint32_t)kVersion)
+        << file << " has a newer version " << head[1];
+    uint64_t n; memcpy(&n, get(sizeof(n)), sizeof(n));
+    num_keys_ = n;
+    col_.resize(head[2]);
+    for (auto& c : col_) {
+      char name[9] = {0}; memcpy(name, get(8), 8);
+      uint32_t w[2]; memcpy(w, get(sizeof(w)), sizeof(w));
+      c.name = name; c.width = w[0];
+    }
+    get(Pad(p) - p);
+    key_ = reinterpret_cast<const uint64_t*>(get(n * sizeof(uint64_t)));
+    for (auto& c : col_) {
+      size_t m = n * c.width;
+      c.len = NULL;
+      if (c.width == 0) {
+        c.len = reinterpret_cast<const uint32_t*>(get(n * sizeof(uint32_t)));
+        get(Pad(p) - p);
+        m = 0;
+        for (size_t i = 0; i < n; ++i) m += c.len[i];
+      }
+      c.val = reinterpret_cast<const float*>(get(m * sizeof(float)));
+      get(Pad(p) - p);
+    }
+  }
+
+  static size_t Pad(size_t p) { return (p + 7) & ~(size_t)7; }
+
+  MappedFile file_;
+  const char* data_ = NULL;
+  size_t size_ = 0;
+  size_t num_keys_ = 0;
+  const uint64_t* key_ = NULL;
+  std::vector<Col> col_;
+};
+
+/**
+ * \brief Iterates the rows of a chunk, with the columns in a given order
+ */
+class ModelRowIter {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param chunk the chunk
+   * @param cols the columns to read, all of them must exist in the chunk with
+   * the same width
+   */
+  ModelRowIter(const ModelChunk& chunk, const std::vector<ModelColumn>& cols)
+      : chunk_(chunk), idx_(cols.size()), val_(cols.size()), len_(cols.size()) {
+    for (size_t j = 0; j < cols.size(); ++j) {
+      int c = chunk.Find(cols[j].name);
+      CHECK_GE(c, 0) << "column " << cols[j].name << " is not found";
+      CHECK_EQ(chunk.width(c), cols[j].width) << "column " << cols[j].name;
+      idx_[j] = c;
+    }
+  }
+
+  /** \brief moves to the next row, returns false if at the end */
+  bool Next() {
+    if (i_ == chunk_.size()) return false;
+    for (size_t j = 0; j < idx_.size(); ++j) {
+      int c = idx_[j];
+      if (i_ == 0) {
+        val_[j] = chunk_.val(c);
+      } else {
+        val_[j] += len_[j];
+      }
+      len_[j] = chunk_.width(c) ? chunk_.width(c) : chunk_.len(c)[i_];
+    }
+    key_ = chunk_.key()[i_ ++];
+    return true;
+  }
+
+  uint64_t key() const { return key_; }
+  /** \brief the values of the j-th column */
+  const float* const* val() const { return val_.data(); }
+  /** \brief the number of values of the j-th column */
+  const uint32_t* len() const { return len_.data(); }
+
+ private:
+  const ModelChunk& chunk_;
+  std::vector<int> idx_;
+  std::vector<const float*> val_;
+  std::vector<uint32_t> len_;
+  size_t i_ = 0;
+  uint64_t key_ = 0;
+};
+
+/**
+ * \brief The model of a server node stored in several chunk files
+ *
+ * An index file, which has the name given, lists the chunk files named
+ * name_chunk-i with their key ranges. The chunks are written and read by
+ * several threads concurrently. A reader only needs the chunks overlapping its
+ * key range, such as a server loading the models saved by a different number
+ * of servers.
+ */
+class ModelFile {
+ public:
+  /** \brief the information of a chunk */
+  struct Chunk {
+    uint64_t num_keys, min_key, max_key;
+  };
+
+  /**
+   * \brief returns true if name is the index file of this format
+   */
+  static bool Is(const std::string& name) {
+    Stream* fi = Stream::Create(name.c_str(), "r", true);
+    if (fi == NULL) return false;
+    uint32_t head[2] = {0, 0};
+    bool ret = fi->Read(head, sizeof(head)) == sizeof(head) &&
+               head[0] == kMagic;
+    delete fi;
+    return ret;
+  }
+
+  /**
+   * \brief writes a model
+   *
+   * @param name the name of the index file
+   * @param key the sorted keys
+   * @param cols the columns, only the names and widths are used
+   * @param num_threads the number of threads writing chunks, including the
+   * calling one
+   * @param fill fill(begin, end, cols) appends the values of key[begin, end)
+   * into cols. It is called concurrently with different cols
+   */
+  static void Write(
+      const std::string& name, const std::vector<uint64_t>& key,
+      const std::vector<ModelColumn>& cols, int num_threads,
+      const std::function<void(size_t, size_t,
+                               std::vector<ModelColumn>*)>& fill) {
+    CHECK(ModelChunk::LittleEndian());
+    size_t n = key.size();
+    size_t nc = std::max((n + kChunkKeys - 1) / kChunkKeys, (size_t)1);
+    std::vector<Chunk> chunks(nc);
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+      std::vector<ModelColumn> c = cols;
+      size_t i;
+      while ((i = next ++) < nc) {
+        size_t begin = n * i / nc, end = n * (i + 1) / nc;
+        for (auto& col : c) col.Clear();
+        fill(begin, end, &c);
+        WriteChunk(ChunkName(name, i), key.data() + begin, end - begin, c);
+        chunks[i].num_keys = end - begin;
+        chunks[i].min_key = end > begin ? key[begin] : 0;
+        chunks[i].max_key = end > begin ? key[end - 1] : 0;
+      }
+    };
+    std::vector<std::thread> thr;
+    int nt = std::min(num_threads, (int)nc);
+    for (int t = 1; t < nt; ++t) thr.emplace_back(run);
+    run();
+    for (auto& t : thr) t.join();
+
+    Stream* fo = CHECK_NOTNULL(Stream::Create(name.c_str(), "w"));
+    uint32_t head[4] = {kMagic, kVersion, (uint32_t)nc, 0};
+    uint64_t num_keys = n;
+    fo->Write(head, sizeof(head));
+    fo->Write(&num_keys, sizeof(num_keys));
+    fo->Write(chunks.data(), chunks.size() * sizeof(Chunk));
+    delete fo;
+  }
+
+  /**
+   * \brief reads the index file, returns the chunks
+   */
+  static std::vector<Chunk> ReadIndex(const std::string& name) {
+    Stream* fi = CHECK_NOTNULL(Stream::Create(name.c_str(), "r"));
+    uint32_t head[4]; uint64_t num_keys;
+    CHECK_EQ(fi->Read(head, sizeof(head)), sizeof(head));
+    CHECK_EQ(head[0], (uint32_t)kMagic) << name << " is not a model index";
+    CHECK_LE(head[1], (uint32_t)kVersion)
+        << name << " has a newer version " << head[1];
+    CHECK_EQ(fi->Read(&num_keys, sizeof(num_keys)), sizeof(num_keys));
+    std::vector<Chunk> chunks(head[2]);
+    size_t size = chunks.size() * sizeof(Chunk);
+    CHECK_EQ(fi->Read(chunks.data(), size), size) << name << " is truncated";
+    delete fi;
+    return chunks;
+  }
+
+  /**
+   * \brief returns the chunk files of the models with the index files names,
+   * which may have keys in [begin, end). The maximal key is included if end is
+   * the maximal key
+   */
+  static std::vector<std::string> ChunkFiles(
+      const std::vector<std::string>& names, uint64_t begin, uint64_t end) {
+    std::vector<std::string> files;
+    for (const auto& name : names) {
+      auto chunks = ReadIndex(name);
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        const auto& c = chunks[i];
+        if (c.num_keys == 0 || c.max_key < begin) continue;
+        if (c.min_key >= end && end != static_cast<uint64_t>(-1)) continue;
+        files.push_back(ChunkName(name, i));
+      }
+    }
+    return files;
+  }
+
+  /**
+   * \brief maps the chunk files concurrently, and runs fn(i, chunk) on the i-th
+   * of them by the thread mapping it
+   */
+  static void Read(
+      const std::vector<std::string>& files, int num_threads,
+      const std::function<void(size_t, const ModelChunk&)>& fn) {
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+      size_t i;
+      while ((i = next ++) < files.size()) {
+        ModelChunk chunk(files[i]);
+        fn(i, chunk);
+      }
+    };
+    std::vector<std::thread> thr;
+    int nt = std::min(num_threads, (int)files.size());
+    for (int t = 1; t < nt; ++t) thr.emplace_back(run);
+    run();
+    for (auto& t : thr) t.join();
+  }
+
+  static std::string ChunkName(const std::string& name, size_t i) {
+    return name + "_chunk-" + std::to_string(i);
+  }
+
+  static const uint32_t kMagic = 0x584D444D;  // "MDMX"
+  static const uint32_t kVersion = 1;
+  /** \brief the maximal number of keys in a chunk */
+  static const size_t kChunkKeys = 1 << 22;
+
+ private:
+  static void WriteChunk(const std::string& file, const uint64_t* key, size_t n,
+                         const std::vector<ModelColumn>& cols) {
+    Stream* fo = CHECK_NOTNULL(Stream::Create(file.c_str(), "w"));
+    size_t p = 0;
+    auto put = [fo, &p](const void* d, size_t size) {
+      fo->Write(d, size); p += size;
+    };
+    auto pad = [&put, &p]() {
+      static const char zero[8] = {0};
+      put(zero, ((p + 7) & ~(size_t)7) - p);
+    };
+    uint32_t head[4] = {ModelChunk::kMagic, ModelChunk::kVersion,
+                        (uint32_t)cols.size(), 0};
+    uint64_t num_keys = n;
+    put(head, sizeof(head));
+    put(&num_keys, sizeof(num_keys));
+    for (const auto& c : cols) {
+      char name[8] = {0}; memcpy(name, c.name.data(), c.name.size());
+      uint32_t w[2] = {(uint32_t)c.width, 0};
+      put(name, 8); put(w, sizeof(w));
+    }
+    pad();
+    put(key, n * sizeof(uint64_t));
+    for (const auto& c : cols) {
+      if (c.width == 0) {
+        CHECK_EQ(c.len.size(), n) << "column " << c.name;
+        put(c.len.data(), n * sizeof(uint32_t));
+        pad();
+      } else {
+        CHECK_EQ(c.val.size(), n * c.width) << "column " << c.name;
+      }
+      put(c.val.data(), c.val.size() * sizeof(float));
+      pad();
+    }
+    delete fo;
+  }
+};
+
+}  // namespace dmlc
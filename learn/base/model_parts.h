@@ -0,0 +1,193 @@
+/**
+ * @file   model_parts.h
+ * @brief  Read the nonzero weights and embeddings of a model saved by servers
+ */
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "base/model_file.h"
+#include "base/thread_pool.h"
+#include "base/parallel_sort.h"
+namespace dmlc {
+
+/**
+ * \brief The nonzero weights w and embeddings V of a model, with sorted keys
+ */
+struct SparseModel {
+  std::vector<uint64_t> w_key;
+  std::vector<float> w;
+  std::vector<uint64_t> V_key;
+  /** \brief dim values for each key in V_key */
+  std::vector<float> V;
+  int dim = 0;
+};
+
+/**
+ * \brief Reads all parts name_part-k of a model saved by the linear method or
+ * difacto, keeping only the nonzero w and V
+ *
+ * A part is either a ModelFile, which has the column w and, for difacto, V, or
+ * saved by the Save of the stores, whose format depends on the model type.
+ * The parts and chunks are read concurrently.
+ */
+class ModelPartReader {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param type linear or difacto, only used for the parts not in ModelFile
+   * @param l1_shrk difacto only. drop the embedding of a key whose w is 0, as
+   * difacto does not use it if l1_shrk is true
+   * @param num_threads the number of threads
+   */
+  ModelPartReader(const std::string& type, bool l1_shrk, int num_threads)
+      : type_(type), l1_shrk_(l1_shrk), nt_(std::max(num_threads, 1)) {
+    CHECK(type_ == "linear" || type_ == "difacto")
+        << "unknown model type " << type_;
+  }
+
+  /**
+   * \brief reads the model, an embedding shorter than the others is padded by
+   * 0, which does not change the prediction
+   */
+  void Read(const std::string& name, SparseModel* model) {
+    // find the parts, and the chunks of the parts in the binary format
+    std::vector<std::string> streams, chunks;
+    for (int i = 0; ; ++i) {
+      auto part = name + "_part-" + std::to_string(i);
+      Stream* fi = Stream::Create(part.c_str(), "r", true);
+      if (fi == NULL) break;
+      delete fi;
+      if (ModelFile::Is(part)) {
+        auto c = ModelFile::ChunkFiles({part}, 0, static_cast<uint64_t>(-1));
+        chunks.insert(chunks.end(), c.begin(), c.end());
+      } else {
+        streams.push_back(part);
+      }
+    }
+    CHECK(streams.size() + chunks.size()) << "cannot find " << name
+                                          << "_part-0";
+
+    // read them concurrently
+    std::vector<Entries> ent(streams.size() + chunks.size());
+    ModelFile::Read(chunks, nt_, [this, &ent](size_t i,
+                                              const ModelChunk& chunk) {
+        ReadChunk(chunk, &ent[i]);
+      });
+    ThreadPool pool(nt_);
+    pool.ParallelFor(streams.size(), [&](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          ReadStream(streams[i], &ent[chunks.size() + i]);
+        }
+      });
+
+    // merge and sort
+    using WPair = std::pair<uint64_t, float>;
+    // (key, (entries, i))
+    using VPair = std::pair<uint64_t, std::pair<uint32_t, uint32_t>>;
+    std::vector<WPair> w;
+    std::vector<VPair> V;
+    int dim = 0;
+    for (size_t i = 0; i < ent.size(); ++i) {
+      w.insert(w.end(), ent[i].w.begin(), ent[i].w.end());
+      ent[i].w.clear();
+      for (size_t j = 0; j < ent[i].V_key.size(); ++j) {
+        V.push_back(std::make_pair(ent[i].V_key[j], std::make_pair(i, j)));
+        dim = std::max(dim, (int)ent[i].V_len[j]);
+      }
+    }
+    ParallelSort(&w, &pool, [](const WPair& a, const WPair& b) {
+        return a.first < b.first;
+      });
+    ParallelSort(&V, &pool, [](const VPair& a, const VPair& b) {
+        return a.first < b.first;
+      });
+
+    model->w_key.resize(w.size());
+    model->w.resize(w.size());
+    for (size_t i = 0; i < w.size(); ++i) {
+      model->w_key[i] = w[i].first; model->w[i] = w[i].second;
+    }
+    model->dim = dim;
+    model->V_key.resize(V.size());
+    model->V.assign(V.size() * dim, 0);
+    for (size_t i = 0; i < V.size(); ++i) {
+      const auto& e = ent[V[i].second.first];
+      size_t j = V[i].second.second;
+      model->V_key[i] = V[i].first;
+      const float* v = e.V.data() + e.V_pos[j];
+      std::copy(v, v + e.V_len[j], model->V.data() + i * dim);
+    }
+  }
+
+ private:
+  // the nonzero entries read from a model part or chunk
+  struct Entries {
+    std::vector<std::pair<uint64_t, float>> w;
+    std::vector<uint64_t> V_key;
+    std::vector<size_t> V_pos;
+    std::vector<uint32_t> V_len;
+    std::vector<float> V;
+  };
+
+  void Add(uint64_t key, float w, const float* V, uint32_t n, Entries* ent) {
+    if (w != 0) ent->w.push_back(std::make_pair(key, w));
+    if (n == 0 || (w == 0 && l1_shrk_)) return;
+    bool zero = true;
+    for (uint32_t i = 0; i < n; ++i) if (V[i] != 0) zero = false;
+    if (zero) return;
+    ent->V_key.push_back(key);
+    ent->V_pos.push_back(ent->V.size());
+    ent->V_len.push_back(n);
+    ent->V.insert(ent->V.end(), V, V + n);
+  }
+
+  // reads a part saved by the Save of the stores
+  void ReadStream(const std::string& file, Entries* ent) {
+    Stream* fi = CHECK_NOTNULL(Stream::Create(file.c_str(), "r"));
+    uint64_t key;
+    while (fi->Read(&key, sizeof(key)) == sizeof(key)) {
+      if (type_ == "linear") {
+        float w;
+        CHECK_EQ(fi->Read(&w, sizeof(w)), sizeof(w)) << file
+                                                     << " is truncated";
+        Add(key, w, NULL, 0, ent);
+      } else {
+        // see difacto::AdaGradEntry::Save, w_0 is followed by 3 floats if
+        // size == 1
+        int size;
+        CHECK_EQ(fi->Read(&size, sizeof(size)), sizeof(size));
+        CHECK_GE(size, 1) << file << " is not a difacto model";
+        std::vector<float> w(size == 1 ? 4 : size * 2 + 1);
+        size_t n = w.size() * sizeof(float);
+        CHECK_EQ(fi->Read(w.data(), n), n) << file << " is truncated";
+        Add(key, w[0], w.data() + 1, size - 1, ent);
+      }
+    }
+    delete fi;
+  }
+
+  // reads a chunk of a ModelFile
+  void ReadChunk(const ModelChunk& chunk, Entries* ent) {
+    int w = chunk.Find("w"), V = chunk.Find("V");
+    CHECK_GE(w, 0) << "column w is not found";
+    CHECK_EQ(chunk.width(w), 1);
+    const float* v = V < 0 ? NULL : chunk.val(V);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      uint32_t n = 0;
+      if (V >= 0) n = chunk.width(V) ? chunk.width(V) : chunk.len(V)[i];
+      Add(chunk.key()[i], chunk.val(w)[i], v, n, ent);
+      v += n;
+    }
+  }
+
+  std::string type_;
+  bool l1_shrk_;
+  int nt_;
+};
+
+}  // namespace dmlc
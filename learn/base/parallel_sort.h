@@ -3,41 +3,51 @@
  * @brief  Parallel sort
  */
 #pragma once
-#include <thread>
 #include <vector>
 #include <algorithm>
 #include <dmlc/logging.h>
+#include "base/thread_pool.h"
 namespace dmlc {
 
-namespace {
-/// @brief the thread function
-template<typename T, class Fn>
-void ParallelSort_(T* data, size_t len, size_t grainsize, const Fn& cmp) {
-  if (len <= grainsize) {
-    std::sort(data, data + len, cmp);
-  } else {
-    std::thread thr(ParallelSort_<T, Fn>, data, len/2, grainsize, cmp);
-    ParallelSort_(data + len/2, len - len/2, grainsize, cmp);
-    thr.join();
-    std::inplace_merge(data, data + len/2, data + len, cmp);
-  }
-}
-}  // namespace
-
-
 /**
  * @brief Parallel Sort
  *
+ * the array is divided into segments which are sorted concurrently, and then
+ * merged pairwisely in log(#segments) rounds
+ *
  * @param arr the array for sorting
- * @param num_threads
+ * @param pool the thread pool
  * @param cmp the comparision function, such as [](const T& a, const T& b) {
  * return a < b; } or an even simplier version: std::less<T>()
  */
 template<typename T, class Fn>
-void ParallelSort(std::vector<T>* arr, int num_threads, const Fn& cmp) {
-  CHECK_GT(num_threads, 0);
-  size_t grainsize = std::max(arr->size() / num_threads + 5, (size_t)1024*16);
-  ParallelSort_(arr->data(), arr->size(), grainsize, cmp);
+void ParallelSort(std::vector<T>* arr, ThreadPool* pool, const Fn& cmp) {
+  CHECK_NOTNULL(pool);
+  T* data = arr->data();
+  size_t n = arr->size();
+  size_t grainsize = 1024*16;
+  int np = (int)std::min((size_t)pool->num_threads(), n / grainsize + 1);
+  std::vector<size_t> pos(np+1);
+  for (int i = 0; i < np; ++i) pos[i] = Range(0, n).Segment(i, np).begin;
+  pos[np] = n;
+
+  pool->ParallelFor(np, [data, &pos, &cmp](int, const Range& rg) {
+      for (size_t i = rg.begin; i < rg.end; ++i) {
+        std::sort(data + pos[i], data + pos[i+1], cmp);
+      }
+    });
+
+  for (int step = 1; step < np; step *= 2) {
+    size_t m = (np + 2 * step - 1) / (2 * step);
+    pool->ParallelFor(m, [data, &pos, &cmp, np, step](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          int b = (int)i * 2 * step;
+          int mid = std::min(b + step, np), e = std::min(b + 2 * step, np);
+          if (mid == e) continue;
+          std::inplace_merge(data + pos[b], data + pos[mid], data + pos[e], cmp);
+        }
+      });
+  }
 }
 
 }  // namespace dmlc
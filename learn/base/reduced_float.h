@@ -0,0 +1,142 @@
+/**
+ * @file   reduced_float.h
+ * @brief  Floating-point numbers stored with reduced precision
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+namespace dmlc {
+
+/**
+ * \brief IEEE 754 half precision: 1 sign, 5 exponent and 10 mantissa bits. The
+ * maximal value is 65504
+ */
+struct fp16 { uint16_t x = 0; };
+
+/**
+ * \brief bfloat16: the upper 16 bits of a float. It has the same range as
+ * float but only 8 mantissa bits
+ */
+struct bf16 { uint16_t x = 0; };
+
+/**
+ * \brief Converts between float and the storage type T. Only the storage is in
+ * reduced precision, the computation is always in float.
+ *
+ * Encode rounds to the nearest even.
+ */
+template <typename T> struct Real;
+
+template <> struct Real<float> {
+  static inline float Decode(float v) { return v; }
+  static inline float Encode(float v) { return v; }
+};
+
+template <> struct Real<bf16> {
+  static inline float Decode(bf16 v) {
+    uint32_t u = (uint32_t)v.x << 16;
+    float f; memcpy(&f, &u, sizeof(f));
+    return f;
+  }
+  static inline bf16 Encode(float f) {
+    uint32_t u; memcpy(&u, &f, sizeof(u));
+    bf16 v;
+    if ((u & 0x7FFFFFFF) > 0x7F800000) {
+      v.x = (u >> 16) | 0x40;  // keep nan quiet
+    } else {
+      v.x = (u + 0x7FFF + ((u >> 16) & 1)) >> 16;
+    }
+    return v;
+  }
+};
+
+template <> struct Real<fp16> {
+  static inline float Decode(fp16 v) {
+    uint32_t sign = (uint32_t)(v.x & 0x8000) << 16;
+    uint32_t exp = (v.x >> 10) & 0x1F, man = v.x & 0x3FF;
+    if (exp == 0) {
+      // zero or subnormal, namely man * 2^-24
+      float f = man * 5.9604644775390625e-8f;
+      return sign ? -f : f;
+    }
+    uint32_t u = sign | (man << 13) |
+        (exp == 0x1F ? 0x7F800000 : (exp + 127 - 15) << 23);
+    float f; memcpy(&f, &u, sizeof(f));
+    return f;
+  }
+
+  static inline fp16 Encode(float f) {
+    uint32_t u; memcpy(&u, &f, sizeof(u));
+    uint16_t sign = (u >> 16) & 0x8000;
+    u &= 0x7FFFFFFF;
+    fp16 v;
+    if (u >= 0x7F800000) {
+      // inf or nan
+      v.x = sign | (u > 0x7F800000 ? 0x7E00 : 0x7C00);
+    } else if (u >= 0x477FF000) {
+      // rounded to inf
+      v.x = sign | 0x7C00;
+    } else if (u < 0x38800000) {
+      // subnormal, let the hardware round it at the unit 2^-24 of 0.5f
+      float a; memcpy(&a, &u, sizeof(a));
+      a += .5f;
+      memcpy(&u, &a, sizeof(u));
+      v.x = sign | (u - 0x3F000000);
+    } else {
+      uint32_t odd = (u >> 13) & 1;
+      u += 0xFFF + odd - ((uint32_t)(127 - 15) << 23);
+      v.x = sign | (u >> 13);
+    }
+    return v;
+  }
+};
+
+/**
+ * \brief Rounds x to an int8 stochastically, namely to floor(x) with
+ * probability 1 - (x - floor(x)) and ceil(x) otherwise, so the rounding is
+ * unbiased. It is clipped into [-127, 127].
+ *
+ * @param x the value, often v / scale
+ * @param u a uniform random number in [0, 1)
+ */
+inline int8_t StochasticRound(float x, float u) {
+  float r = std::floor(x + u);
+  return (int8_t)(r > 127 ? 127 : (r < -127 ? -127 : r));
+}
+
+/**
+ * \brief A fast random number generator for stochastic rounding (xorshift32).
+ * It is not thread-safe
+ */
+class FastRand {
+ public:
+  explicit FastRand(uint32_t seed = 2463534242U) : s_(seed ? seed : 1) { }
+  /** \brief returns a uniform random number in [0, 1) */
+  inline float Uniform() {
+    s_ ^= s_ << 13; s_ ^= s_ >> 17; s_ ^= s_ << 5;
+    return (s_ >> 8) * (1.f / 16777216.f);
+  }
+ private:
+  uint32_t s_;
+};
+
+/** \brief the finalizer of splitmix64, which mixes the bits of x */
+inline uint64_t Mix64(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * \brief returns a uniform random number in [0, 1) determined by (key, i,
+ * seed). It has no state, so it is thread-safe and the same numbers are
+ * generated no matter in which order or on which machine they are asked
+ */
+inline float HashUniform(uint64_t key, uint64_t i, uint64_t seed) {
+  uint64_t x = Mix64(key + seed * 0x9E3779B97F4A7C15ULL);
+  x = Mix64(x ^ (i * 0xD6E8FEB86659FD93ULL));
+  return (x >> 40) * (1.f / 16777216.f);
+}
+
+}  // namespace dmlc
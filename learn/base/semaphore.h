@@ -0,0 +1,52 @@
+/**
+ * @file   semaphore.h
+ * @brief  A lightweight counting semaphore
+ */
+#pragma once
+#include <semaphore.h>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief A counting semaphore
+ *
+ * The count is kept in an atomic integer, so \ref Wait and \ref Post are a
+ * single atomic operation unless a thread actually needs to block or to be
+ * woken up. Only then the OS semaphore is touched.
+ */
+class Semaphore {
+ public:
+  explicit Semaphore(int count = 0) : count_(count) {
+    CHECK_GE(count, 0);
+    CHECK_EQ(sem_init(&sema_, 0, 0), 0);
+  }
+  ~Semaphore() { sem_destroy(&sema_); }
+
+  /**
+   * \brief decrease the count by one, block if it is not positive
+   */
+  void Wait() {
+    if (count_.fetch_sub(1, std::memory_order_acquire) > 0) return;
+    while (sem_wait(&sema_) != 0) {
+      CHECK_EQ(errno, EINTR);
+    }
+  }
+
+  /**
+   * \brief increase the count by n, and wake up the blocked threads if any
+   */
+  void Post(int n = 1) {
+    int old = count_.fetch_add(n, std::memory_order_release);
+    // a negative count is the number of blocked threads
+    for (int i = std::min(-old, n); i > 0; --i) sem_post(&sema_);
+  }
+
+ private:
+  std::atomic<int> count_;
+  sem_t sema_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,247 @@
+/**
+ * @file   serving_model.h
+ * @brief  A compact read-only model for prediction
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "dmlc/io.h"
+#include "dmlc/memory_io.h"
+#include "dmlc/logging.h"
+#include "base/model_file.h"
+#include "base/model_parts.h"
+#include "base/reduced_float.h"
+namespace dmlc {
+
+/**
+ * \brief A compact model for prediction, written by tool/export_model from the
+ * models saved by the linear method or difacto.
+ *
+ * It only has the nonzero weights w and the embeddings V, without the
+ * optimizer state, in float or fp16. The file is mapped by mmap, so it is
+ * shared by all processes on a machine and loaded lazily. The layout is
+ *
+ * - header: magic, version, flags, the embedding dimension
+ * - two tables, one for w and one for V. A table is n sorted keys as uint64,
+ *   and then n * width values. The keys have a radix index: the keys in [min,
+ *   max] are divided into buckets of 2^shift consecutive keys, and the index
+ *   stores the position of the first key of each bucket. So a lookup only
+ *   searches the few keys in a bucket.
+ *
+ * Each part is padded to 8 bytes, and all numbers are little-endian.
+ */
+class ServingModel {
+ public:
+  /**
+   * \brief maps a file written by Write
+   */
+  explicit ServingModel(const std::string& file) : file_(file, false) {
+    Parse(file);
+  }
+
+  /**
+   * \brief builds the model in memory, such as from the parts read by
+   * ModelPartReader
+   */
+  ServingModel(const SparseModel& model, bool fp16)
+      : file_(Serialize(model, fp16)) {
+    Parse("the model in memory");
+  }
+
+  /**
+   * \brief returns true if file is written by Write
+   */
+  static bool Is(const std::string& file) {
+    Stream* fi = Stream::Create(file.c_str(), "r", true);
+    if (fi == NULL) return false;
+    uint32_t magic = 0;
+    bool ret = fi->Read(&magic, sizeof(magic)) == sizeof(magic) &&
+               magic == kMagic;
+    delete fi;
+    return ret;
+  }
+
+  /** \brief the number of nonzero weights */
+  size_t num_w() const { return w_.n; }
+  /** \brief the number of embeddings */
+  size_t num_V() const { return V_.n; }
+  /** \brief the embedding dimension, 0 for a linear model */
+  int dim() const { return dim_; }
+
+  /** \brief returns the weight of a key, 0 if not found */
+  inline float w(uint64_t key) const {
+    size_t i = w_.Find(key);
+    return i == kNotFound ? 0 : Value(w_, i);
+  }
+
+  /**
+   * \brief returns the dim() values of the embedding of a key, or NULL if the
+   * key has no embedding
+   *
+   * The values in float are returned in place without copying, while the
+   * values in fp16 are decoded into buf, which has dim() elements.
+   */
+  inline const float* V(uint64_t key, float* buf) const {
+    size_t i = V_.Find(key);
+    if (i == kNotFound) return NULL;
+    if (!fp16_) return reinterpret_cast<const float*>(V_.val) + i * dim_;
+    for (int j = 0; j < dim_; ++j) buf[j] = Value(V_, i * dim_ + j);
+    return buf;
+  }
+
+  /**
+   * \brief writes a model into a file
+   *
+   * @param file the filename
+   * @param model the model with sorted keys
+   * @param fp16 stores the values in fp16 rather than float
+   */
+  static void Write(const std::string& file, const SparseModel& model,
+                    bool fp16) {
+    Stream* fo = CHECK_NOTNULL(Stream::Create(file.c_str(), "w"));
+    Write(fo, model, fp16);
+    delete fo;
+  }
+
+  static void Write(Stream* fo, const SparseModel& model, bool fp16) {
+    CHECK(ModelChunk::LittleEndian());
+    CHECK_EQ(model.w_key.size(), model.w.size());
+    CHECK_EQ(model.V_key.size() * model.dim, model.V.size());
+    auto put = [fo](const void* d, size_t n) {
+      static const char zero[8] = {0};
+      fo->Write(d, n);
+      fo->Write(zero, Pad(n) - n);
+    };
+    uint32_t head[4] = {kMagic, kVersion, fp16 ? kFP16 : 0,
+                        (uint32_t)model.dim};
+    put(head, sizeof(head));
+    for (int t = 0; t < 2; ++t) {
+      const auto& key = t == 0 ? model.w_key : model.V_key;
+      const auto& val = t == 0 ? model.w : model.V;
+      size_t n = key.size();
+      for (size_t i = 1; i < n; ++i) {
+        CHECK_LT(key[i-1], key[i]) << "the keys are not sorted";
+      }
+      uint64_t h[4] = {n, n ? key[0] : 0, n ? key[n-1] : 0, 0};
+      // about kBucketKeys keys per bucket. compare the last bucket rather than
+      // the number of buckets, which is 2^64 for keys 0 and 2^64-1 if shift = 0
+      size_t target = std::max(n / kBucketKeys, (size_t)1);
+      while (n && Bucket(h[2], h[1], h[3]) >= target) ++ h[3];
+      put(h, sizeof(h));
+      size_t nb = n ? NumBuckets(h[1], h[2], h[3]) : 0;
+      std::vector<uint64_t> pos(nb + 1);
+      size_t j = 0;
+      for (size_t b = 0; b < nb; ++b) {
+        pos[b] = j;
+        while (j < n && Bucket(key[j], h[1], h[3]) == b) ++ j;
+      }
+      pos[nb] = n;
+      put(pos.data(), pos.size() * sizeof(uint64_t));
+      put(key.data(), n * sizeof(uint64_t));
+      if (fp16) {
+        std::vector<uint16_t> v(val.size());
+        for (size_t i = 0; i < v.size(); ++i) {
+          v[i] = Real<dmlc::fp16>::Encode(val[i]).x;
+        }
+        put(v.data(), v.size() * sizeof(uint16_t));
+      } else {
+        put(val.data(), val.size() * sizeof(float));
+      }
+    }
+  }
+
+  static const uint32_t kMagic = 0x5653444D;  // "MDSV"
+  static const uint32_t kVersion = 1;
+  /** \brief the values are in fp16 */
+  static const uint32_t kFP16 = 1;
+
+ private:
+  static const size_t kNotFound = static_cast<size_t>(-1);
+  static const size_t kBucketKeys = 8;
+
+  struct Table {
+    uint64_t n = 0, min_key = 0, max_key = 0, shift = 0;
+    int width = 0;
+    const uint64_t* pos = NULL;
+    const uint64_t* key = NULL;
+    const char* val = NULL;
+
+    /** \brief returns the position of a key, kNotFound if not found */
+    inline size_t Find(uint64_t k) const {
+      if (n == 0 || k < min_key || k > max_key) return kNotFound;
+      uint64_t b = Bucket(k, min_key, shift);
+      const uint64_t* end = key + pos[b + 1];
+      const uint64_t* it = std::lower_bound(key + pos[b], end, k);
+      return it != end && *it == k ? it - key : kNotFound;
+    }
+  };
+
+  void Parse(const std::string& file) {
+    CHECK(ModelChunk::LittleEndian());
+    size_t p = 0;
+    auto get = [this, &p, &file](size_t n) {
+      CHECK_LE(p + n, file_.size()) << file << " is truncated";
+      const char* d = file_.data() + p; p += Pad(n);
+      return d;
+    };
+    uint32_t head[4];
+    memcpy(head, get(sizeof(head)), sizeof(head));
+    CHECK_EQ(head[0], (uint32_t)kMagic) << file << " is not a serving model";
+    CHECK_LE(head[1], (uint32_t)kVersion)
+        << file << " has a newer version " << head[1];
+    fp16_ = head[2] & kFP16;
+    dim_ = head[3];
+    for (int t = 0; t < 2; ++t) {
+      Table& tb = t == 0 ? w_ : V_;
+      uint64_t h[4];
+      memcpy(h, get(sizeof(h)), sizeof(h));
+      tb.n = h[0]; tb.min_key = h[1]; tb.max_key = h[2]; tb.shift = h[3];
+      tb.width = t == 0 ? 1 : dim_;
+      CHECK(tb.n == 0 || Bucket(tb.max_key, tb.min_key, tb.shift) < tb.n)
+          << file << " has a bad index";
+      size_t nb = tb.n ? NumBuckets(tb.min_key, tb.max_key, tb.shift) : 0;
+      tb.pos = reinterpret_cast<const uint64_t*>(
+          get((nb + 1) * sizeof(uint64_t)));
+      tb.key = reinterpret_cast<const uint64_t*>(get(tb.n * sizeof(uint64_t)));
+      tb.val = get(tb.n * tb.width * (fp16_ ? 2 : 4));
+    }
+  }
+
+  static std::string Serialize(const SparseModel& model, bool fp16) {
+    std::string buf;
+    MemoryStringStream fo(&buf);
+    Write(&fo, model, fp16);
+    return buf;
+  }
+
+  inline float Value(const Table& tb, size_t i) const {
+    if (fp16_) {
+      dmlc::fp16 v;
+      memcpy(&v.x, tb.val + i * 2, 2);
+      return Real<dmlc::fp16>::Decode(v);
+    }
+    float v;
+    memcpy(&v, tb.val + i * 4, 4);
+    return v;
+  }
+
+  static uint64_t Bucket(uint64_t k, uint64_t min_key, uint64_t shift) {
+    return shift >= 64 ? 0 : (k - min_key) >> shift;
+  }
+  // the last bucket must be less than 2^64-1
+  static size_t NumBuckets(uint64_t min_key, uint64_t max_key,
+                           uint64_t shift) {
+    return Bucket(max_key, min_key, shift) + 1;
+  }
+  static size_t Pad(size_t p) { return (p + 7) & ~(size_t)7; }
+
+  MappedFile file_;
+  bool fp16_ = false;
+  int dim_ = 0;
+  Table w_, V_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,86 @@
+/**
+ * @file   simd.h
+ * @brief  Vectorized math functions on float arrays
+ */
+#pragma once
+#include <stddef.h>
+#include <cmath>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+namespace dmlc {
+
+/**
+ * \brief y[i] = sqrt(x[i]) for i = 0, ..., n-1. x and y can be the same.
+ *
+ * The compiler does not vectorize std::sqrt unless errno is disabled, so it is
+ * written with the intrinsics. The results are identical to std::sqrt.
+ */
+inline void VecSqrt(const float* x, size_t n, float* y) {
+  size_t i = 0;
+#if defined(__AVX__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_sqrt_ps(_mm256_loadu_ps(x + i)));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(y + i, _mm_sqrt_ps(_mm_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; ++i) y[i] = std::sqrt(x[i]);
+}
+
+/**
+ * \brief y[i] += a * x[i] for i = 0, ..., n-1
+ */
+inline void VecAxpy(float a, const float* x, size_t n, float* y) {
+  size_t i = 0;
+#if defined(__AVX__)
+  __m256 a8 = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_add_ps(
+        _mm256_loadu_ps(y + i), _mm256_mul_ps(a8, _mm256_loadu_ps(x + i))));
+  }
+#endif
+#if defined(__SSE2__)
+  __m128 a4 = _mm_set1_ps(a);
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(y + i, _mm_add_ps(
+        _mm_loadu_ps(y + i), _mm_mul_ps(a4, _mm_loadu_ps(x + i))));
+  }
+#endif
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+/**
+ * \brief returns sum_i x[i] * y[i] for i = 0, ..., n-1
+ *
+ * The sum is accumulated in several lanes, so the result may differ from the
+ * sequential sum in the last bits.
+ */
+inline float VecDot(const float* x, const float* y, size_t n) {
+  size_t i = 0;
+  float s = 0;
+#if defined(__SSE2__)
+  __m128 s4 = _mm_setzero_ps();
+#if defined(__AVX__)
+  __m256 s8 = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    s8 = _mm256_add_ps(s8, _mm256_mul_ps(_mm256_loadu_ps(x + i),
+                                         _mm256_loadu_ps(y + i)));
+  }
+  s4 = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+#endif
+  for (; i + 4 <= n; i += 4) {
+    s4 = _mm_add_ps(s4, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+  }
+  float t[4];
+  _mm_storeu_ps(t, s4);
+  s = (t[0] + t[1]) + (t[2] + t[3]);
+#endif
+  for (; i < n; ++i) s += x[i] * y[i];
+  return s;
+}
+
+}  // namespace dmlc
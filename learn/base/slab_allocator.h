@@ -0,0 +1,220 @@
+/**
+ * @file   slab_allocator.h
+ * @brief  Fixed-size float blocks allocated from large pages
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief Allocates blocks of n floats from large pages, and addresses them by
+ * 32-bit handles rather than pointers
+ *
+ * A page has 2^\ref kPageBits blocks, so handle h is the (h & mask)-th block
+ * of the (h >> kPageBits)-th page. A freed block is put into a free list,
+ * which is linked through the first 4 bytes of the blocks, and reused by the
+ * next allocation. The pages are never released.
+ *
+ * Each thread allocates from and frees into its own cache, one of \ref
+ * kNumCaches free lists picked by a thread id, so the threads updating
+ * different stripes of a store do not wait for each other. A cache takes
+ * \ref kBatch blocks at a time from the shared free list or the pages when it
+ * is empty, and gives kBatch back when it has more than 2 * kBatch.
+ *
+ * Comparing to new float[n], a block has no malloc header and is not
+ * fragmented, and the blocks allocated in a row, such as by loading a model,
+ * are contiguous.
+ *
+ * \ref Alloc and \ref Free are thread-safe. \ref Get is lock-free, it is valid
+ * for a handle passed to the calling thread with a synchronization, such as a
+ * mutex, after it is allocated.
+ */
+class FloatSlab {
+ public:
+  static const int kPageBits = 16;
+  static const uint32_t kMaxPages = 1 << (32 - kPageBits);
+  /** \brief the number of caches */
+  static const int kNumCaches = 16;
+  /** \brief the number of blocks moved between a cache and the shared list */
+  static const uint32_t kBatch = 64;
+
+  explicit FloatSlab(int n) : n_(n) { CHECK_GT(n_, 0); }
+  ~FloatSlab() {
+    for (uint32_t i = 0; i < num_pages_; ++i) delete [] pages_[i];
+  }
+
+  /** \brief allocates a block, whose values are not initialized */
+  uint32_t Alloc() {
+    Cache& c = caches_[CacheID()];
+    std::lock_guard<std::mutex> lk(c.mu);
+    if (c.free == kNull) Refill(&c);
+    uint32_t h = c.free;
+    c.free = Next(h); -- c.size;
+    return h;
+  }
+
+  /** \brief frees a block */
+  void Free(uint32_t h) {
+    Cache& c = caches_[CacheID()];
+    std::lock_guard<std::mutex> lk(c.mu);
+    Next(h) = c.free;
+    c.free = h; ++ c.size;
+    if (c.size > 2 * kBatch) Release(&c);
+  }
+
+  /** \brief returns the address of a block */
+  inline float* Get(uint32_t h) const {
+    return pages_[h >> kPageBits] + (size_t)(h & kMask) * n_;
+  }
+
+  /** \brief the number of floats in a block */
+  int n() const { return n_; }
+
+  /** \brief the bytes of the allocated pages */
+  size_t bytes() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return ((size_t)num_pages_ * n_ * sizeof(float)) << kPageBits;
+  }
+
+ private:
+  static const uint32_t kMask = (1 << kPageBits) - 1;
+  // the end of the free list, which is never allocated
+  static const uint32_t kNull = static_cast<uint32_t>(-1);
+
+  // a free list of a few threads, padded to its own cache lines
+  struct Cache {
+    std::mutex mu;
+    uint32_t free = kNull;
+    uint32_t size = 0;
+    char pad[64];
+  };
+
+  // the cache of the calling thread
+  static int CacheID() {
+    static std::atomic<int> next(0);
+    static thread_local int id = next ++ % kNumCaches;
+    return id;
+  }
+
+  // the next one of a free block
+  inline uint32_t& Next(uint32_t h) const {
+    return *reinterpret_cast<uint32_t*>(Get(h));
+  }
+
+  // moves kBatch blocks from the shared free list, or new blocks, into the
+  // empty cache c
+  void Refill(Cache* c) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (free_ != kNull) {
+      // the shared list has whole batches
+      c->free = free_;
+      c->size = kBatch;
+      uint32_t h = free_;
+      for (uint32_t i = 1; i < kBatch; ++i) h = Next(h);
+      free_ = Next(h);
+      Next(h) = kNull;
+      return;
+    }
+    // new blocks in order, so the ones allocated in a row are contiguous
+    uint32_t m = 0;
+    for (; m < kBatch && next_ != kNull; ++m) {
+      if ((next_ >> kPageBits) == num_pages_) {
+        pages_[num_pages_++] = new float[(size_t)n_ << kPageBits];
+      }
+      ++ next_;
+    }
+    CHECK_GT(m, 0U) << "too many blocks";
+    for (uint32_t i = 0; i < m; ++i) {
+      uint32_t h = next_ - m + i;
+      Next(h) = i + 1 < m ? h + 1 : kNull;
+    }
+    c->free = next_ - m;
+    c->size = m;
+  }
+
+  // moves kBatch blocks from the cache c into the shared free list
+  void Release(Cache* c) {
+    uint32_t head = c->free, h = head;
+    for (uint32_t i = 1; i < kBatch; ++i) h = Next(h);
+    c->free = Next(h);
+    c->size -= kBatch;
+    std::lock_guard<std::mutex> lk(mu_);
+    Next(h) = free_;
+    free_ = head;
+  }
+
+  int n_;
+  float* pages_[kMaxPages];
+  uint32_t num_pages_ = 0;
+  // the next block never allocated
+  uint32_t next_ = 0;
+  // the shared free list, in batches of kBatch blocks
+  uint32_t free_ = kNull;
+  mutable std::mutex mu_;
+  Cache caches_[kNumCaches];
+};
+
+/**
+ * \brief A FloatSlab for each block size, created on the first allocation
+ *
+ * It can be a static variable, as it is constant initialized, and it is never
+ * destroyed, so the blocks can be freed at exit. A slab is created once and
+ * never replaced, so it is found without locking.
+ */
+class FloatSlabs {
+ public:
+  /** \brief the max block size */
+  static const int kMaxSize = 1 << 12;
+
+  constexpr FloatSlabs() : slab_() { }
+
+  /** \brief allocates a block with n floats */
+  uint32_t Alloc(int n) {
+    CHECK(n > 0 && n <= kMaxSize) << "invalid block size " << n;
+    FloatSlab* s = slab_[n].load(std::memory_order_acquire);
+    if (s == NULL) {
+      std::lock_guard<std::mutex> lk(mu_);
+      s = slab_[n].load(std::memory_order_relaxed);
+      if (s == NULL) {
+        s = new FloatSlab(n);
+        slab_[n].store(s, std::memory_order_release);
+      }
+    }
+    return s->Alloc();
+  }
+
+  /** \brief frees a block with n floats */
+  void Free(int n, uint32_t h) { Slab(n)->Free(h); }
+
+  /**
+   * \brief returns the address of a block with n floats
+   *
+   * The slab is created before the block is allocated, and the handle is
+   * passed with a synchronization, so a relaxed load sees it.
+   */
+  inline float* Get(int n, uint32_t h) const { return Slab(n)->Get(h); }
+
+  /** \brief the bytes of the allocated pages of all slabs */
+  size_t bytes() {
+    size_t b = 0;
+    for (const auto& s : slab_) {
+      FloatSlab* p = s.load(std::memory_order_acquire);
+      if (p) b += p->bytes();
+    }
+    return b;
+  }
+
+ private:
+  inline FloatSlab* Slab(int n) const {
+    return slab_[n].load(std::memory_order_relaxed);
+  }
+
+  std::atomic<FloatSlab*> slab_[kMaxSize + 1];
+  // serializes the creation of the slabs
+  std::mutex mu_;
+};
+
+}  // namespace dmlc
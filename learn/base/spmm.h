@@ -5,8 +5,7 @@
 #pragma once
 #include <cstring>
 #include "dmlc/data.h"
-#include "dmlc/omp.h"
-#include "base/spmv.h"  // for Range
+#include "base/thread_pool.h"
 
 namespace dmlc {
 
@@ -15,25 +14,24 @@ namespace dmlc {
  */
 class SpMM {
  public:
-  static const int kDefaultNT = 2;
   using SpMat = RowBlock<unsigned>;
 
   /** \brief y = D * x */
   template<typename V>
   static void Times(const SpMat& D, const std::vector<V>& x,
-                    std::vector<V>* y, int nt = kDefaultNT) {
+                    std::vector<V>* y, ThreadPool* pool) {
     if (x.empty()) return;
     CHECK_NOTNULL(y);
     int dim = (int)(y->size() / D.size);
-    Times<V>(D, x.data(), y->data(), dim, nt);
+    Times<V>(D, x.data(), y->data(), dim, pool);
   }
 
 
   /** \brief y = D^T * x */
   template<typename V>
   static void TransTimes(const SpMat& D, const std::vector<V>& x,
-                         std::vector<V>* y, int nt = kDefaultNT) {
-    TransTimes<V>(D, x, 0, std::vector<V>(), y, nt);
+                         std::vector<V>* y, ThreadPool* pool) {
+    TransTimes<V>(D, x, 0, std::vector<V>(), y, pool);
   }
 
   /** \brief y = D^T * x + p * z */
@@ -41,26 +39,22 @@ class SpMM {
   template<typename V>
   static void TransTimes(const SpMat& D, const std::vector<V>& x,
                          V p, const std::vector<V>& z,
-                         std::vector<V>* y, int nt = kDefaultNT) {
+                         std::vector<V>* y, ThreadPool* pool) {
     if (x.empty()) return;
     int dim = (int)(x.size() / D.size);
     if (z.size() == y->size() && p != 0) {
-      TransTimes<V>(D, x.data(), z.data(), p, y->data(), y->size(), dim, nt);
+      TransTimes<V>(D, x.data(), z.data(), p, y->data(), y->size(), dim, pool);
     } else {
-      TransTimes<V>(D, x.data(), NULL, 0, y->data(), y->size(), dim, nt);
+      TransTimes<V>(D, x.data(), NULL, 0, y->data(), y->size(), dim, pool);
     }
   }
  private:
   // y = D * x
   template<typename V>
   static void Times(const SpMat& D, const V* const x,
-                    V* y, int dim, int nt = kDefaultNT) {
+                    V* y, int dim, ThreadPool* pool) {
     memset(y, 0, D.size * dim * sizeof(V));
-#pragma omp parallel num_threads(nt)
-    {
-      Range rg = Range(0, D.size).Segment(
-          omp_get_thread_num(), omp_get_num_threads());
-
+    pool->ParallelFor(D.size, [&D, x, y, dim](int, const Range& rg) {
       for (size_t i = rg.begin; i < rg.end; ++i) {
         if (D.offset[i] == D.offset[i+1]) continue;
         V* y_i = y + i * dim;
@@ -77,7 +71,7 @@ class SpMM {
           }
         }
       }
-    }
+    });
   }
 
   // y = D' * x
@@ -85,18 +79,14 @@ class SpMM {
   static void TransTimes(const SpMat& D, const V* const x,
                          const V* const z, V p,
                          V* y, size_t y_size, int dim,
-                         int nt = kDefaultNT) {
+                         ThreadPool* pool) {
     if (z) {
       for (size_t i = 0; i < y_size; ++i) y[i] = z[i] * p;
     } else {
       memset(y, 0, y_size*sizeof(V));
     }
 
-#pragma omp parallel num_threads(nt)
-    {
-      Range rg = Range(0, y_size/dim).Segment(
-          omp_get_thread_num(), omp_get_num_threads());
-
+    pool->ParallelFor(y_size/dim, [&D, x, y, dim](int, const Range& rg) {
       for (size_t i = 0; i < D.size; ++i) {
         if (D.offset[i] == D.offset[i+1]) continue;
         V const * x_i = x + i * dim;
@@ -119,7 +109,7 @@ class SpMM {
           }
         }
       }
-    }
+    });
   }
 };
 
@@ -0,0 +1,160 @@
+/**
+ * @file   thread_pool.h
+ * @brief  A thread pool shared by the computations of a node
+ */
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "dmlc/logging.h"
+#include "base/range.h"
+namespace dmlc {
+
+/**
+ * \brief A fixed size thread pool for data parallel kernels
+ *
+ * A node, such as a worker processing several minibatches at the same time,
+ * owns a single pool, and all its kernels submit work to it via \ref
+ * ParallelFor. Comparing to open a new openmp region for each kernel, the
+ * number of computing threads is bounded no matter how many kernels are
+ * running concurrently.
+ *
+ * A pool with n threads starts n - 1 threads, the thread calling \ref
+ * ParallelFor works on its own job as the n-th one. So a single job uses all
+ * threads, and a job never waits for an idle thread to make progress.
+ */
+class ThreadPool {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param num_threads the number of threads, including the calling thread
+   * @param pin_cores if true, the i-th thread is pinned to the i-th core
+   */
+  explicit ThreadPool(int num_threads, bool pin_cores = false)
+      : nt_(std::max(num_threads, 1)) {
+    for (int i = 1; i < nt_; ++i) {
+      thr_.emplace_back(&ThreadPool::RunWorker, this);
+      if (pin_cores) PinCore(thr_.back().native_handle(), i);
+    }
+  }
+
+  ~ThreadPool() {
+    mu_.lock(); done_ = true; mu_.unlock();
+    cond_.notify_all();
+    for (auto& t : thr_) t.join();
+  }
+
+  /**
+   * \brief returns the number of threads, which is also the maximal number of
+   * segments of \ref ParallelFor
+   */
+  int num_threads() const { return nt_; }
+
+  /**
+   * \brief the function running on a segment. it takes the segment id and the
+   * segment range
+   */
+  using Fn = std::function<void(int, const Range&)>;
+
+  /**
+   * \brief evenly divide [0, n) into segments, and run fn on each segment
+   * concurrently. it returns when all segments are done
+   *
+   * @param n the size of the range
+   * @param fn the function, it is called with the segment id in [0,
+   * num_threads()), so it can be used to store the partial results such as
+   * for a sum reduction
+   * @param grain the minimal segment size
+   */
+  void ParallelFor(size_t n, const Fn& fn, size_t grain = 1) {
+    if (n == 0) return;
+    int np = (int)std::min((size_t)nt_, std::max(n / std::max(grain, (size_t)1),
+                                                 (size_t)1));
+    if (np == 1) { fn(0, Range(0, n)); return; }
+
+    Job job; job.fn = &fn; job.rg = Range(0, n); job.np = np;
+    mu_.lock(); jobs_.push_back(&job); mu_.unlock();
+    cond_.notify_all();
+
+    // work on my own job
+    int i;
+    while ((i = Claim(&job)) >= 0) Run(&job, i);
+
+    std::unique_lock<std::mutex> lk(job.mu);
+    job.cond.wait(lk, [&job] { return job.done == job.np; });
+  }
+
+ private:
+  struct Job {
+    Fn const* fn;
+    Range rg;
+    int np;
+    // the next segment to run, protected by ThreadPool::mu_
+    int next = 0;
+    // the number of finished segments
+    int done = 0;
+    std::mutex mu;
+    std::condition_variable cond;
+  };
+
+  // claim a segment of a job, returns -1 if all have been claimed
+  int Claim(Job* job) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (job->next == job->np) return -1;
+    int i = job->next ++;
+    if (job->next == job->np) jobs_.remove(job);
+    return i;
+  }
+
+  void Run(Job* job, int i) {
+    (*job->fn)(i, job->rg.Segment(i, job->np));
+    // the job may be freed by the caller once done == np, so do not touch it
+    // after releasing the lock
+    std::lock_guard<std::mutex> lk(job->mu);
+    if (++ job->done == job->np) job->cond.notify_all();
+  }
+
+  void RunWorker() {
+    while (true) {
+      Job* job; int i;
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cond_.wait(lk, [this] { return done_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        job = jobs_.front();
+        i = job->next ++;
+        if (job->next == job->np) jobs_.pop_front();
+      }
+      Run(job, i);
+    }
+  }
+
+  static void PinCore(std::thread::native_handle_type thr, int i) {
+#ifdef __linux__
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(i % std::max(std::thread::hardware_concurrency(), 1U), &cpu);
+    if (pthread_setaffinity_np(thr, sizeof(cpu), &cpu) != 0) {
+      LOG(WARNING) << "failed to pin thread " << i << " to a core";
+    }
+#else
+    LOG(WARNING) << "pinning threads to cores is not supported";
+#endif
+  }
+
+  int nt_;
+  bool done_ = false;
+  std::mutex mu_;
+  std::condition_variable cond_;
+  std::list<Job*> jobs_;
+  std::vector<std::thread> thr_;
+};
+
+}  // namespace dmlc
@@ -0,0 +1,155 @@
+/**
+ * @file   weight_cache.h
+ * @brief  A worker-side cache of the pulled weights
+ */
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "dmlc/logging.h"
+namespace dmlc {
+
+/**
+ * \brief Caches the weights pulled from the servers with bounded staleness
+ *
+ * The cache has a clock which is ticked once for each minibatch. A weight
+ * pulled by the minibatch at clock c can be reused by the minibatches at clock
+ * c+1, ..., c+staleness, after that it must be pulled again. For power-law
+ * data, where the same hot keys appear in almost every minibatch, it saves most
+ * of the pulled bytes and the server load.
+ *
+ * It is thread-safe. Keys are distributed among several shards, each of which
+ * has its own lock.
+ *
+ * \tparam K the key type
+ * \tparam V the value type
+ */
+template <typename K, typename V>
+class WeightCache {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param staleness the maximal number of minibatches a weight can be reused
+   * @param capacity the maximal number of cached keys
+   */
+  WeightCache(int staleness, size_t capacity)
+      : staleness_(staleness), capacity_(capacity / kNumShards + 1) {
+    CHECK_GT(staleness, 0);
+  }
+  ~WeightCache() { }
+
+  /**
+   * \brief starts a new minibatch, returns its clock
+   */
+  int64_t Tick() { return ++ clock_; }
+
+  /**
+   * \brief lookups the keys
+   *
+   * @param clock the clock of the current minibatch
+   * @param keys the keys
+   * @param val the values, the i-th one is filled if keys[i] is hit. it must
+   * have the same size as keys
+   * @param miss the keys missed or stale
+   * @param miss_pos the positions of the missed keys in \a keys
+   */
+  void Get(int64_t clock, const std::vector<K>& keys, std::vector<V>* val,
+           std::vector<K>* miss, std::vector<size_t>* miss_pos) {
+    CHECK_EQ(keys.size(), val->size());
+    std::vector<unsigned char> hit(keys.size(), 0);
+    ForEachShard(keys, [this, clock, &keys, val, &hit](
+        Shard* s, const std::vector<size_t>& pos) {
+      for (size_t i : pos) {
+        auto it = s->map.find(keys[i]);
+        if (it == s->map.end() ||
+            clock - it->second.clock > staleness_) continue;
+        (*val)[i] = it->second.val; hit[i] = 1;
+      }
+    });
+    miss->clear(); miss_pos->clear();
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (hit[i]) continue;
+      miss->push_back(keys[i]); miss_pos->push_back(i);
+    }
+    num_hit_ += keys.size() - miss->size();
+    num_miss_ += miss->size();
+  }
+
+  /**
+   * \brief inserts the pulled values
+   *
+   * @param clock the clock of the minibatch pulled the values
+   * @param keys the keys
+   * @param val the values
+   */
+  void Put(int64_t clock, const std::vector<K>& keys, const V* val) {
+    ForEachShard(keys, [this, clock, &keys, val](
+        Shard* s, const std::vector<size_t>& pos) {
+      if (s->map.size() + pos.size() > capacity_) Purge(s);
+      for (size_t i : pos) {
+        auto it = s->map.find(keys[i]);
+        if (it != s->map.end()) {
+          if (it->second.clock < clock) it->second = Entry{val[i], clock};
+        } else if (s->map.size() < capacity_) {
+          s->map[keys[i]] = Entry{val[i], clock};
+        }
+      }
+    });
+  }
+
+  /**
+   * \brief returns the hit ratio since the beginning
+   */
+  double HitRatio() const {
+    double n = (double)(num_hit_ + num_miss_);
+    return n == 0 ? 0 : num_hit_ / n;
+  }
+
+ private:
+  static const int kNumShards = 16;
+  struct Entry { V val; int64_t clock; };
+  struct Shard {
+    std::mutex mu;
+    std::unordered_map<K, Entry> map;
+  };
+
+  // call fn(shard, positions of keys in this shard) with the shard locked
+  template <typename Fn>
+  void ForEachShard(const std::vector<K>& keys, const Fn& fn) {
+    std::vector<size_t> pos[kNumShards];
+    for (size_t i = 0; i < keys.size(); ++i) {
+      pos[ShardID(keys[i])].push_back(i);
+    }
+    for (int i = 0; i < kNumShards; ++i) {
+      if (pos[i].empty()) continue;
+      std::lock_guard<std::mutex> lk(shards_[i].mu);
+      fn(&shards_[i], pos[i]);
+    }
+  }
+
+  // remove the entries cannot be reused anymore
+  void Purge(Shard* s) {
+    int64_t clock = clock_;
+    for (auto it = s->map.begin(); it != s->map.end(); ) {
+      if (clock - it->second.clock > staleness_) {
+        it = s->map.erase(it);
+      } else {
+        ++ it;
+      }
+    }
+  }
+
+  static int ShardID(K key) {
+    return (int)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 60) % kNumShards;
+  }
+
+  int staleness_;
+  size_t capacity_;
+  std::atomic<int64_t> clock_{0};
+  std::atomic<uint64_t> num_hit_{0}, num_miss_{0};
+  Shard shards_[kNumShards];
+};
+
+}  // namespace dmlc
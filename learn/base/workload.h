@@ -32,11 +32,19 @@ struct Workload : public Serializable {
           = filename + " " + std::to_string(k) + " / " + std::to_string(n);
       return ret;
     }
+
+    bool operator==(const File& other) const {
+      return filename == other.filename && n == other.n && k == other.k;
+    }
   };
 
   /// \brief files needed to be processed
   std::vector<File> file;
 
+  /// \brief files of the next workload already assigned to this worker. the
+  /// worker can start to read them while processing \a file
+  std::vector<File> prefetch;
+
   std::string ShortDebugString() const {
     std::stringstream ss;
     ss << "iter = " << data_pass << ", "
@@ -53,6 +61,19 @@ struct Workload : public Serializable {
   virtual void Load(Stream* fi) {
     fi->Read(&type, sizeof(type));
     fi->Read(&data_pass, sizeof(data_pass));
+    LoadFiles(fi, &file);
+    LoadFiles(fi, &prefetch);
+  }
+
+  virtual void Save(Stream *fo) const {
+    fo->Write(&type, sizeof(type));
+    fo->Write(&data_pass, sizeof(data_pass));
+    SaveFiles(fo, file);
+    SaveFiles(fo, prefetch);
+  }
+
+ private:
+  static void LoadFiles(Stream* fi, std::vector<File>* files) {
     size_t num;
     fi->Read(&num, sizeof(num));
     for (size_t i = 0; i < num; ++i) {
@@ -61,16 +82,14 @@ struct Workload : public Serializable {
       fi->Read(&f.format);
       fi->Read(&f.n, sizeof(f.n));
       fi->Read(&f.k, sizeof(f.k));
-      file.push_back(f);
+      files->push_back(f);
     }
   }
 
-  virtual void Save(Stream *fo) const {
-    fo->Write(&type, sizeof(type));
-    fo->Write(&data_pass, sizeof(data_pass));
-    size_t num = file.size();
+  static void SaveFiles(Stream* fo, const std::vector<File>& files) {
+    size_t num = files.size();
     fo->Write(&num, sizeof(num));
-    for (const auto& f : file) {
+    for (const auto& f : files) {
       fo->Write(f.filename);
       fo->Write(f.format);
       fo->Write(&f.n, sizeof(f.n));
@@ -42,8 +42,11 @@ class WorkloadPool {
   }
 
 
-  void Init(bool shuffle, int timeout) {
-    // TODO
+  void Init(bool shuffle, int timeout, int num_file_per_wl = 1) {
+    // TODO timeout
+    std::lock_guard<std::mutex> lk(mu_);
+    shuffle_ = shuffle;
+    num_file_per_wl_ = std::max(num_file_per_wl, 1);
   }
 
   void Add(const std::vector<Workload::File>& files, int npart,
@@ -66,6 +69,7 @@ class WorkloadPool {
     assigned_.clear();
     inited_ = false;
     time_.clear();
+    released_.clear();
     num_finished_ = 0;
   }
 
@@ -74,23 +78,98 @@ class WorkloadPool {
     task_.clear();
   }
 
+  /**
+   * \brief assign a new workload to node id
+   *
+   * a node can hold several workloads at the same time, which are then
+   * processed in the order of assignment. only the first one is timed for
+   * straggler detection, the others start to be timed once the previous one is
+   * finished.
+   */
   void Get(const std::string& id, Workload* wl) {
     std::lock_guard<std::mutex> lk(mu_);
     wl->file.clear();
+    bool active = true;
+    for (const auto& a : assigned_) {
+      if (a.node == id && !a.straggler) { active = false; break; }
+    }
     for (int i = 0; i < num_file_per_wl_; ++i) {
-      GetOne(id, wl);
+      GetOne(id, num_wl_, active, wl);
     }
+    ++ num_wl_;
   }
 
   // id dies
-  void Reset(const std::string& id) { Set(id, false); }
+  void Reset(const std::string& id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = assigned_.begin();
+    while (it != assigned_.end()) {
+      if (it->node == id) {
+        // a straggler's workload has already been given back
+        if (!it->straggler) Mark(it->filename, it->k, 0);
+        LOG(INFO) << id << " failed to finish workload " << it->DebugStr();
+        it = assigned_.erase(it);
+      } else {
+        ++ it;
+      }
+    }
+    released_.erase(id);
+  }
+
+  // id finished the earliest workload it got before
+  void Finish(const std::string& id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    int wl_id = -1;
+    for (const auto& a : assigned_) {
+      if (a.node == id && (wl_id < 0 || a.wl_id < wl_id)) wl_id = a.wl_id;
+    }
+    if (wl_id < 0) return;
+
+    double cur_t = GetTime();
+    int next_id = -1;
+    auto it = assigned_.begin();
+    while (it != assigned_.end()) {
+      if (it->node != id) { ++ it; continue; }
+      if (it->wl_id != wl_id) {
+        if (next_id < 0 || it->wl_id < next_id) next_id = it->wl_id;
+        ++ it; continue;
+      }
+      double time = cur_t - it->start;
+      if (!it->straggler) time_.push_back(time);
+      Mark(it->filename, it->k, 2);
+      LOG(INFO) << id << " finished " << it->DebugStr()
+                << " in " << time << " sec.";
+      it = assigned_.erase(it);
+
+      size_t as = assigned_.size();
+      if (as < 5) {
+        std::string nodes;
+        for (const auto& a : assigned_) nodes += " " + a.node;
+        LOG(INFO) << "the last " << as << " jobs:" << nodes;
+      }
+    }
+
+    // the node starts to process the next workload now
+    for (auto& a : assigned_) {
+      if (a.node == id && a.wl_id == next_id) {
+        a.active = true; a.start = cur_t;
+      }
+    }
+  }
 
-  // id finished the workload it got before
-  void Finish(const std::string& id) { Set(id, true); }
+  /**
+   * \brief returns true if the workloads assigned ahead to node id have been
+   * given back since the last call, because its current one is a straggler.
+   * the caller then should drop the ones it has not sent to the node
+   */
+  bool TakeReleased(const std::string& id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    return released_.erase(id) > 0;
+  }
 
   bool IsFinished() {
     std::lock_guard<std::mutex> lk(mu_);
-    return (inited_ && task_.empty() && assigned_.empty());
+    return (inited_ && task_.empty() && NumAssigned() == 0);
   }
 
   int num_finished() {
@@ -99,40 +178,19 @@ class WorkloadPool {
   }
   int num_assigned() {
     std::lock_guard<std::mutex> lk(mu_);
-    return assigned_.size();
+    return NumAssigned();
   }
 
  private:
-  void Set(const std::string& id, bool del) {
-    std::lock_guard<std::mutex> lk(mu_);
-    auto it = assigned_.begin();
-    while (it != assigned_.end()) {
-      if (it->node == id) {
-        if (!del) {
-          Mark(it->filename, it->k, 0);
-          LOG(INFO) << id << " failed to finish workload " << it->DebugStr();
-        } else {
-          double time = GetTime() - it->start;
-          time_.push_back(time);
-          Mark(it->filename, it->k, 2);
-          LOG(INFO) << id << " finished " << it->DebugStr()
-                    << " in " << time << " sec.";
-        }
-        it = assigned_.erase(it);
-
-        size_t as = assigned_.size();
-        if (as < 5) {
-          std::string nodes;
-          for (const auto& a : assigned_) nodes += " " + a.node;
-          LOG(INFO) << "the last " << as << " jobs:" << nodes;
-        }
-      } else {
-        ++ it;
-      }
-    }
+  // the number of assigned parts, not including the ones given back by
+  // stragglers
+  int NumAssigned() {
+    int n = 0;
+    for (const auto& a : assigned_) if (!a.straggler) ++ n;
+    return n;
   }
 
-  void GetOne(const std::string& id, Workload* wl) {
+  void GetOne(const std::string& id, int wl_id, bool active, Workload* wl) {
     int pick = 0;
     if (shuffle_) {
       int n = 0;
@@ -163,6 +221,8 @@ class WorkloadPool {
         a.node     = id;
         a.k        = (int)k;
         a.n        = (int)t.track.size();
+        a.wl_id    = wl_id;
+        a.active   = active;
         assigned_.push_back(a);
         wl->file.push_back(a.Get());
         LOG(INFO) << "assign " << id << " job " << a.DebugStr()
@@ -180,20 +240,35 @@ class WorkloadPool {
     for (double t : time_) mean += t;
     mean /= time_.size();
     double cur_t = GetTime();
-    auto it = assigned_.begin();
-    while (it != assigned_.end()) {
-      double t = cur_t - it->start;
+    std::unordered_set<std::string> slow;
+    for (auto& a : assigned_) {
+      // skip the ones assigned ahead, the node has not started them yet
+      if (!a.active || a.straggler) continue;
+      double t = cur_t - a.start;
       if (t > std::max(mean * 2, (double)5)) {
-        LOG(INFO) << it->node << " is processing "
-                  << it->DebugStr() << " for " << t
+        LOG(INFO) << a.node << " is processing "
+                  << a.DebugStr() << " for " << t
                   << " sec, which is much longer than the average time "
                   << mean << " sec. reassign this workload to other nodes";
-        Mark(it->filename, it->k, 0);
-        it = assigned_.erase(it);
-      } else {
-        ++ it;
+        Mark(a.filename, a.k, 0);
+        // keep it until the node finishes it, so the finish order of this
+        // node still matches its assignment order
+        a.straggler = true;
+        slow.insert(a.node);
       }
     }
+
+    // the node will not start the ones assigned ahead before it finishes the
+    // slow one, so give them back too
+    auto it = assigned_.begin();
+    while (it != assigned_.end()) {
+      if (it->active || slow.count(it->node) == 0) { ++ it; continue; }
+      LOG(INFO) << "reassign " << it->DebugStr() << " assigned ahead to "
+                << it->node;
+      Mark(it->filename, it->k, 0);
+      released_.insert(it->node);
+      it = assigned_.erase(it);
+    }
   }
 
 
@@ -214,6 +289,8 @@ class WorkloadPool {
 
   int num_file_per_wl_ = 1;
   int num_finished_ = 0;
+  // the id of the next workload
+  int num_wl_ = 0;
 
   struct Task {
     // capable nodes
@@ -229,6 +306,9 @@ class WorkloadPool {
     std::string filename;
     std::string node;
     int n, k;
+    int wl_id;     // parts assigned by the same Get share the same id
+    bool active;   // false if still waiting for the previous workloads
+    bool straggler = false;  // true if it has been reassigned
     double start;  // start time
     Workload::File Get() {
       Workload::File f;
@@ -243,6 +323,8 @@ class WorkloadPool {
   };
 
   std::list<Assigned> assigned_;
+  // the nodes whose workloads assigned ahead have been given back
+  std::unordered_set<std::string> released_;
 
   bool inited_ = false, done_ = false;
 
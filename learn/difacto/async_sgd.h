@@ -1,8 +1,15 @@
 #pragma once
+#include <type_traits>
+#include <atomic>
 #include "progress.h"
 #include "config.pb.h"
 #include "loss.h"
+#include "sparse_store.h"
 #include "base/localizer.h"
+#include "base/grad_aggregator.h"
+#include "base/reduced_float.h"
+#include "base/simd.h"
+#include "base/slab_allocator.h"
 #include "solver/minibatch_solver.h"
 
 namespace dmlc {
@@ -18,6 +25,9 @@ class AsyncScheduler : public solver::MinibatchScheduler {
       CHECK(conf_.val_data().size()) << "early stop needs validation dataset";
     }
     Init(conf);
+    if (conf_.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf_.print_sec());
+    }
   }
   virtual ~AsyncScheduler() { }
 
@@ -66,18 +76,30 @@ struct ISGDHandle {
   inline void Start(bool push, int timestamp, int cmd, void* msg) {
     push_count = (push && (cmd == kPushFeaCnt)) ? true : false;
     perf_.Start(push, cmd);
+    if (latency) { push_ = push; start_ = GetTime(); }
   }
 
   inline void Report() {
     // reduce communication frequency
     ++ ct_;
     if (ct_ >= ns_ && reporter) {
-      Progress prog; prog.new_w() = new_w; prog.new_V() = new_V; reporter(prog);
-      new_w = 0; new_V = 0;ct_ = 0;
+      Progress prog;
+      prog.new_w() = new_w.exchange(0); prog.new_V() = new_V.exchange(0);
+      prog.reclaimed() = reclaimed.exchange(0);
+      prog.dropped_V() = dropped_V.exchange(0); reporter(prog);
+      ct_ = 0;
     }
   }
 
-  inline void Finish() { Report(); perf_.Stop(); }
+  inline void Finish() {
+    if (latency) {
+      latency->Add(push_ ? LatencyMonitor::kServerPush :
+                   LatencyMonitor::kServerPull, GetTime() - start_);
+      Progress prog;
+      if (latency->Report(&prog.data) && reporter) reporter(prog);
+    }
+    Report(); perf_.Stop();
+  }
 
   // for w
   float lambda_l1 = 0, lambda_l2 = 0;
@@ -91,15 +113,38 @@ struct ISGDHandle {
     float alpha = .01, beta = 1;
     float V_min = -.01, V_max = .01;
   };
-  Embedding V;
+  /// \brief the embedding tiers, with increasing thresholds and dims
+  std::vector<Embedding> V;
   bool l1_shrk;
+  /// \brief whether the entries may be evicted
+  bool evict = false;
+  /// \brief the seed of the initial values of V, see AdaGradHandle::Resize
+  uint64_t init_seed = 0;
+
+  /// \brief the tier of an embedding with n values, namely the last one with
+  /// dim <= n, or the first one if n is smaller than all dims
+  inline const Embedding& Tier(int n) const {
+    CHECK(!V.empty());
+    size_t i = 0;
+    while (i + 1 < V.size() && V[i+1].dim <= n) ++i;
+    return V[i];
+  }
 
   // statistic
   bool push_count;
-  static int64_t new_w;
-  static int64_t new_V;
+  /// atomic, as the entries may be updated by several threads
+  static std::atomic<int64_t> new_w;
+  static std::atomic<int64_t> new_V;
+  /// \brief bytes freed by evicting entries
+  static std::atomic<int64_t> reclaimed;
+  /// \brief the pushes of V gradients longer than their entries, see
+  /// AdaGradHandle::Push
+  static std::atomic<int64_t> dropped_V;
   std::function<void(const Progress& prog)> reporter;
 
+  /// \brief if not NULL, record the time of handling requests
+  LatencyMonitor* latency = NULL;
+
   void Load(Stream* fi) { }
   void Save(Stream *fo) const { }
 
@@ -127,55 +172,157 @@ struct ISGDHandle {
   } perf_;
 
   int ct_ = 0, ns_ = 0;
+  bool push_ = false;
+  double start_ = 0;
 };
 
+template <typename T> struct AccumType { using type = T; };
+template <> struct AccumType<int8_t> { using type = fp16; };
+
+/**
+ * \brief decodes the n values of V stored after the header of w
+ */
+template <typename T>
+inline void DecodeV(const float* w, int n, float* v) {
+  const T* x = reinterpret_cast<const T*>(w + 1);
+  for (int i = 0; i < n; ++i) v[i] = Real<T>::Decode(x[i]);
+}
+
+template <>
+inline void DecodeV<int8_t>(const float* w, int n, float* v) {
+  float scale = w[1];
+  const int8_t* x = reinterpret_cast<const int8_t*>(w + 2);
+  for (int i = 0; i < n; ++i) v[i] = x[i] * scale;
+}
+
+/**
+ * \brief encodes the n values of V after the header of w
+ */
+template <typename T>
+inline void EncodeV(const float* v, int n, float* w, FastRand* rnd) {
+  T* x = reinterpret_cast<T*>(w + 1);
+  for (int i = 0; i < n; ++i) x[i] = Real<T>::Encode(v[i]);
+}
+
+/**
+ * \brief int8 with a per-key scale max_i |v_i| / 127 and stochastic rounding
+ */
+template <>
+inline void EncodeV<int8_t>(const float* v, int n, float* w, FastRand* rnd) {
+  float max = 0;
+  for (int i = 0; i < n; ++i) max = std::max(max, std::abs(v[i]));
+  float scale = max / 127;
+  w[1] = scale;
+  int8_t* x = reinterpret_cast<int8_t*>(w + 2);
+  if (scale == 0) {
+    memset(x, 0, n);
+  } else {
+    for (int i = 0; i < n; ++i) x[i] = StochasticRound(v[i] / scale, rnd->Uniform());
+  }
+}
+
 /**
  * \brief value stored on server nodes
+ *
+ * \tparam T the storage type of V. The accumulated gradients of V are stored in
+ * T too, except for int8_t, where FP16 is used. w, z and their accumulated
+ * gradients are always float.
  */
+template <typename T = float>
 struct AdaGradEntry {
+  using G = typename AccumType<T>::type;
+
   AdaGradEntry() { }
   ~AdaGradEntry() { Clear(); }
 
   inline void Clear() {
-    if ( size > 1 ) { delete [] w; delete [] sqc_grad; }
-    size = 0; w = NULL; sqc_grad = NULL;
+    if (size > 1) {
+      slabs_.Free(WSize(size), h_[0]); slabs_.Free(CGSize(size), h_[1]);
+    }
+    size = 0; val_[0] = val_[1] = val_[2] = 0;
   }
 
   inline void Resize(int n) {
-    if (n < size) { size = n; return; }
-
-    float* new_w = new float[n]; float* new_cg = new float[n+1];
-    if (size == 1) {
-      new_w[0] = w_0(); new_cg[0] = sqc_grad_0(); new_cg[1] = z_0();
-    } else {
-      memcpy(new_w, w, size * sizeof(float));
-      memcpy(new_cg, sqc_grad, (size+1) * sizeof(float));
-      Clear();
+    if (n == size) return;
+    float w0 = w_0(), cg0 = sqc_grad_0(), z0 = z_0();
+    uint32_t h[2] = {0, 0};
+    if (n > 1) {
+      h[0] = slabs_.Alloc(WSize(n)); h[1] = slabs_.Alloc(CGSize(n));
+      if (size > 1) {
+        memcpy(slabs_.Get(WSize(n), h[0]), w(),
+               std::min(WSize(size), WSize(n)) * sizeof(float));
+        memcpy(slabs_.Get(CGSize(n), h[1]), sqc_grad(),
+               std::min(CGSize(size), CGSize(n)) * sizeof(float));
+      }
     }
-    w = new_w; sqc_grad = new_cg; size = n;
+    Clear();
+    size = n;
+    if (n > 1) { h_[0] = h[0]; h_[1] = h[1]; }
+    w_0() = w0; sqc_grad_0() = cg0; z_0() = z0;
   }
 
-  inline float& w_0() { return size == 1 ? *(float *)&w : w[0]; }
-  inline float w_0() const { return size == 1 ? *(float *)&w : w[0]; }
+  inline float& w_0() { return size == 1 ? val_[0] : w()[0]; }
+  inline float w_0() const { return size == 1 ? val_[0] : w()[0]; }
 
-  inline float& sqc_grad_0() {
-    return size == 1 ? *(float *)&sqc_grad : sqc_grad[0];
+  inline float& sqc_grad_0() { return size == 1 ? val_[1] : sqc_grad()[0]; }
+  inline float& z_0() { return size == 1 ? val_[2] : sqc_grad()[1]; }
+  inline float sqc_grad_0() const {
+    return size == 1 ? val_[1] : sqc_grad()[0];
   }
+  inline float z_0() const { return size == 1 ? val_[2] : sqc_grad()[1]; }
 
-  inline float& z_0() {
-    return size == 1 ? *(((float *)&sqc_grad)+1) : sqc_grad[1];
+  /// \brief w and V, only valid if size > 1. it is w_0, [the scale of V if T
+  /// is int8_t,] and then V in T
+  inline float* w() const { return slabs_.Get(WSize(size), h_[0]); }
+
+  /// \brief square root of the cumulative gradient, only valid if size > 1.
+  /// it is the ones of w_0, z_0, and then the ones of V in G
+  inline float* sqc_grad() const {
+    return slabs_.Get(CGSize(size), h_[1]);
+  }
+
+  /// \brief V in float, only valid if T is float
+  inline float* V() { return w() + 1; }
+  /// \brief the accumulated gradients of V in float, only valid if T is float
+  inline float* sqc_grad_V() { return sqc_grad() + 2; }
+
+  /**
+   * \brief decodes V and its accumulated gradients, both have size-1 values
+   */
+  inline void GetV(float* v, float* cg) const {
+    if (size <= 1) return;
+    DecodeV<T>(w(), size - 1, v);
+    const G* x = reinterpret_cast<const G*>(sqc_grad() + 2);
+    for (int i = 0; i < size - 1; ++i) cg[i] = Real<G>::Decode(x[i]);
+  }
+
+  /**
+   * \brief encodes V and its accumulated gradients
+   */
+  inline void SetV(const float* v, const float* cg, FastRand* rnd) {
+    if (size <= 1) return;
+    EncodeV<T>(v, size - 1, w(), rnd);
+    G* x = reinterpret_cast<G*>(sqc_grad() + 2);
+    for (int i = 0; i < size - 1; ++i) x[i] = Real<G>::Encode(cg[i]);
   }
 
   void Load(Stream* fi) {
+    Clear();
     fi->Read(&size, sizeof(size)) ;
     if (size == 1) {
-      fi->Read(&w, sizeof(float*));
-      fi->Read(&sqc_grad, sizeof(float*));
+      // see Save
+      float v[kStreamHead];
+      fi->Read(v, sizeof(v));
+      w_0() = v[0]; sqc_grad_0() = v[2]; z_0() = v[3];
     } else {
-      w = new float[size];
-      sqc_grad = new float[size+1];
-      fi->Read(w, sizeof(float)*size);
-      fi->Read(sqc_grad, sizeof(float)*(size+1));
+      // always stored in float
+      std::vector<float> w_f(size), cg_f(size+1);
+      fi->Read(w_f.data(), sizeof(float)*size);
+      fi->Read(cg_f.data(), sizeof(float)*(size+1));
+      Alloc();
+      w_0() = w_f[0]; sqc_grad_0() = cg_f[0]; z_0() = cg_f[1];
+      static FastRand rnd;
+      SetV(w_f.data() + 1, cg_f.data() + 2, &rnd);
       ISGDHandle::new_V += size - 1;
     }
     if (w_0() != 0) ++ ISGDHandle::new_w;
@@ -184,82 +331,183 @@ struct AdaGradEntry {
   void Save(Stream *fo) const {
     fo->Write(&size, sizeof(size));
     if (size == 1) {
-      fo->Write(&w, sizeof(float*));
-      fo->Write(&sqc_grad, sizeof(float*));
+      // w_0, 4 zero bytes, sqc_grad_0 and z_0, which is the layout of the two
+      // pointers w and sqc_grad that packed them in the former entry, so the
+      // models saved before are still read
+      float v[kStreamHead] = {w_0(), 0, sqc_grad_0(), z_0()};
+      fo->Write(v, sizeof(v));
     } else {
-      fo->Write(w, sizeof(float)*size);
-      fo->Write(sqc_grad, sizeof(float)*(size+1));
+      std::vector<float> w_f(size), cg_f(size+1);
+      w_f[0] = w_0(); cg_f[0] = sqc_grad_0(); cg_f[1] = z_0();
+      GetV(w_f.data() + 1, cg_f.data() + 2);
+      fo->Write(w_f.data(), sizeof(float)*size);
+      fo->Write(cg_f.data(), sizeof(float)*(size+1));
     }
   }
 
   bool Empty() const { return (w_0() == 0 && size == 1); }
 
+  /// \brief the number of floats after size in a stream if size == 1
+  static const int kStreamHead = 4;
+
+  /// \brief the columns in a ModelFile: w_0, z_0 and sqc_grad_0, and then V
+  /// and its sqc_grad, whose lengths are size - 1
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    cols->emplace_back("w", 1);
+    cols->emplace_back("z", 1);
+    cols->emplace_back("n", 1);
+    cols->emplace_back("V", 0);
+    cols->emplace_back("Vn", 0);
+  }
+
+  void SaveCols(ModelColumn* cols) const {
+    cols[0].Add(w_0()); cols[1].Add(z_0()); cols[2].Add(sqc_grad_0());
+    std::vector<float> v(2 * (size - 1));
+    GetV(v.data(), v.data() + size - 1);
+    cols[3].Add(v.data(), size - 1);
+    cols[4].Add(v.data() + size - 1, size - 1);
+  }
+
+  void LoadCols(const float* const* val, const uint32_t* len) {
+    CHECK_EQ(len[3], len[4]);
+    Clear();
+    size = len[3] + 1;
+    if (size > 1) {
+      Alloc();
+      thread_local FastRand rnd;
+      SetV(val[3], val[4], &rnd);
+      ISGDHandle::new_V += size - 1;
+    }
+    w_0() = val[0][0]; z_0() = val[1][0]; sqc_grad_0() = val[2][0];
+    if (w_0() != 0) ++ ISGDHandle::new_w;
+  }
+
   /// #appearence of this feature in the data
   unsigned fea_cnt = 0;
 
-  /// length of w. if size == 1, then using w itself to store the value to save
-  /// memory and avoid unnecessary new (see w_0())
+  /// length of w. if size == 1, then w_0, sqc_grad_0 and z_0 are stored in
+  /// the entry itself to save memory and avoid unnecessary allocations (see
+  /// w_0())
   int size = 1;
 
-  /// w and V
-  float *w = NULL;
+  /// \brief the number of floats allocated for w if size = n > 1
+  static int WSize(int n) {
+    return kHead + ((n - 1) * sizeof(T) + sizeof(float) - 1) / sizeof(float);
+  }
+  /// \brief the number of floats allocated for sqc_grad if size = n > 1
+  static int CGSize(int n) {
+    return 2 + ((n - 1) * sizeof(G) + sizeof(float) - 1) / sizeof(float);
+  }
+
+  /// \brief the blocks of w and sqc_grad of all entries
+  static FloatSlabs slabs_;
 
-  /// square root of the cumulative gradient
-  float *sqc_grad = NULL;
+ private:
+  static const int kHead = std::is_same<T, int8_t>::value ? 2 : 1;
+
+  // allocates the blocks of w and sqc_grad for size > 1
+  inline void Alloc() {
+    h_[0] = slabs_.Alloc(WSize(size)); h_[1] = slabs_.Alloc(CGSize(size));
+  }
+
+  union {
+    /// w_0, sqc_grad_0 and z_0 if size == 1
+    float val_[3] = {0, 0, 0};
+    /// the handles of w and sqc_grad in \ref slabs_ if size > 1
+    uint32_t h_[2];
+  };
 };
 
+template <typename T> FloatSlabs AdaGradEntry<T>::slabs_;
+
 /**
  * \brief model updater
+ *
+ * \tparam T the storage type of V, see AdaGradEntry
  */
+template <typename T = float>
 struct AdaGradHandle : public ISGDHandle {
+  static const bool kFloat = std::is_same<T, float>::value;
 
-  inline void Push(FeaID key, Blob<const float> recv, AdaGradEntry& val) {
+  inline void Push(FeaID key, Blob<const float> recv, AdaGradEntry<T>& val) {
     if (push_count) {
       val.fea_cnt += (unsigned) recv[0];
-      Resize(val);
+      Resize(key, val);
     } else {
-      CHECK_LE(recv.size, (size_t)val.size);
       CHECK_GE(recv.size, (size_t)0);
 
       // update w
-      UpdateW(val, recv[0]);
-
-      // update V
-      if (recv.size > 1) {
-        UpdateV(val.w+1, val.sqc_grad+2, recv.data+1, recv.size-1);
+      UpdateW(key, val, recv[0]);
+
+      // update V. the gradient is longer than V if the entry was evicted and
+      // created again after the pull, then the V it was computed on is gone,
+      // so it is dropped. otherwise it is a bug
+      if (recv.size > (size_t)val.size) {
+        CHECK(evict) << "key " << key << " has " << val.size
+                     << " values, but its gradient has " << recv.size;
+        ++ dropped_V;
+      } else if (recv.size > 1) {
+        const auto& tier = Tier(val.size - 1);
+        if (kFloat) {
+          UpdateV(tier, val.V(), val.sqc_grad_V(), recv.data+1, recv.size-1);
+        } else {
+          // update in float
+          float* v = Buffer(val.size - 1), *cg = v + val.size - 1;
+          val.GetV(v, cg);
+          UpdateV(tier, v, cg, recv.data+1, recv.size-1);
+          val.SetV(v, cg, &rnd_);
+        }
       }
     }
   }
 
-  inline void Pull(FeaID key, const AdaGradEntry& val, Blob<float>& send) {
+  inline void Pull(FeaID key, const AdaGradEntry<T>& val, Blob<float>& send) {
     float w0 = val.w_0();
     if (val.size == 1 || (l1_shrk && (w0 == 0))) {
       CHECK_GT(send.size, (size_t)0);
       send[0] = w0;
       send.size = 1;
+    } else if (kFloat) {
+      send.data = val.w();
+      send.size = val.size;
     } else {
-      send.data = val.w;
+      // the store copies send before the next key is pulled
+      float* v = Buffer(val.size - 1);
+      v[0] = w0;
+      val.GetV(v + 1, v + val.size);
+      send.data = v;
       send.size = val.size;
     }
   }
 
-  /// \brief resize if necessary
-  inline void Resize(AdaGradEntry& val) {
-    // resize the larger dim first to avoid double resize
-    if (val.fea_cnt > V.thr && val.size < V.dim + 1 &&
-        (!l1_shrk || val.w_0() != 0)) {
-      int old_siz = val.size;
-      val.Resize(V.dim + 1);
-      for (int j = old_siz; j < val.size; ++j) {
-        val.w[j] = rand() / (float) RAND_MAX * (V.V_max - V.V_min) + V.V_min;
-        val.sqc_grad[j+1] = 0;
-      }
-      new_V += val.size - old_siz;
+  /// \brief resize if necessary. V_kj is initialized by a hash of (key, j,
+  /// init_seed) rather than a shared random generator, so the model is the
+  /// same no matter how the keys are distributed over the servers and threads
+  inline void Resize(FeaID key, AdaGradEntry<T>& val) {
+    if (l1_shrk && val.w_0() == 0) return;
+    // resize to the largest tier reached to avoid double resize
+    int dim = 0;
+    for (const auto& e : V) if (val.fea_cnt > e.thr) dim = e.dim;
+    if (val.size >= dim + 1) return;
+
+    // the first values are kept, so a key moved to a larger tier continues to
+    // learn its embedding
+    const auto& tier = Tier(dim);
+    int old_siz = val.size;
+    float* v = Buffer(dim), *cg = v + dim;
+    val.GetV(v, cg);
+    val.Resize(dim + 1);
+    for (int j = old_siz - 1; j < dim; ++j) {
+      v[j] = HashUniform(key, j, init_seed) * (tier.V_max - tier.V_min) +
+             tier.V_min;
+      cg[j] = 0;
     }
+    val.SetV(v, cg, &rnd_);
+    new_V += val.size - old_siz;
   }
 
   // ftrl
-  inline void UpdateW(AdaGradEntry& val, float g) {
+  inline void UpdateW(FeaID key, AdaGradEntry<T>& val, float g) {
     float w = val.w_0();
     g += lambda_l2 * w;
 
@@ -279,55 +527,144 @@ struct AdaGradHandle : public ISGDHandle {
     }
 
     if (w == 0 && val.w_0() != 0) {
-      ++ new_w; Resize(val);
+      ++ new_w; Resize(key, val);
     } else if (w != 0 && val.w_0() == 0) {
       -- new_w;
     }
   }
 
-  // adagrad
-  inline void UpdateV(float* w, float* cg, float const* g, int n) {
+  // adagrad, split into loops so that they are vectorized
+  inline void UpdateV(const Embedding& tier, float* w, float* cg,
+                      float const* g, int n) {
+    if (grad_.size() < (size_t)n) grad_.resize(n);
+    float* grad = grad_.data();
     for (int i = 0; i < n; ++i) {
-      float grad = g[i] + V.lambda_l2 * w[i];
-      cg[i] = sqrt(cg[i] * cg[i] + grad * grad);
-      float eta = V.alpha / ( cg[i] + V.beta );
-      w[i] -= eta * grad;
+      grad[i] = g[i] + tier.lambda_l2 * w[i];
+      cg[i] = cg[i] * cg[i] + grad[i] * grad[i];
+    }
+    VecSqrt(cg, n, cg);
+    for (int i = 0; i < n; ++i) {
+      float eta = tier.alpha / ( cg[i] + tier.beta );
+      w[i] -= eta * grad[i];
     }
   }
+
+ private:
+  // returns a buffer with at least 2 * n + 1 floats
+  float* Buffer(int n) {
+    if (buf_.size() < (size_t)(2 * n + 1)) buf_.resize(2 * n + 1);
+    return buf_.data();
+  }
+  std::vector<float> buf_, grad_;
+  FastRand rnd_;
 };
 
 class AsyncServer : public solver::MinibatchServer {
  public:
   AsyncServer(const Config& conf) : conf_(conf) {
-    using Server = ps::OnlineServer<float, AdaGradEntry, AdaGradHandle>;
-    AdaGradHandle h;
+    background_save_ = conf_.background_save();
+    auto prec = conf_.precision();
+    if (prec == Config::FP32) {
+      CreateServer<float>();
+    } else if (prec == Config::FP16) {
+      CreateServer<fp16>();
+    } else if (prec == Config::BF16) {
+      CreateServer<bf16>();
+    } else if (prec == Config::INT8) {
+      CreateServer<int8_t>();
+    } else {
+      LOG(FATAL) << "unknown precision: " << prec;
+    }
+  }
+
+  virtual ~AsyncServer() {
+    // the store of ps::OnlineServer is owned by the system
+    if (sparse_store_) delete server_;
+    delete latency_;
+  }
+ protected:
+  template <typename T>
+  void CreateServer() {
+    using Server = ps::OnlineServer<float, AdaGradEntry<T>, AdaGradHandle<T>>;
+    AdaGradHandle<T> h;
     h.reporter = [this](const Progress& prog) { ReportToScheduler(prog.data); };
+    if (conf_.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf_.print_sec());
+      h.latency = latency_;
+    }
 
     // for w
-    h.alpha     = conf.lr_eta();
-    h.beta      = conf.lr_beta();
-    h.lambda_l1 = conf.lambda_l1();
-    h.lambda_l2 = conf.lambda_l2();
-    h.l1_shrk   = conf.l1_shrk();
+    h.alpha     = conf_.lr_eta();
+    h.beta      = conf_.lr_beta();
+    h.lambda_l1 = conf_.lambda_l1();
+    h.lambda_l2 = conf_.lambda_l2();
+    h.l1_shrk   = conf_.l1_shrk();
+    h.init_seed = conf_.init_seed();
 
     // for V
-    if (conf.embedding_size() > 0) {
-      const auto& c = conf.embedding(0);
-      h.V.dim       = c.dim();
-      h.V.thr       = (unsigned)c.threshold();
-      h.V.lambda_l2 = c.lambda_l2();
-      h.V.V_min     = - c.init_scale();
-      h.V.V_max     = c.init_scale();
-      h.V.alpha     = c.has_lr_eta() ? c.lr_eta() : h.alpha;
-      h.V.beta      = c.has_lr_beta() ? c.lr_beta() : h.beta;
+    for (const auto& c : EmbeddingTiers(conf_)) {
+      ISGDHandle::Embedding e;
+      e.dim       = c.dim();
+      e.thr       = (unsigned)c.threshold();
+      e.lambda_l2 = c.lambda_l2();
+      e.V_min     = - c.init_scale();
+      e.V_max     = c.init_scale();
+      e.alpha     = c.has_lr_eta() ? c.lr_eta() : h.alpha;
+      e.beta      = c.has_lr_beta() ? c.lr_beta() : h.beta;
+      h.V.push_back(e);
     }
 
-    Server s(h);
-    server_ = s.server();
+    EvictionPolicy* evict = new EvictionPolicy(
+        conf_.evict_ttl_pass(), conf_.evict_ttl_sec(), conf_.evict_zero());
+    h.evict = evict->enabled();
+    // the store of ps::OnlineServer cannot erase keys
+    sparse_store_ = conf_.sparse_store() || evict->enabled() ||
+                    conf_.binary_model();
+    if (sparse_store_) {
+      auto store = new SparseStore<AdaGradEntry<T>, AdaGradHandle<T>>(h);
+      store->SetThreads(conf_.num_threads());
+      bool l1_shrk = h.l1_shrk;
+      store->SetEviction(evict, [](const AdaGradEntry<T>& e) {
+          if (e.w_0() != 0) -- ISGDHandle::new_w;
+          ISGDHandle::new_V -= e.size - 1;
+          ISGDHandle::reclaimed += sizeof(FeaID) + sizeof(e) + 1 +
+              (e.size > 1 ? (e.WSize(e.size) + e.CGSize(e.size)) * 4 : 0);
+        }, [l1_shrk](const AdaGradEntry<T>& e) {
+          // V is not pulled if w is 0 with l1_shrk
+          return e.w_0() == 0 && (e.size == 1 || l1_shrk);
+        });
+      start_iter_ = [store](int iter) { store->StartIter(); };
+      lock_model_ = [store](bool lock) {
+        if (lock) { store->Lock(); } else { store->Unlock(); }
+      };
+      int nt = conf_.num_threads();
+      if (conf_.binary_model()) {
+        save_file_ = [store, nt](const std::string& name, bool forked) {
+          store->SaveFile(name, forked ? 1 : nt);
+        };
+      }
+      load_parts_ = [store, nt](const std::vector<std::string>& parts,
+                                ps::Key begin, ps::Key end) {
+        std::vector<std::string> files;
+        for (const auto& part : parts) {
+          if (ModelFile::Is(part)) { files.push_back(part); continue; }
+          Stream* fi = CHECK_NOTNULL(Stream::Create(part.c_str(), "r"));
+          store->Load(fi, begin, end, [](const AdaGradEntry<T>& e) {
+              if (e.w_0() != 0) -- ISGDHandle::new_w;
+              ISGDHandle::new_V -= e.size - 1;
+            });
+          delete fi;
+        }
+        if (files.size()) store->LoadFile(files, begin, end, nt);
+      };
+      server_ = store;
+    } else {
+      delete evict;
+      Server s(h);
+      server_ = s.server();
+    }
   }
 
-  virtual ~AsyncServer() { }
- protected:
   virtual void LoadModel(Stream* fi) {
     server_->Load(fi);
 
@@ -339,8 +676,47 @@ class AsyncServer : public solver::MinibatchServer {
   virtual void SaveModel(Stream* fo) const {
     server_->Save(fo);
   }
+
+  virtual bool SaveModelFile(const std::string& name, bool forked) const {
+    if (!save_file_) return false;
+    save_file_(name, forked);
+    return true;
+  }
+
+  virtual bool LoadModelParts(const std::vector<std::string>& parts,
+                              ps::Key begin, ps::Key end) {
+    if (!load_parts_) {
+      for (const auto& part : parts) {
+        CHECK(!ModelFile::Is(part))
+            << part << " is a binary model, which needs sparse_store";
+      }
+      return false;
+    }
+    load_parts_(parts, begin, end);
+    Progress prog;
+    prog.new_w() = ISGDHandle::new_w.exchange(0);
+    prog.new_V() = ISGDHandle::new_V.exchange(0);
+    ReportToScheduler(prog.data);
+    return true;
+  }
+
+  virtual void StartIter(int iter) {
+    if (start_iter_) start_iter_(iter);
+  }
+
+  virtual void LockModel(bool lock) {
+    if (lock_model_) lock_model_(lock);
+  }
+
   ps::KVStore* server_;
+  bool sparse_store_ = false;
+  std::function<void(int)> start_iter_;
+  std::function<void(bool)> lock_model_;
+  std::function<void(const std::string&, bool)> save_file_;
+  std::function<void(const std::vector<std::string>&, ps::Key, ps::Key)>
+      load_parts_;
   Config conf_;
+  LatencyMonitor* latency_ = NULL;
 };
 
 class AsyncWorker : public solver::MinibatchWorker {
@@ -350,13 +726,31 @@ class AsyncWorker : public solver::MinibatchWorker {
     shuffle_       = conf_.rand_shuffle();
     concurrent_mb_ = conf_.max_concurrency();
     neg_sampling_  = conf_.neg_sampling();
-    for (int i = 0; i < conf.embedding_size(); ++i) {
-      if (conf.embedding(i).dim() > 0) {
-        do_embedding_ = true; break;
-      }
+    adaptive_concurrency_ = conf_.adaptive_concurrency();
+    min_concurrent_mb_    = conf_.min_concurrency();
+    pool_ = new ThreadPool(conf_.num_threads(), conf_.pin_cores());
+    if (conf_.ssp_staleness() >= 0) {
+      ssp_ = new solver::SSPClock(conf_.ssp_staleness());
+    }
+    if (conf_.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf_.print_sec());
     }
+    if (conf_.grad_aggregation() > 1 || conf_.grad_aggregation_sec() > 0) {
+      // only the time window bounds the aggregation if grad_aggregation <= 1
+      int num_mb = conf_.grad_aggregation() > 1 ? conf_.grad_aggregation() : 0;
+      // the clock advances only when the aggregated gradients are pushed, so a
+      // worker must be able to start num_mb minibatches ahead of it. it would
+      // wait forever for a window, which closes only when a minibatch is added
+      CHECK(conf_.ssp_staleness() < 0 ||
+            (num_mb > 0 && conf_.ssp_staleness() >= num_mb - 1))
+          << "ssp_staleness must be >= grad_aggregation - 1, and needs "
+          << "grad_aggregation > 1";
+      agg_ = new GradAggregator<FeaID, float>(
+          num_mb, conf_.grad_aggregation_sec());
+    }
+    do_embedding_ = !EmbeddingTiers(conf_).empty();
   }
-  virtual ~AsyncWorker() { }
+  virtual ~AsyncWorker() { delete agg_; }
 
  protected:
 
@@ -365,10 +759,11 @@ class AsyncWorker : public solver::MinibatchWorker {
     auto feaid = std::make_shared<std::vector<FeaID>>();
     auto feacnt = std::make_shared<std::vector<float>>();
 
+    MinibatchTime time;
     double start = GetTime();
-    Localizer<FeaID> lc(conf_.num_threads());
+    Localizer<FeaID> lc(pool_);
     lc.Localize(mb, data, feaid.get(), feacnt.get());
-    workload_time_ += GetTime() - start;
+    time.localize = GetTime() - start;
 
     ps::SyncOpts pull_w_opt;
     if (wl.type == Workload::TRAIN && wl.data_pass == 0 && do_embedding_) {
@@ -384,13 +779,15 @@ class AsyncWorker : public solver::MinibatchWorker {
     // pull the weight from the servers
     auto val = new std::vector<float>();
     auto val_siz = new std::vector<int>();
+    time.pull = GetTime();
 
     // this callback will be called when the weight has been actually pulled
     // back
-    pull_w_opt.callback = [this, data, feaid, val, val_siz, wl]() {
+    pull_w_opt.callback = [this, data, feaid, val, val_siz, wl, time]() mutable {
       double start = GetTime();
+      time.pull = start - time.pull;
       // eval the objective, and report progress to the scheduler
-      Loss<float> loss(data->GetBlock(), *val, *val_siz, conf_);
+      Loss<float> loss(data->GetBlock(), *val, *val_siz, conf_, pool_);
       Progress prog; loss.Evaluate(&prog); ReportToScheduler(prog.data);
       if (wl.type == Workload::PRED) {
         loss.Predict(PredictStream(conf_.predict_out(), wl), conf_.prob_predict());
@@ -398,25 +795,32 @@ class AsyncWorker : public solver::MinibatchWorker {
         // calculate and push the gradients
         loss.CalcGrad(val);
 
-        ps::SyncOpts push_grad_opt;
-        // filters to reduce network traffic
-        SetFilters(2, &push_grad_opt);
-        // this callback will be called when the gradients have been actually
-        // pushed
-        // LL << DebugStr(*val);
-        push_grad_opt.callback = [this]() { FinishMinibatch(); };
-        server_.ZVPush(feaid,
-                       std::shared_ptr<std::vector<float>>(val),
-                       std::shared_ptr<std::vector<int>>(val_siz),
-                       push_grad_opt);
-
+        time.compute = GetTime() - start;
+        if (agg_) {
+          // push only if enough minibatches have been aggregated
+          auto agg_key = std::make_shared<std::vector<FeaID>>();
+          auto agg_val = std::make_shared<std::vector<float>>();
+          auto agg_siz = std::make_shared<std::vector<int>>();
+          int n = agg_->Add(*feaid, *val, val_siz, agg_key.get(),
+                            agg_val.get(), agg_siz.get());
+          delete val;
+          delete val_siz;
+          if (n) {
+            Push(agg_key, agg_val, agg_siz, time, n);
+          } else {
+            FinishMinibatch(time, 0);
+          }
+        } else {
+          Push(feaid, std::shared_ptr<std::vector<float>>(val),
+               std::shared_ptr<std::vector<int>>(val_siz), time);
+        }
       } else {
-        FinishMinibatch();
         delete val;
         delete val_siz;
+        time.compute = GetTime() - start;
+        FinishMinibatch(time);
       }
       delete data;
-      workload_time_ += GetTime() - start;
     };
 
     // filters to reduce network traffic
@@ -424,10 +828,43 @@ class AsyncWorker : public solver::MinibatchWorker {
     server_.ZVPull(feaid, val, val_siz, pull_w_opt);
   }
 
+  virtual void FinishWorkload(const Workload& wl) {
+    // push the remaining aggregated gradients
+    auto key = std::make_shared<std::vector<FeaID>>();
+    auto grad = std::make_shared<std::vector<float>>();
+    auto siz = std::make_shared<std::vector<int>>();
+    int n = agg_ ? agg_->Flush(key.get(), grad.get(), siz.get()) : 0;
+    if (!n) return;
+    ps::SyncOpts opts;
+    SetFilters(2, &opts);
+    server_.Wait(server_.ZVPush(key, grad, siz, opts));
+    FinishPush(n);
+  }
+
  private:
+  // push the gradients of num_mb minibatches, then finish the minibatch
+  void Push(const std::shared_ptr<std::vector<FeaID>>& key,
+            const std::shared_ptr<std::vector<float>>& grad,
+            const std::shared_ptr<std::vector<int>>& siz,
+            MinibatchTime time, int num_mb = 1) {
+    ps::SyncOpts push_grad_opt;
+    // filters to reduce network traffic
+    SetFilters(2, &push_grad_opt);
+    // this callback will be called when the gradients have been actually
+    // pushed
+    time.push = GetTime();
+    push_grad_opt.callback = [this, time, num_mb]() mutable {
+      time.push = GetTime() - time.push;
+      FinishMinibatch(time, num_mb);
+    };
+    server_.ZVPush(key, grad, siz, push_grad_opt);
+  }
+
   // flag: 0 push feature count, 1 pull weight, 2 push gradient
   void SetFilters(int flag, ps::SyncOpts* opts) {
-    if (conf_.key_cache()) {
+    // the aggregated keys never match the pulled ones, so the cached keys would
+    // never be cleared
+    if (conf_.key_cache() && !agg_) {
       opts->AddFilter(ps::Filter::KEY_CACHING)->set_clear_cache(flag == 2);
     }
     if (conf_.fixed_bytes() > 0) {
@@ -448,6 +885,7 @@ class AsyncWorker : public solver::MinibatchWorker {
   Config conf_;
   bool do_embedding_ = false;
   ps::KVWorker<float> server_;
+  GradAggregator<FeaID, float>* agg_ = NULL;
 };
 
 
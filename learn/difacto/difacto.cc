@@ -24,8 +24,10 @@ App* App::Create(int argc, char *argv[]) {
 }
 }  // namespace ps
 
-int64_t dmlc::difacto::ISGDHandle::new_w = 0;
-int64_t dmlc::difacto::ISGDHandle::new_V = 0;
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_w{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_V{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::reclaimed{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::dropped_V{0};
 
 int main(int argc, char *argv[]) {
   return ps::RunSystem(&argc, &argv);
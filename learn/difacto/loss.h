@@ -1,5 +1,5 @@
 #pragma once
-#include "base/spmm.h"
+#include <math.h>
 #include "base/binary_class_evaluation.h"
 #include "config.pb.h"
 #include "dmlc/data.h"
@@ -7,8 +7,41 @@
 namespace dmlc {
 namespace difacto {
 
+/**
+ * \brief returns the embeddings with dim > 0 in conf
+ *
+ * They are tiers by feature frequency: a key gets the embedding of the last
+ * tier whose threshold its count exceeds, so the frequent keys have longer
+ * embeddings. A key moved to a larger tier keeps the first values, and a
+ * shorter embedding is treated as padded by 0 in the model. So the tiers must
+ * have increasing thresholds and dims.
+ */
+inline std::vector<Config::Embedding> EmbeddingTiers(const Config& conf) {
+  std::vector<Config::Embedding> tiers;
+  for (const auto& e : conf.embedding()) {
+    if (e.dim() <= 0) continue;
+    if (tiers.size()) {
+      CHECK_GT(e.threshold(), tiers.back().threshold())
+          << "the embeddings should have increasing thresholds";
+      CHECK_GT(e.dim(), tiers.back().dim())
+          << "the embeddings should have increasing dims";
+    }
+    tiers.push_back(e);
+  }
+  return tiers;
+}
+
 /**
  * \brief the loss function
+ *
+ * The prediction and the gradients are computed by fused row-wise kernels,
+ * which read w and V in place from the pulled model. For row i,
+ *
+ *   py_i = <x_i, w> + .5 * sum_k ((x_i V)_k^2 - sum_j x_ij^2 V_jk^2)
+ *
+ * is computed in one traversal of the row, which keeps x_i V for the
+ * gradients. An embedding is treated as padded by 0 to the largest dim of the
+ * tiers, so a key only costs its own length.
  */
 template <typename T>
 class Loss {
@@ -17,27 +50,44 @@ class Loss {
    * create and init the loss function
    *
    * @param data X and Y
-   * @param model w and V
+   * @param model w and V, which should be alive until the loss is destroyed
    * @param model_siz 1 + length V[i]
    * @param conf difacto conf
+   * @param pool the thread pool for computation
    */
   Loss(const RowBlock<unsigned>& data,
        const std::vector<T>& model,
        const std::vector<int>& model_siz,
-       const Config& conf) {
-    nt_ = conf.num_threads();
-
-    // init w
-    w.Load(0, data, model, model_siz);
+       const Config& conf,
+       ThreadPool* pool)
+      : X_(data), model_(model.data()), pool_(pool) {
+    // the embedding tiers, dim_ is the largest one
+    auto tiers = EmbeddingTiers(conf);
+    for (const auto& cf : tiers) {
+      Tier t;
+      t.dim                = cf.dim();
+      t.dropout            = cf.dropout();
+      t.grad_clipping      = cf.grad_clipping();
+      t.grad_normalization = cf.grad_normalization();
+      tiers_.push_back(t);
+    }
+    dim_ = tiers_.empty() ? 0 : tiers_.back().dim;
 
-    // init V
-    if (conf.embedding_size() == 0) return;
-    const auto& cf = conf.embedding(0);
-    if (cf.dim() == 0) return;
-    V.Load(cf.dim(), data, model, model_siz);
-    V.dropout            = cf.dropout();
-    V.grad_clipping      = cf.grad_clipping();
-    V.grad_normalization = cf.grad_normalization();
+    // the position, length and tier of each key in model
+    key_.resize(model_siz.size());
+    size_t p = 0;
+    for (size_t i = 0; i < model_siz.size(); ++i) {
+      auto& k = key_[i];
+      k.pos = model_siz[i] == 0 ? kNoPos : (unsigned)p;
+      k.len = std::max(model_siz[i] - 1, 0);
+      k.tier = 0;
+      while (k.tier + 1 < (int)tiers_.size() &&
+             tiers_[k.tier + 1].dim <= k.len) ++ k.tier;
+      p += model_siz[i];
+    }
+    CHECK_EQ(p, model.size());
+    CHECK_LT(p, (size_t)kNoPos) << "too many values pulled";
+    model_size_ = p;
   }
 
   ~Loss() { }
@@ -51,44 +101,16 @@ class Loss {
    * .* : elemenetal-wise times
    */
   void Evaluate(Progress* prog) {
+    Forward();
 
-    // py = X * w
-    py_.resize(w.X.size);
-    SpMV::Times(w.X, w.weight, &py_, nt_);
-
-    BinClassEval<T> eval(w.X.label, py_.data(), py_.size(), nt_);
-    prog->objv_w() = eval.LogitObjv();
-
-    // py += .5 * sum((X*V).^2 - (X.*X)*(V.*V), 2);
-    if (!V.weight.empty()) {
-      // tmp = (X.*X)*(V.*V)
-      std::vector<T> vv = V.weight;
-      for (auto& v : vv) v *= v;
-      CHECK_EQ(vv.size(), V.pos.size() * V.dim);
-      std::vector<T> xxvv(V.X.size * V.dim);
-      SpMM::Times(V.XX, vv, &xxvv, nt_);
-
-      // V.XV = X*V
-      V.XV.resize(xxvv.size());
-      SpMM::Times(V.X, V.weight, &V.XV, nt_);
-
-      // py += .5 * sum((V.XV).^2 - xxvv)
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < py_.size(); ++i) {
-        T* t = V.XV.data() + i * V.dim;
-        T* tt = xxvv.data() + i * V.dim;
-        T s = 0;
-        for (int j = 0; j < V.dim; ++j) s += t[j] * t[j] - tt[j];
-        py_[i] += .5 * s;
-      }
-      prog->objv() = eval.LogitObjv();
-    } else {
-      prog->objv() = prog->objv_w();
-    }
+    prog->objv_w() = BinClassEval<T>(
+        X_.label, pyw_.data(), pyw_.size(), pool_).LogitObjv();
+    BinClassEval<T> eval(X_.label, py_.data(), py_.size(), pool_);
+    prog->objv() = dim_ ? eval.LogitObjv() : prog->objv_w();
 
     // auc, acc, logloss, copc
     prog->auc()    = eval.AUC();
-    prog->new_ex() = w.X.size;
+    prog->new_ex() = X_.size;
     prog->count()  = 1;
     // prog->copc()   = eval.Copc();
   }
@@ -98,78 +120,77 @@ class Loss {
    * p = - y ./ (1 + exp (y .* py));
    * grad_w = X' * p;
    * grad_u = X' * diag(p) * X * V  - diag((X.*X)'*p) * V
+   *
+   * @param grad the gradients with the layout of the model. it can be the
+   * model itself
    */
   void CalcGrad(std::vector<T>* grad) {
     // p = ... (reuse py_)
-    CHECK_EQ(py_.size(), w.X.size) << "call *evaluate* first";
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < py_.size(); ++i) {
-      T y = w.X.label[i] > 0 ? 1 : -1;
-      py_[i] = - y / ( 1 + exp ( y * py_[i] ));
-    }
-
-    // grad_w = ...
-    SpMV::TransTimes(w.X, py_, &w.weight, nt_);
-    w.Save(grad);
-
-    // grad_u = ...
-    if (!V.weight.empty()) {
-      int dim = V.dim;
-
-      // xxp = (X.*X)'*p
-      size_t m = V.pos.size();
-      std::vector<T> xxp(m);
-      SpMM::TransTimes(V.XX, py_, &xxp, nt_);
-
-      // V = - diag(xxp) * V
-      CHECK_EQ(V.weight.size(), dim * m);
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < m; ++i) {
-        T* v = V.weight.data() + i * dim;
-        for (int j = 0; j < dim; ++j) v[j] *= - xxp[i];
-      }
-
-      // V.XV = diag(p) * X * V
-      size_t n = py_.size();
-      CHECK_EQ(V.XV.size(), n * dim);
-#pragma omp parallel for num_threads(nt_)
-      for (size_t i = 0; i < n; ++i) {
-        T* y = V.XV.data() + i * dim;
-        for (int j = 0; j < dim; ++j) y[j] *= py_[i];
-      }
-
-      // V += X' * V.XV
-      SpMM::TransTimes(V.X, V.XV, (T)1, V.weight, &V.weight, nt_);
-
-      // some preprocessing
-      if (V.grad_clipping > 0) {
-        T gc = V.grad_clipping;
-        for (T& g : V.weight) g = g > gc ? gc : ( g < -gc ? -gc : g);
-      }
+    CHECK_EQ(py_.size(), X_.size) << "call *evaluate* first";
+    pool_->ParallelFor(py_.size(), [this](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          T y = X_.label[i] > 0 ? 1 : -1;
+          py_[i] = - y / ( 1 + exp ( y * py_[i] ));
+        }
+      });
 
-      if (V.dropout > 0) {
-        for (T& g : V.weight) {
-          if ((T)rand() / RAND_MAX > 1 - V.dropout) g = 0;
+    // each thread accumulates the rows in its range into its own buffer, with
+    // the layout of the model followed by xxp, so X is traversed once in
+    // total. then the buffers are summed into grad, which may be the model
+    // itself, so V_j is read before grad_j is written:
+    //   xxp_j = sum_i p_i x_ij^2
+    //   grad_w_j = sum_i p_i x_ij
+    //   grad_V_jk = sum_i p_i x_ij (x_i V)_k - xxp_j V_jk
+    CHECK_EQ(grad->size(), model_size_);
+    std::vector<std::vector<T>> buf(pool_->num_threads());
+    pool_->ParallelFor(X_.size, [this, &buf](int s, const Range& rg) {
+        buf[s].assign(model_size_ + key_.size(), 0);
+        T* xxp = buf[s].data() + model_size_;
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          const T* xv = XV_.data() + i * dim_;
+          for (size_t j = X_.offset[i]; j < X_.offset[i+1]; ++j) {
+            unsigned e = X_.index[j];
+            const Key& k = key_[e];
+            if (k.pos == kNoPos) continue;
+            T x = X_.value ? X_.value[j] : 1;
+            T px = py_[i] * x;
+            T* g = buf[s].data() + k.pos;
+            g[0] += px;
+            xxp[e] += px * x;
+            for (int d = 0, n = Len(k); d < n; ++d) g[1+d] += px * xv[d];
+          }
         }
-      }
-      if (V.grad_normalization) Normalize(V.weight);
-    }
-    V.Save(grad);
-  }
+      });
+    // a small minibatch has fewer segments than threads
+    while (buf.size() && buf.back().empty()) buf.pop_back();
+    pool_->ParallelFor(key_.size(), [this, &buf, grad](int, const Range& rg) {
+        for (size_t e = rg.begin; e < rg.end; ++e) {
+          const Key& k = key_[e];
+          if (k.pos == kNoPos) continue;
+          T* g = grad->data() + k.pos;
+          const T* v = model_ + k.pos + 1;
+          T xxp = 0, gw = 0;
+          for (const auto& b : buf) {
+            xxp += b[model_size_ + e];
+            gw += b[k.pos];
+          }
+          int n = Len(k);
+          for (int d = 0; d < n; ++d) {
+            T gv = 0;
+            for (const auto& b : buf) gv += b[k.pos + 1 + d];
+            g[1+d] = gv - xxp * v[d];
+          }
+          // the values beyond the largest dim are not used
+          for (int d = n + 1; d <= k.len; ++d) g[d] = 0;
+          g[0] = gw;
+        }
+      });
 
-  void Normalize(std::vector<T>& grad) {
-    T norm = 0;
-    for (T g : grad) norm += g * g;
-    if (norm < 1e-10) return;
-    norm = sqrt(norm);
-    for (T& g : grad) g = g / norm;
+    if (dim_) Preprocess(grad->data());
   }
 
   virtual void Predict(Stream* fo, bool prob_out) {
-    if (py_.empty()) {
-      py_.resize(w.X.size);
-      SpMV::Times(w.X, w.weight, &py_, nt_);
-    }
+    if (py_.empty()) Forward();
     ostream os(fo);
     if (prob_out) {
       for (auto p : py_) os << 1.0 / (1.0 + exp( - p )) << "\n";
@@ -179,108 +200,106 @@ class Loss {
   }
 
  private:
-  /// \brief store data and model w (dim==0) and V (dim >= 1)
-  struct Data {
-    /// \brief get data and model
-    void Load(int d, const RowBlock<unsigned>& data,
-              const std::vector<T>& model,
-              const std::vector<int>& model_siz) {
-      // init pos and w
-      std::vector<unsigned> col_map;
-      dim = d;
-      if (dim == 0) {  // w
-        pos.resize(model_siz.size());
-        weight.resize(model_siz.size());
-        unsigned p = 0;
-        for (size_t i = 0; i < model_siz.size(); ++i) {
-          if (model_siz[i] == 0) {
-            pos[i] = (unsigned)-1;
-          } else {
-            pos[i] = p; weight[i] = model[p]; p += model_siz[i];
-          }
-        }
-        CHECK_EQ((size_t)p, model.size());
-      } else {  // V
-        col_map.resize(model_siz.size());
-        unsigned k = 0, p = 0;
-        for (size_t i = 0; i < model_siz.size(); ++i) {
-          if (model_siz[i] == dim + 1) {
-            pos.push_back(p+1);  // skip the first dim
-            col_map[i] = ++ k;
+  /// \brief computes pyw_ = X * w, py_ and XV_ = X * V in one traversal of
+  /// each row
+  void Forward() {
+    size_t n = X_.size;
+    pyw_.resize(n); py_.resize(n); XV_.resize(n * dim_);
+    pool_->ParallelFor(n, [this](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          T* xv = XV_.data() + i * dim_;
+          std::fill(xv, xv + dim_, 0);
+          T xw = 0, xxvv = 0;
+          for (size_t j = X_.offset[i]; j < X_.offset[i+1]; ++j) {
+            const Key& k = key_[X_.index[j]];
+            if (k.pos == kNoPos) continue;
+            T x = X_.value ? X_.value[j] : 1;
+            const T* w = model_ + k.pos;
+            xw += x * w[0];
+            const T* v = w + 1;
+            T vv = 0;
+            for (int d = 0, n = Len(k); d < n; ++d) {
+              xv[d] += x * v[d];
+              vv += v[d] * v[d];
+            }
+            xxvv += x * x * vv;
           }
-          p += model_siz[i];
+          T s = 0;
+          for (int d = 0; d < dim_; ++d) s += xv[d] * xv[d];
+          pyw_[i] = xw;
+          py_[i] = xw + .5 * (s - xxvv);
         }
-        CHECK_EQ((size_t)p, model.size());
-        weight.resize(pos.size() * dim);
-        for (size_t i = 0; i < pos.size(); ++i) {
-          memcpy(weight.data()+i*dim, model.data()+pos[i], dim*sizeof(T));
-        }
-      }
-      if (weight.empty()) return;
+      });
+  }
 
-      // init X
-      if (dim == 0) {  // w
-        X = data;
-      } else {  // V
-        // pick the columns with model_siz = dim + 1
-        os.push_back(0);
-        for (size_t i = 0; i < data.size; ++i) {
-          for (size_t j = data.offset[i]; j < data.offset[i+1]; ++j) {
-            unsigned d = data.index[j];
-            unsigned k = col_map[d];
-            if (k > 0) {
-              idx.push_back(k-1);
-              if (data.value) val_.push_back(data.value[j]);
-            }
-          }
-          os.push_back(idx.size());
+  /// \brief clipping, dropout and normalization on the gradients of V, with
+  /// the options of the tier of each key. the gradients are normalized by the
+  /// l2-norm of their tier
+  void Preprocess(T* grad) {
+    std::vector<T> norm(tiers_.size());
+    for (const auto& k : key_) {
+      int n = Len(k), i = k.tier;
+      if (n == 0) continue;
+      const auto& t = tiers_[i];
+      T* g = grad + k.pos + 1;
+      if (t.grad_clipping > 0) {
+        T gc = t.grad_clipping;
+        for (int j = 0; j < n; ++j) {
+          g[j] = g[j] > gc ? gc : ( g[j] < -gc ? -gc : g[j]);
         }
-        X.size = data.size;
-        X.offset = BeginPtr(os);
-        X.value = BeginPtr(val_);
-        X.index = BeginPtr(idx);
       }
-
-      // init XX
-      XX = X;
-      if (X.value) {
-        val2_.resize(X.offset[X.size]);
-        for (size_t i = 0; i < val2_.size(); ++i) {
-          val2_[i] = X.value[i] * X.value[i];
+      if (t.dropout > 0) {
+        for (int j = 0; j < n; ++j) {
+          if ((T)rand() / RAND_MAX > 1 - t.dropout) g[j] = 0;
         }
-        XX.value = BeginPtr(val2_);
       }
+      for (int j = 0; j < n; ++j) norm[i] += g[j] * g[j];
     }
-
-    /// \brief set the gradient
-    void Save(std::vector<T>* grad) const {
-      if (weight.empty()) return;
-      int d = dim == 0 ? 1 : dim;
-      CHECK_EQ(weight.size(), pos.size()*d);
-      for (size_t i = 0; i < pos.size(); ++i) {
-        if (pos[i] == (unsigned)-1) continue;
-        memcpy(grad->data()+pos[i], weight.data()+i*d, d*sizeof(T));
-      }
+    bool normalize = false;
+    for (const auto& t : tiers_) normalize |= t.grad_normalization != 0;
+    if (!normalize) return;
+    for (const auto& k : key_) {
+      int n = Len(k), i = k.tier;
+      if (n == 0 || !tiers_[i].grad_normalization || norm[i] < 1e-10) continue;
+      T nm = sqrt(norm[i]);
+      T* g = grad + k.pos + 1;
+      for (int j = 0; j < n; ++j) g[j] /= nm;
     }
+  }
 
-    int dim;
-    RowBlock<unsigned> X, XX;  // XX = X.*X
-    std::vector<T> weight;
-    std::vector<unsigned> pos;
+  static const unsigned kNoPos = static_cast<unsigned>(-1);
 
-    std::vector<T> XV;
+  /// \brief the options of an embedding tier
+  struct Tier {
+    int dim = 0;
     T dropout = 0;
     T grad_clipping = 0;
     T grad_normalization = 0;
-   private:
-    std::vector<T> val_, val2_;
-    std::vector<size_t> os;
-    std::vector<unsigned> idx;
   };
-  Data w, V;
+  std::vector<Tier> tiers_;
+  int dim_ = 0;
+
+  RowBlock<unsigned> X_;
+  const T* model_;
+  size_t model_size_ = 0;
+  /// \brief where a key is in the model, kept together as they are read for
+  /// each nonzero entry of X
+  struct Key {
+    /// \brief the position of w, kNoPos if the key is not pulled
+    unsigned pos;
+    /// \brief the pulled length of V
+    uint16_t len;
+    /// \brief the tier by the pulled length of V
+    uint16_t tier;
+  };
+  std::vector<Key> key_;
+
+  /// \brief the length of V of a key used in computation, at most dim_
+  inline int Len(const Key& k) const { return std::min((int)k.len, dim_); }
 
-  std::vector<T> py_;
-  int nt_;  // number of threads
+  /// \brief X * w, the prediction, and X * V
+  std::vector<T> pyw_, py_, XV_;
+  ThreadPool* pool_;
 };
 
 }  // namespace difacto
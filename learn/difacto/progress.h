@@ -5,23 +5,27 @@ namespace dmlc {
 namespace difacto {
 
 struct Progress {
-  Progress() : data(8) { }
+  Progress() : data(10) { }
 
   static std::string HeadStr() {
-    return "  ttl #ex   inc #ex |  |w|_0  logloss_w |   |V|_0    logloss    AUC";
+    return "  ttl #ex   inc #ex |  |w|_0  logloss_w |   |V|_0    logloss    AUC"
+        "  | evict(MB)  drop_V";
   }
 
   std::string PrintStr() {
     ttl_ex += new_ex();
     nnz_w += new_w();
     nnz_V += new_V();
+    ttl_reclaimed += reclaimed();
+    ttl_dropped_V += dropped_V();
 
     if (new_ex() == 0) return "";
 
     char buf[256];
-    snprintf(buf, 256, "%9.4g  %7.2g | %9.4g  %6.4lf | %9.4g  %7.5lf  %7.5lf ",
-             ttl_ex, new_ex(), nnz_w, objv_w() / new_ex(), nnz_V,
-             objv() / new_ex(),  auc() / count());
+    snprintf(buf, 256, "%9.4g  %7.2g | %9.4g  %6.4lf | %9.4g  %7.5lf  %7.5lf "
+             "| %9.3g  %6.3g", ttl_ex, new_ex(), nnz_w, objv_w() / new_ex(),
+             nnz_V, objv() / new_ex(),  auc() / count(), ttl_reclaimed / 1e6,
+             ttl_dropped_V);
     return std::string(buf);
   }
 
@@ -34,12 +38,16 @@ struct Progress {
   double& new_ex() { return data[5]; }
   double& new_w() { return data[6]; }
   double& new_V() { return data[7]; }
+  double& reclaimed() { return data[8]; }
+  /// \brief the pushes of V gradients dropped as their entries were evicted
+  /// and created again after the pulls
+  double& dropped_V() { return data[9]; }
 
   double objv() const { return data[0]; }
   double new_ex() const { return data[5]; }
 
   std::vector<double> data;
-  double ttl_ex = 0, nnz_w = 0, nnz_V;
+  double ttl_ex = 0, nnz_w = 0, nnz_V = 0, ttl_reclaimed = 0, ttl_dropped_V = 0;
 };
 
 }  // namespace difacto
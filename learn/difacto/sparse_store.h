@@ -0,0 +1,470 @@
+/**
+ * @file   sparse_store.h
+ * @brief  A key-value store with variable-length values and eviction
+ */
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include "ps.h"
+#include "base/eviction.h"
+#include "base/thread_pool.h"
+#include "base/parallel_sort.h"
+#include "base/model_file.h"
+namespace dmlc {
+namespace difacto {
+
+/**
+ * \brief A hash map store of the difacto entries, used in place of the store
+ * of ps::OnlineServer when entries may be evicted
+ *
+ * It has the same protocol as the store of ps::OnlineServer: a push carries the
+ * values of all keys in value[0], and the value lengths in value[1] if they are
+ * not all the same. A pull replies the values and their lengths, which are set
+ * by Handle::Pull.
+ *
+ * Each entry has a 1-byte mark for the EvictionPolicy. When the clock of the
+ * policy advances, the buckets of the map are swept incrementally by the
+ * following push requests, and the evicted entries are erased.
+ *
+ * With more than one thread, the keys are divided into stripes by hashing, and
+ * each stripe has its own map and a copy of the handle. A request is split by
+ * stripes and the stripes are processed in parallel by a thread pool. A stripe
+ * is only touched by one thread, and requests are still processed one by one,
+ * so no lock is needed and the updates of a key keep the request order.
+ * Handle::Start is called on all copies, and Handle::Finish only on the first
+ * one.
+ *
+ * \tparam Entry the entry
+ * \tparam Handle the handle
+ */
+template <typename Entry, typename Handle>
+class SparseStore : public ps::KVStore {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param handle the handle
+   * @param pull_val_len the maximal number of values pulled for each key
+   * @param id the customer id, the same one as ps::OnlineServer uses
+   */
+  SparseStore(const Handle& handle, int pull_val_len = 1,
+              int id = ps::NextCustomerID())
+      : ps::KVStore(id), pull_val_len_(pull_val_len) {
+    stripes_.push_back(new Stripe(handle));
+  }
+  virtual ~SparseStore() {
+    for (auto st : stripes_) delete st;
+    delete evict_; delete pool_;
+  }
+
+  /**
+   * \brief processes requests with num_threads threads. It must be called
+   * before inserting any key
+   */
+  void SetThreads(int num_threads) {
+    CHECK_EQ(size(), (size_t)0);
+    num_threads = std::max(num_threads, 1);
+    delete pool_; pool_ = NULL;
+    if (num_threads > 1) pool_ = new ThreadPool(num_threads);
+    Handle h = stripes_[0]->handle;
+    for (auto st : stripes_) delete st;
+    stripes_.clear();
+    for (int i = 0; i < num_threads; ++i) stripes_.push_back(new Stripe(h));
+  }
+
+  /**
+   * \brief evicts entries according to the policy. It must be called before
+   * inserting any key
+   *
+   * @param evict the policy, which will be deleted by this store
+   * @param on_evict called for each evicted entry. It is called by several
+   * threads concurrently if there are more than one thread
+   * @param zero returns true if an entry is zero. Entry::Empty in default
+   */
+  void SetEviction(EvictionPolicy* evict,
+                   const std::function<void(const Entry&)>& on_evict,
+                   const std::function<bool(const Entry&)>& zero = nullptr) {
+    CHECK_EQ(size(), (size_t)0);
+    delete evict_;
+    evict_ = evict->enabled() ? evict : NULL;
+    if (!evict_) delete evict;
+    on_evict_ = on_evict;
+    zero_ = zero;
+  }
+
+  /**
+   * \brief a training data pass starts. It can be called by any thread
+   */
+  void StartIter() { if (evict_) evict_->StartIter(); }
+
+  /**
+   * \brief blocks the requests until Unlock, such as to fork a consistent
+   * snapshot. A request being processed is finished first
+   */
+  void Lock() { mu_.lock(); }
+  void Unlock() { mu_.unlock(); }
+
+  virtual void Clear() {
+    for (auto st : stripes_) { st->data.clear(); st->sweep_pos = kNoSweep; }
+  }
+
+  virtual void HandlePush(ps::Message* msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Start(true, msg);
+    ps::SArray<ps::Key> key(msg->key);
+    size_t n = key.size();
+    if (n > 0) {
+      CHECK_GE(msg->value.size(), (size_t)1);
+      ps::SArray<float> val(msg->value[0]);
+      ps::SArray<int> len;
+      if (msg->value.size() > 1) {
+        len = ps::SArray<int>(msg->value[1]);
+        CHECK_EQ(len.size(), n);
+      } else {
+        CHECK_EQ(val.size() % n, (size_t)0);
+      }
+      size_t k = val.size() / n;
+      const int* l = len.size() ? len.data() : NULL;
+      bool sweep = evict_ && evict_->Tick();
+      if (stripes_.size() == 1) {
+        Push(stripes_[0], key.data(), val.data(), val.size(), l, n, k, sweep);
+      } else {
+        Split(key.data(), n);
+        size_t p = 0;
+        for (size_t i = 0; i < n; ++i) {
+          Stripe* st = stripes_[sid_[i]];
+          size_t m = l ? l[i] : k;
+          CHECK_LE(p + m, val.size());
+          st->val_buf.insert(st->val_buf.end(), val.data() + p,
+                             val.data() + p + m);
+          st->len_buf.push_back(m);
+          p += m;
+        }
+        CHECK_EQ(p, val.size());
+        ForEachStripe([this, sweep](Stripe* st) {
+            Push(st, st->key_buf.data(), st->val_buf.data(), st->val_buf.size(),
+                 st->len_buf.data(), st->key_buf.size(), 0, sweep);
+          });
+      }
+    }
+    stripes_[0]->handle.Finish();
+  }
+
+  virtual void HandlePull(ps::Message* msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Start(false, msg);
+    ps::SArray<ps::Key> key(msg->key);
+    size_t n = key.size();
+    ps::SArray<int> len(n);
+    ps::SArray<float> val;
+    if (stripes_.size() == 1) {
+      Stripe* st = stripes_[0];
+      Pull(st, key.data(), n);
+      val = ps::SArray<float>(st->val_buf.size());
+      std::copy(st->val_buf.begin(), st->val_buf.end(), val.data());
+      std::copy(st->len_buf.begin(), st->len_buf.end(), len.data());
+    } else {
+      Split(key.data(), n);
+      ForEachStripe([this](Stripe* st) {
+          Pull(st, st->key_buf.data(), st->key_buf.size());
+        });
+      // merge the values in the request order
+      size_t total = 0;
+      for (auto st : stripes_) { total += st->val_buf.size(); st->pos = 0; }
+      val = ps::SArray<float>(total);
+      std::vector<size_t> j(stripes_.size(), 0);
+      float* out = val.data();
+      for (size_t i = 0; i < n; ++i) {
+        Stripe* st = stripes_[sid_[i]];
+        int m = st->len_buf[j[sid_[i]] ++];
+        const float* v = st->val_buf.data() + st->pos;
+        out = std::copy(v, v + m, out);
+        st->pos += m;
+        len[i] = m;
+      }
+    }
+    msg->clear_value();
+    msg->add_value(val);
+    msg->add_value(len);
+    stripes_[0]->handle.Finish();
+  }
+
+  virtual void Load(Stream* fi) {
+    Load(fi, 0, static_cast<ps::Key>(-1), nullptr);
+  }
+
+  /**
+   * \brief loads the entries saved by Save, but keeps only the keys in [begin,
+   * end), such as the ones of this server when the model was saved by a
+   * different number of servers
+   *
+   * @param drop if not empty, called on each entry loaded and then dropped
+   */
+  void Load(Stream* fi, ps::Key begin, ps::Key end,
+            const std::function<void(const Entry&)>& drop) {
+    std::lock_guard<std::mutex> lk(mu_);
+    ps::Key key;
+    while (fi->Read(&key, sizeof(key)) == sizeof(key)) {
+      if (!InRange(key, begin, end)) {
+        Entry e;
+        e.Load(fi);
+        if (drop) drop(e);
+        continue;
+      }
+      Value& v = stripes_[StripeOf(key)]->data[key];
+      v.entry.Load(fi);
+      if (evict_) v.mark = evict_->Touch(0);
+    }
+  }
+
+  virtual void Save(Stream* fo) const {
+    for (const auto st : stripes_) {
+      for (const auto& it : st->data) {
+        if (it.second.entry.Empty()) continue;
+        fo->Write(&it.first, sizeof(ps::Key));
+        it.second.entry.Save(fo);
+      }
+    }
+  }
+
+  /**
+   * \brief saves the non-empty entries into a ModelFile, see base/model_file.h
+   *
+   * The Entry needs static InitCols(std::vector<ModelColumn>*) to define the
+   * columns, SaveCols(ModelColumn*) const and LoadCols(const float* const*,
+   * const uint32_t*).
+   *
+   * @param name the name of the index file
+   * @param num_threads the number of threads sorting and writing, including
+   * the calling one. 1 creates no thread
+   */
+  void SaveFile(const std::string& name, int num_threads) const {
+    std::vector<std::pair<ps::Key, const Entry*>> kv;
+    for (const auto st : stripes_) {
+      for (const auto& it : st->data) {
+        if (it.second.entry.Empty()) continue;
+        kv.push_back(std::make_pair(it.first, &it.second.entry));
+      }
+    }
+    ThreadPool pool(num_threads);
+    ParallelSort(&kv, &pool, [](const std::pair<ps::Key, const Entry*>& a,
+                                const std::pair<ps::Key, const Entry*>& b) {
+                   return a.first < b.first;
+                 });
+    std::vector<uint64_t> key(kv.size());
+    for (size_t i = 0; i < kv.size(); ++i) key[i] = kv[i].first;
+    std::vector<ModelColumn> cols;
+    Entry::InitCols(&cols);
+    ModelFile::Write(name, key, cols, num_threads, [&kv](
+        size_t begin, size_t end, std::vector<ModelColumn>* cols) {
+      for (size_t i = begin; i < end; ++i) kv[i].second->SaveCols(cols->data());
+    });
+  }
+
+  /**
+   * \brief loads the ModelFiles saved by SaveFile, but keeps only the keys in
+   * [begin, end). The chunks of all files are read concurrently, and the ones
+   * out of the range are skipped
+   *
+   * @param names the names of the index files
+   * @param begin the first key
+   * @param end the key after the last one
+   * @param num_threads the number of threads reading chunks
+   */
+  void LoadFile(const std::vector<std::string>& names, ps::Key begin,
+                ps::Key end, int num_threads) {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<ModelColumn> cols;
+    Entry::InitCols(&cols);
+    size_t ns = stripes_.size();
+    std::vector<std::mutex> mu(ns);
+    std::atomic<int> tid(0);
+    ModelFile::Read(ModelFile::ChunkFiles(names, begin, end), num_threads, [&](
+        size_t, const ModelChunk& chunk) {
+      // ns marks a key out of the range
+      size_t n = chunk.size();
+      std::vector<uint32_t> sid(n);
+      std::vector<size_t> cnt(ns + 1, 0);
+      for (size_t i = 0; i < n; ++i) {
+        ps::Key key = chunk.key()[i];
+        sid[i] = InRange(key, begin, end) ? StripeOf(key) : ns;
+        ++ cnt[sid[i]];
+      }
+      // the entries are not copyable, so they are loaded in place, stripe by
+      // stripe, starting from different stripes in different threads
+      int t = tid ++;
+      for (size_t j = 0; j < ns; ++j) {
+        size_t s = (t + j) % ns;
+        if (cnt[s] == 0) continue;
+        Stripe* st = stripes_[s];
+        std::lock_guard<std::mutex> lk(mu[s]);
+        st->data.reserve(st->data.size() + cnt[s]);
+        ModelRowIter it(chunk, cols);
+        for (size_t i = 0; it.Next(); ++i) {
+          if (sid[i] != s) continue;
+          Value& v = st->data[it.key()];
+          v.entry.LoadCols(it.val(), it.len());
+          if (evict_) v.mark = evict_->Touch(0);
+        }
+      }
+    });
+  }
+
+  /**
+   * \brief returns the number of keys stored
+   */
+  size_t size() const {
+    size_t n = 0;
+    for (const auto st : stripes_) n += st->data.size();
+    return n;
+  }
+
+ private:
+  template <typename T> using Blob = ps::Blob<T>;
+  static const size_t kNoSweep = static_cast<size_t>(-1);
+  /// \brief the minimal number of entries checked by a push request
+  static const size_t kMinStep = 1024;
+
+  struct Value {
+    Entry entry;
+    uint8_t mark = 0;
+  };
+
+  // the keys in a stripe, only accessed by one thread at a time
+  struct Stripe {
+    explicit Stripe(const Handle& h) : handle(h) { }
+    Handle handle;
+    std::unordered_map<ps::Key, Value> data;
+    size_t sweep_pos = kNoSweep;
+    std::vector<ps::Key> evicted;
+    // buffers for a request
+    std::vector<ps::Key> key_buf;
+    std::vector<float> val_buf;
+    std::vector<int> len_buf;
+    size_t pos = 0;
+  };
+
+  // the maximal key is also in the last range, which ends at it
+  static bool InRange(ps::Key k, ps::Key begin, ps::Key end) {
+    return k >= begin && (k < end || end == static_cast<ps::Key>(-1));
+  }
+
+  size_t StripeOf(ps::Key k) const {
+    if (stripes_.size() == 1) return 0;
+    return ((k * 0xD6E8FEB86659FD93ULL) >> 32) % stripes_.size();
+  }
+
+  void Start(bool push, ps::Message* msg) {
+    for (auto st : stripes_) {
+      st->handle.Start(push, msg->task.time(), msg->task.cmd(), (void*)msg);
+    }
+  }
+
+  // splits the keys of a request into the stripes, and clears their buffers
+  void Split(const ps::Key* key, size_t n) {
+    for (auto st : stripes_) {
+      st->key_buf.clear(); st->val_buf.clear(); st->len_buf.clear();
+    }
+    sid_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      sid_[i] = StripeOf(key[i]);
+      stripes_[sid_[i]]->key_buf.push_back(key[i]);
+    }
+  }
+
+  // runs fn on all stripes in parallel
+  void ForEachStripe(const std::function<void(Stripe*)>& fn) {
+    pool_->ParallelFor(stripes_.size(), [this, &fn](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) fn(stripes_[i]);
+      });
+  }
+
+  // pushes n keys, the i-th one has len[i] values, or k if len is NULL
+  void Push(Stripe* st, const ps::Key* key, const float* val, size_t val_size,
+            const int* len, size_t n, size_t k, bool start_sweep) {
+    if (evict_) {
+      if (start_sweep) StartSweep(st);
+      Sweep(st, std::max(2 * n, (size_t)kMinStep));
+    }
+    size_t p = 0;
+    for (size_t i = 0; i < n; ++i) {
+      size_t l = len ? len[i] : k;
+      CHECK_LE(p + l, val_size);
+      Value& v = st->data[key[i]];
+      if (evict_) v.mark = evict_->Touch(v.mark);
+      st->handle.Push(key[i], Blob<const float>(val + p, l), v.entry);
+      p += l;
+    }
+    CHECK_EQ(p, val_size);
+  }
+
+  // pulls n keys into the val_buf and len_buf of st
+  void Pull(Stripe* st, const ps::Key* key, size_t n) {
+    st->val_buf.clear(); st->len_buf.resize(n);
+    std::vector<float> buf(pull_val_len_);
+    Entry empty;
+    for (size_t i = 0; i < n; ++i) {
+      auto it = st->data.find(key[i]);
+      // the handle may point send to its own buffer
+      Blob<float> send(buf.data(), buf.size());
+      st->handle.Pull(key[i], it == st->data.end() ? empty : it->second.entry,
+                      send);
+      st->val_buf.insert(st->val_buf.end(), send.data, send.data + send.size);
+      st->len_buf[i] = send.size;
+    }
+  }
+
+  // starts a new sweep, the previous one is finished first
+  void StartSweep(Stripe* st) {
+    Sweep(st, kNoSweep);
+    st->sweep_pos = 0;
+  }
+
+  // checks the entries in the next buckets until num entries are checked. the
+  // map is not rehashed within a sweep step, as nothing is inserted
+  void Sweep(Stripe* st, size_t num) {
+    size_t& pos = st->sweep_pos;
+    if (pos == kNoSweep) return;
+    auto& data = st->data;
+    size_t nb = data.bucket_count(), n = 0;
+    for (; pos < nb && n < num; ++pos) {
+      for (auto it = data.begin(pos); it != data.end(pos); ++it, ++n) {
+        const Entry& e = it->second.entry;
+        bool zero = zero_ ? zero_(e) : e.Empty();
+        if (evict_->Sweep(&it->second.mark, zero)) {
+          st->evicted.push_back(it->first);
+        }
+      }
+      for (ps::Key k : st->evicted) {
+        auto it = data.find(k);
+        if (on_evict_) on_evict_(it->second.entry);
+        data.erase(it);
+      }
+      st->evicted.clear();
+    }
+    // the buckets may be changed by rehashing between two steps, then some
+    // entries are checked twice or skipped in this sweep, so they are evicted
+    // one clock period earlier or later
+    if (pos >= nb) pos = kNoSweep;
+  }
+
+  int pull_val_len_;
+  std::vector<Stripe*> stripes_;
+  ThreadPool* pool_ = NULL;
+  std::mutex mu_;
+  // the stripe of each key in a request
+  std::vector<uint32_t> sid_;
+  // eviction
+  EvictionPolicy* evict_ = NULL;
+  std::function<void(const Entry&)> on_evict_;
+  std::function<bool(const Entry&)> zero_;
+};
+
+}  // namespace difacto
+}  // namespace dmlc
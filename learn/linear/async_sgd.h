@@ -2,12 +2,19 @@
  * @file   async_sgd.h
  * @brief  Asynchronous stochastic gradient descent to solve linear methods.
  */
+#include <atomic>
 #include "solver/minibatch_solver.h"
 #include "config.pb.h"
 #include "progress.h"
 #include "base/localizer.h"
+#include "base/weight_cache.h"
+#include "base/grad_aggregator.h"
+#include "base/reduced_float.h"
+#include "base/simd.h"
+#include "base/model_file.h"
 #include "loss.h"
 #include "penalty.h"
+#include "flat_store.h"
 
 namespace dmlc {
 namespace linear {
@@ -21,14 +28,29 @@ template <typename T> using Blob = ps::Blob<T>;
 struct ISGDHandle {
  public:
   ISGDHandle() { ns_ = ps::NodeInfo::NumServers(); }
-  inline void Start(bool push, int timestamp, int cmd, void* msg) { }
+  /// \brief called once the hyper-parameters are set
+  inline void Init() { }
+
+  inline void Start(bool push, int timestamp, int cmd, void* msg) {
+    if (latency) { push_ = push; start_ = GetTime(); }
+  }
 
   inline void Finish() {
+    if (latency) {
+      latency->Add(push_ ? LatencyMonitor::kServerPush :
+                   LatencyMonitor::kServerPull, GetTime() - start_);
+      Progress prog;
+      if (latency->Report(&prog.data) && reporter) reporter(prog);
+    }
+
     // avoid too frequently reporting
     ++ ct_;
     if (ct_ >= ns_ && reporter) {
-      Progress prog; prog.new_w() = new_w; reporter(prog);
-      new_w = 0; ct_ = 0;
+      Progress prog;
+      prog.new_w() = new_w.exchange(0);
+      prog.reclaimed() = reclaimed.exchange(0);
+      reporter(prog);
+      ct_ = 0;
     }
   }
 
@@ -40,6 +62,14 @@ struct ISGDHandle {
     }
   }
 
+  inline static void Update(const float* cur_w, const float* old_w, size_t n) {
+    int64_t d = 0;
+    for (size_t i = 0; i < n; ++i) {
+      d += (old_w[i] == 0 && cur_w[i] != 0) - (old_w[i] != 0 && cur_w[i] == 0);
+    }
+    new_w += d;
+  }
+
   void Load(Stream* fi) { }
   void Save(Stream *fo) const { }
 
@@ -49,11 +79,28 @@ struct ISGDHandle {
   float alpha = 0.1, beta = 1;
 
   std::function<void(const Progress& prog)> reporter;
-  static int64_t new_w;
+  /// \brief atomic, as the entries may be updated by several threads
+  static std::atomic<int64_t> new_w;
+  /// \brief bytes freed by evicting entries
+  static std::atomic<int64_t> reclaimed;
+
+  /// \brief if not NULL, record the time of handling requests
+  LatencyMonitor* latency = NULL;
+
+ protected:
+  /// \brief returns the i-th scratch array with at least n floats, used by the
+  /// batch updates
+  inline float* Scratch(int i, size_t n) {
+    if (scratch_[i].size() < n) scratch_[i].resize(n);
+    return scratch_[i].data();
+  }
 
  private:
   int ct_ = 0;
   int ns_ = 0;
+  bool push_ = false;
+  double start_ = 0;
+  std::vector<float> scratch_[6];
 };
 
 template <typename T> inline void TLoad(Stream* fi, T* ptr) {
@@ -73,6 +120,16 @@ struct SGDEntry {
   inline void Load(Stream *fi) { TLoad(fi, this); }
   inline void Save(Stream *fo) const { TSave(fo, this); }
   inline bool Empty() const { return w == 0; }
+
+  /// \brief the columns in a ModelFile
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    cols->emplace_back("w", 1);
+  }
+  inline void SaveCols(ModelColumn* cols) const { cols[0].Add(w); }
+  inline void LoadCols(const float* const* val, const uint32_t* len) {
+    w = val[0][0];
+    ISGDHandle::Update(w, 0);
+  }
 };
 
 /**
@@ -83,6 +140,7 @@ struct SGDEntry {
 struct SGDHandle : public ISGDHandle {
  public:
   inline void Start(bool push, int timestamp, int cmd, void* msg) {
+    ISGDHandle::Start(push, timestamp, cmd, msg);
     if (push) {
       eta = (this->beta + sqrt((float)t)) / this->alpha;
       t += 1;
@@ -94,6 +152,22 @@ struct SGDHandle : public ISGDHandle {
     Update(w.w, old_w);
   }
 
+  /**
+   * \brief updates the entries of n keys by a batch. the gradient of the i-th
+   * key is grad[i*k]
+   */
+  inline void Push(const FeaID* key, size_t n, const float* grad, size_t k,
+                   SGDEntry* val) {
+    float* w = Scratch(0, n), *z = Scratch(1, n), *e = Scratch(2, n);
+    float* new_w = Scratch(3, n);
+    for (size_t i = 0; i < n; ++i) {
+      w[i] = val[i].w; z[i] = eta * w[i] - grad[i * k]; e[i] = eta;
+    }
+    penalty.Solve(z, e, n, new_w);
+    Update(new_w, w, n);
+    for (size_t i = 0; i < n; ++i) val[i].w = new_w[i];
+  }
+
   inline void Pull(FeaID key, const SGDEntry& w, Blob<float>& send) {
     send[0] = w.w;
   }
@@ -103,14 +177,32 @@ struct SGDHandle : public ISGDHandle {
 
 /**
  * \brief AdaGrad SGD value.
+ *
+ * \tparam T the storage type of the accumulated gradient, see Real
  */
+template <typename T = float>
 struct AdaGradEntry {
   float w = 0;
-  float sq_cum_grad = 0;  // sqrt(sum_t grad_t^2)
+  T sq_cum_grad = T();  // sqrt(sum_t grad_t^2)
 
   inline void Load(Stream *fi) { TLoad(fi, this); }
   inline void Save(Stream *fo) const { TSave(fo, this); }
   inline bool Empty() const { return w == 0; }
+
+  /// \brief the columns in a ModelFile, which also keep the optimizer state
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    cols->emplace_back("w", 1);
+    cols->emplace_back("n", 1);
+  }
+  inline void SaveCols(ModelColumn* cols) const {
+    cols[0].Add(w);
+    cols[1].Add(Real<T>::Decode(sq_cum_grad));
+  }
+  inline void LoadCols(const float* const* val, const uint32_t* len) {
+    w = val[0][0];
+    sq_cum_grad = Real<T>::Encode(val[1][0]);
+    ISGDHandle::Update(w, 0);
+  }
 };
 
 
@@ -119,84 +211,307 @@ struct AdaGradEntry {
  *
  * use alpha / ( beta + sqrt(sum_t grad_t^2)) as the learning rate
  */
+template <typename T = float>
 struct AdaGradHandle : public ISGDHandle {
-  inline void Push(FeaID key, Blob<const float> grad, AdaGradEntry& val) {
+  inline void Push(FeaID key, Blob<const float> grad, AdaGradEntry<T>& val) {
     // update cum grad
     float g = grad[0];
-    float sqrt_n = val.sq_cum_grad;
-    val.sq_cum_grad = sqrt(sqrt_n * sqrt_n + g * g);
+    float sqrt_n = Real<T>::Decode(val.sq_cum_grad);
+    float cg = sqrt(sqrt_n * sqrt_n + g * g);
+    val.sq_cum_grad = Real<T>::Encode(cg);
 
     // update w
-    float eta = (val.sq_cum_grad + beta) / alpha;
+    float eta = (cg + beta) / alpha;
     float old_w = val.w;
     val.w = penalty.Solve(eta * old_w - g, eta);
 
     Update(val.w, old_w);
   }
 
-  inline void Pull(FeaID key, const AdaGradEntry& val, Blob<float>& send) {
+  inline void Push(const FeaID* key, size_t n, const float* grad, size_t k,
+                   AdaGradEntry<T>* val) {
+    float* g = Scratch(0, n), *w = Scratch(1, n), *cg = Scratch(2, n);
+    float* eta = Scratch(3, n), *z = Scratch(4, n), *new_w = Scratch(5, n);
+    for (size_t i = 0; i < n; ++i) {
+      g[i] = grad[i * k]; w[i] = val[i].w;
+      float sqrt_n = Real<T>::Decode(val[i].sq_cum_grad);
+      cg[i] = sqrt_n * sqrt_n + g[i] * g[i];
+    }
+    VecSqrt(cg, n, cg);
+    for (size_t i = 0; i < n; ++i) {
+      eta[i] = (cg[i] + beta) / alpha;
+      z[i] = eta[i] * w[i] - g[i];
+    }
+    penalty.Solve(z, eta, n, new_w);
+    Update(new_w, w, n);
+    for (size_t i = 0; i < n; ++i) {
+      val[i].w = new_w[i];
+      val[i].sq_cum_grad = Real<T>::Encode(cg[i]);
+    }
+  }
+
+  inline void Pull(FeaID key, const AdaGradEntry<T>& val, Blob<float>& send) {
     send[0] = val.w;
   }
 };
 
 /**
  * \brief FTRL value
+ *
+ * \tparam T the storage type of z and the accumulated gradient, see Real
  */
+template <typename T = float>
 struct FTRLEntry {
   float w = 0;  // weight
-  float z = 0;  // the smoothed version of - eta * w + grad
-  float sq_cum_grad = 0; // sqrt(sum_t grad_t^2)
+  T z = T();  // the smoothed version of - eta * w + grad
+  T sq_cum_grad = T(); // sqrt(sum_t grad_t^2)
 
   inline void Load(Stream *fi) { TLoad(fi, this); }
   inline void Save(Stream *fo) const { TSave(fo, this); }
   inline bool Empty() const { return w == 0; }
+
+  /// \brief the columns in a ModelFile, which also keep the optimizer state
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    cols->emplace_back("w", 1);
+    cols->emplace_back("z", 1);
+    cols->emplace_back("n", 1);
+  }
+  inline void SaveCols(ModelColumn* cols) const {
+    cols[0].Add(w);
+    cols[1].Add(Real<T>::Decode(z));
+    cols[2].Add(Real<T>::Decode(sq_cum_grad));
+  }
+  inline void LoadCols(const float* const* val, const uint32_t* len) {
+    w = val[0][0];
+    z = Real<T>::Encode(val[1][0]);
+    sq_cum_grad = Real<T>::Encode(val[2][0]);
+    ISGDHandle::Update(w, 0);
+  }
 };
 
 /**
  * \brief FTRL updater, use a smoothed weight for better spasity
  */
+template <typename T = float>
 struct FTRLHandle : public ISGDHandle {
  public:
-  inline void Push(FeaID key, Blob<const float> grad, FTRLEntry& val) {
+  inline void Push(FeaID key, Blob<const float> grad, FTRLEntry<T>& val) {
     // update cum grad
     float g = grad[0];
-    float sqrt_n = val.sq_cum_grad;
-    val.sq_cum_grad = sqrt(sqrt_n * sqrt_n + g * g);
+    float sqrt_n = Real<T>::Decode(val.sq_cum_grad);
+    float cg = sqrt(sqrt_n * sqrt_n + g * g);
+    val.sq_cum_grad = Real<T>::Encode(cg);
 
     // update z
     float old_w = val.w;
-    float sigma = (val.sq_cum_grad - sqrt_n) / alpha;
-    val.z += g - sigma * old_w;
+    float sigma = (cg - sqrt_n) / alpha;
+    float z = Real<T>::Decode(val.z) + (g - sigma * old_w);
+    val.z = Real<T>::Encode(z);
 
     // update w
-    val.w = penalty.Solve(-val.z, (beta + val.sq_cum_grad) / alpha);
+    val.w = penalty.Solve(-z, (beta + cg) / alpha);
 
     Update(val.w, old_w);
   }
 
-  inline void Pull(FeaID key, const FTRLEntry& val, Blob<float>& send) {
+  inline void Push(const FeaID* key, size_t n, const float* grad, size_t k,
+                   FTRLEntry<T>* val) {
+    float* g = Scratch(0, n), *w = Scratch(1, n), *z = Scratch(2, n);
+    float* sqrt_n = Scratch(3, n), *cg = Scratch(4, n), *new_w = Scratch(5, n);
+    for (size_t i = 0; i < n; ++i) {
+      g[i] = grad[i * k]; w[i] = val[i].w;
+      z[i] = Real<T>::Decode(val[i].z);
+      sqrt_n[i] = Real<T>::Decode(val[i].sq_cum_grad);
+      cg[i] = sqrt_n[i] * sqrt_n[i] + g[i] * g[i];
+    }
+    VecSqrt(cg, n, cg);
+    // reuse sqrt_n for eta, and g for -z
+    for (size_t i = 0; i < n; ++i) {
+      float sigma = (cg[i] - sqrt_n[i]) / alpha;
+      z[i] += g[i] - sigma * w[i];
+      sqrt_n[i] = (beta + cg[i]) / alpha;
+      g[i] = - z[i];
+    }
+    penalty.Solve(g, sqrt_n, n, new_w);
+    Update(new_w, w, n);
+    for (size_t i = 0; i < n; ++i) {
+      val[i].w = new_w[i];
+      val[i].z = Real<T>::Encode(z[i]);
+      val[i].sq_cum_grad = Real<T>::Encode(cg[i]);
+    }
+  }
+
+  inline void Pull(FeaID key, const FTRLEntry<T>& val, Blob<float>& send) {
     send[0] = val.w;
   }
 };
 
+/**
+ * \brief FTRL value without the weight, which is a function of z and
+ * sq_cum_grad and so is computed on demand. It uses 1/3 less memory than
+ * FTRLEntry.
+ */
+template <typename T = float>
+struct FTRLLazyEntry {
+  T z = T();
+  T sq_cum_grad = T();
+
+  /// \brief the weight, the same one as FTRLEntry::w
+  inline float w() const {
+    return param.penalty.Solve(
+        - Real<T>::Decode(z),
+        (param.beta + Real<T>::Decode(sq_cum_grad)) / param.alpha);
+  }
+
+  /// \brief loads the weight, and sets z such that w() returns it
+  inline void Load(Stream *fi) {
+    float w;
+    CHECK_EQ(fi->Read(&w, sizeof(float)), sizeof(float));
+    z = Real<T>::Encode(- param.penalty.Inverse(w, param.beta / param.alpha));
+    sq_cum_grad = T();
+    ISGDHandle::Update(this->w(), 0);
+  }
+  inline void Save(Stream *fo) const {
+    float w = this->w();
+    fo->Write(&w, sizeof(float));
+  }
+  inline bool Empty() const { return w() == 0; }
+
+  /// \brief the same columns as FTRLEntry, w is only saved for other readers
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    FTRLEntry<T>::InitCols(cols);
+  }
+  inline void SaveCols(ModelColumn* cols) const {
+    cols[0].Add(w());
+    cols[1].Add(Real<T>::Decode(z));
+    cols[2].Add(Real<T>::Decode(sq_cum_grad));
+  }
+  inline void LoadCols(const float* const* val, const uint32_t* len) {
+    z = Real<T>::Encode(val[1][0]);
+    sq_cum_grad = Real<T>::Encode(val[2][0]);
+    ISGDHandle::Update(w(), 0);
+  }
+
+  /// \brief the hyper-parameters to compute the weight, set by FTRLLazyHandle
+  struct Param {
+    L1L2<float> penalty;
+    float alpha = 0.1, beta = 1;
+  };
+  static Param param;
+};
+
+template <typename T>
+typename FTRLLazyEntry<T>::Param FTRLLazyEntry<T>::param;
+
+/**
+ * \brief FTRL updater on FTRLLazyEntry, it returns the same weights as
+ * FTRLHandle
+ */
+template <typename T = float>
+struct FTRLLazyHandle : public ISGDHandle {
+ public:
+  inline void Init() {
+    FTRLLazyEntry<T>::param.penalty = penalty;
+    FTRLLazyEntry<T>::param.alpha = alpha;
+    FTRLLazyEntry<T>::param.beta = beta;
+  }
+
+  inline void Push(FeaID key, Blob<const float> grad, FTRLLazyEntry<T>& val) {
+    float old_w = val.w();
+
+    // update cum grad
+    float g = grad[0];
+    float sqrt_n = Real<T>::Decode(val.sq_cum_grad);
+    float cg = sqrt(sqrt_n * sqrt_n + g * g);
+    val.sq_cum_grad = Real<T>::Encode(cg);
+
+    // update z
+    float sigma = (cg - sqrt_n) / alpha;
+    val.z = Real<T>::Encode(Real<T>::Decode(val.z) + (g - sigma * old_w));
+
+    Update(val.w(), old_w);
+  }
+
+  inline void Push(const FeaID* key, size_t n, const float* grad, size_t k,
+                   FTRLLazyEntry<T>* val) {
+    float* g = Scratch(0, n), *w = Scratch(1, n), *z = Scratch(2, n);
+    float* sqrt_n = Scratch(3, n), *cg = Scratch(4, n), *t = Scratch(5, n);
+    for (size_t i = 0; i < n; ++i) {
+      g[i] = grad[i * k];
+      z[i] = Real<T>::Decode(val[i].z);
+      sqrt_n[i] = Real<T>::Decode(val[i].sq_cum_grad);
+      cg[i] = sqrt_n[i] * sqrt_n[i] + g[i] * g[i];
+    }
+    // the old weights
+    for (size_t i = 0; i < n; ++i) {
+      t[i] = - z[i]; w[i] = (beta + sqrt_n[i]) / alpha;
+    }
+    penalty.Solve(t, w, n, w);
+    VecSqrt(cg, n, cg);
+    for (size_t i = 0; i < n; ++i) {
+      float sigma = (cg[i] - sqrt_n[i]) / alpha;
+      z[i] += g[i] - sigma * w[i];
+      // store back first, so the new weights are computed from the rounded
+      // values as w() does
+      val[i].z = Real<T>::Encode(z[i]);
+      val[i].sq_cum_grad = Real<T>::Encode(cg[i]);
+      t[i] = - Real<T>::Decode(val[i].z);
+      g[i] = (beta + Real<T>::Decode(val[i].sq_cum_grad)) / alpha;
+    }
+    // the new weights
+    penalty.Solve(t, g, n, sqrt_n);
+    Update(sqrt_n, w, n);
+  }
+
+  inline void Pull(FeaID key, const FTRLLazyEntry<T>& val, Blob<float>& send) {
+    send[0] = val.w();
+  }
+};
+
 
 class AsgdServer : public solver::MinibatchServer {
  public:
   AsgdServer(const Config& conf) : conf_(conf) {
+    background_save_ = conf_.background_save();
+    // admission, eviction and binary models are only implemented by the flat
+    // store
+    flat_store_ = conf_.flat_store() || conf_.admission_min_count() > 1 ||
+                  conf_.evict_ttl_pass() > 0 || conf_.evict_ttl_sec() > 0 ||
+                  conf_.evict_zero() || conf_.binary_model();
     auto algo = conf_.algo();
     if (algo == Config::SGD) {
       CreateServer<SGDEntry, SGDHandle>();
     } else if (algo == Config::ADAGRAD) {
-      CreateServer<AdaGradEntry, AdaGradHandle>();
+      CreateServerWithPrecision<AdaGradEntry, AdaGradHandle>();
+    } else if (algo == Config::FTRL && conf_.lazy_ftrl()) {
+      CreateServerWithPrecision<FTRLLazyEntry, FTRLLazyHandle>();
     } else if (algo == Config::FTRL) {
-      CreateServer<FTRLEntry, FTRLHandle>();
+      CreateServerWithPrecision<FTRLEntry, FTRLHandle>();
     } else {
       LOG(FATAL) << "unknown algo: " << algo;
     }
   }
-  virtual ~AsgdServer() { }
+  virtual ~AsgdServer() {
+    // the store of ps::OnlineServer is owned by the system
+    if (flat_store_) delete server_;
+    delete latency_;
+  }
 
  protected:
+  template <template <typename> class Entry, template <typename> class Handle>
+  void CreateServerWithPrecision() {
+    auto prec = conf_.precision();
+    if (prec == Config::FP32) {
+      CreateServer<Entry<float>, Handle<float>>();
+    } else if (prec == Config::FP16) {
+      CreateServer<Entry<fp16>, Handle<fp16>>();
+    } else if (prec == Config::BF16) {
+      CreateServer<Entry<bf16>, Handle<bf16>>();
+    } else {
+      LOG(FATAL) << "unsupported precision: " << prec;
+    }
+  }
+
   template <typename Entry, typename Handle>
   void CreateServer() {
     Handle h;
@@ -204,26 +519,106 @@ class AsgdServer : public solver::MinibatchServer {
     h.penalty.set_lambda2(conf_.lambda_l2());
     if (conf_.has_lr_eta()) h.alpha = conf_.lr_eta();
     if (conf_.has_lr_beta()) h.beta = conf_.lr_beta();
+    // so eta > 0 in all penalty.Solve
+    CHECK_GT(h.alpha, 0); CHECK_GE(h.beta, 0);
+    h.Init();
 
     h.reporter = [this](const Progress& prog) {
       ReportToScheduler(prog.data);
     };
-    ps::OnlineServer<float, Entry, Handle> s(h);
-    server_ = s.server();
+    if (conf_.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf_.print_sec());
+      h.latency = latency_;
+    }
+    if (flat_store_) {
+      auto store = new FlatStore<Entry, Handle>(h);
+      store->SetThreads(conf_.num_threads());
+      store->SetAdmission(conf_.admission_min_count(),
+                          conf_.admission_sketch_size());
+      auto evict = new EvictionPolicy(
+          conf_.evict_ttl_pass(), conf_.evict_ttl_sec(), conf_.evict_zero());
+      store->SetEviction(evict, [](const Entry& e) {
+          if (!e.Empty()) -- ISGDHandle::new_w;
+          ISGDHandle::reclaimed += sizeof(FeaID) + sizeof(Entry) + 1;
+        });
+      start_iter_ = [store](int iter) { store->StartIter(); };
+      lock_model_ = [store](bool lock) {
+        if (lock) { store->Lock(); } else { store->Unlock(); }
+      };
+      int nt = conf_.num_threads();
+      if (conf_.binary_model()) {
+        save_file_ = [store, nt](const std::string& name, bool forked) {
+          store->SaveFile(name, forked ? 1 : nt);
+        };
+      }
+      load_parts_ = [store, nt](const std::vector<std::string>& parts,
+                                ps::Key begin, ps::Key end) {
+        std::vector<std::string> files;
+        for (const auto& part : parts) {
+          if (ModelFile::Is(part)) { files.push_back(part); continue; }
+          Stream* fi = CHECK_NOTNULL(Stream::Create(part.c_str(), "r"));
+          store->Load(fi, begin, end, [](const Entry& e) {
+              if (!e.Empty()) -- ISGDHandle::new_w;
+            });
+          delete fi;
+        }
+        if (files.size()) store->LoadFile(files, begin, end, nt);
+      };
+      server_ = store;
+    } else {
+      ps::OnlineServer<float, Entry, Handle> s(h);
+      server_ = s.server();
+    }
   }
 
   virtual void LoadModel(Stream* fi) {
     server_->Load(fi);
-    Progress prog; prog.new_w() = ISGDHandle::new_w; ReportToScheduler(prog.data);
-    ISGDHandle::new_w = 0;
+    Progress prog; prog.new_w() = ISGDHandle::new_w.exchange(0);
+    ReportToScheduler(prog.data);
   }
 
   virtual void SaveModel(Stream* fo) const {
     server_->Save(fo);
   }
 
+  virtual bool SaveModelFile(const std::string& name, bool forked) const {
+    if (!save_file_) return false;
+    save_file_(name, forked);
+    return true;
+  }
+
+  virtual bool LoadModelParts(const std::vector<std::string>& parts,
+                              ps::Key begin, ps::Key end) {
+    if (!load_parts_) {
+      for (const auto& part : parts) {
+        CHECK(!ModelFile::Is(part))
+            << part << " is a binary model, which needs flat_store";
+      }
+      return false;
+    }
+    load_parts_(parts, begin, end);
+    Progress prog; prog.new_w() = ISGDHandle::new_w.exchange(0);
+    ReportToScheduler(prog.data);
+    return true;
+  }
+
+  virtual void StartIter(int iter) {
+    if (start_iter_) start_iter_(iter);
+  }
+
+  virtual void LockModel(bool lock) {
+    if (lock_model_) lock_model_(lock);
+  }
+
   Config conf_;
   ps::KVStore* server_;
+  bool flat_store_ = false;
+  std::function<void(int)> start_iter_;
+  std::function<void(bool)> lock_model_;
+  std::function<void(const std::string&, bool)> save_file_;
+  std::function<void(const std::vector<std::string>&, ps::Key, ps::Key)>
+      load_parts_;
+  LatencyMonitor* latency_ = NULL;
 };
 
 class AsgdWorker : public solver::MinibatchWorker {
@@ -233,8 +628,40 @@ class AsgdWorker : public solver::MinibatchWorker {
     shuffle_       = conf_.rand_shuffle();
     concurrent_mb_ = conf_.max_concurrency();
     neg_sampling_  = conf_.neg_sampling();
+    adaptive_concurrency_ = conf_.adaptive_concurrency();
+    min_concurrent_mb_    = conf_.min_concurrency();
+    pool_ = new ThreadPool(conf_.num_threads(), conf_.pin_cores());
+    if (conf_.ssp_staleness() >= 0) {
+      ssp_ = new solver::SSPClock(conf_.ssp_staleness());
+    }
+    if (conf_.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf_.print_sec());
+    }
+    if (conf_.weight_cache_staleness() > 0) {
+      cache_ = new WeightCache<FeaID, float>(
+          conf_.weight_cache_staleness(), conf_.weight_cache_size());
+    }
+    if (conf_.grad_aggregation() > 1 || conf_.grad_aggregation_sec() > 0) {
+      // only the time window bounds the aggregation if grad_aggregation <= 1
+      int num_mb = conf_.grad_aggregation() > 1 ? conf_.grad_aggregation() : 0;
+      // the clock advances only when the aggregated gradients are pushed, so a
+      // worker must be able to start num_mb minibatches ahead of it. it would
+      // wait forever for a window, which closes only when a minibatch is added
+      CHECK(conf_.ssp_staleness() < 0 ||
+            (num_mb > 0 && conf_.ssp_staleness() >= num_mb - 1))
+          << "ssp_staleness must be >= grad_aggregation - 1, and needs "
+          << "grad_aggregation > 1";
+      agg_ = new GradAggregator<FeaID, float>(
+          num_mb, conf_.grad_aggregation_sec());
+    }
+  }
+  virtual ~AsgdWorker() {
+    if (cache_) {
+      LOG(INFO) << "weight cache hit ratio " << cache_->HitRatio();
+    }
+    delete cache_;
+    delete agg_;
   }
-  virtual ~AsgdWorker() { }
 
  protected:
   virtual void ProcessMinibatch(const Minibatch& mb, const Workload& wl) {
@@ -242,23 +669,49 @@ class AsgdWorker : public solver::MinibatchWorker {
     auto data = new dmlc::data::RowBlockContainer<unsigned>();
     auto feaid = std::make_shared<std::vector<FeaID>>();
 
+    MinibatchTime time;
     double start = GetTime();
-    Localizer<FeaID> lc(nt_);
+    Localizer<FeaID> lc(pool_);
     lc.Localize(mb, data, feaid.get());
-    workload_time_ += GetTime() - start;
+    time.localize = GetTime() - start;
 
-    // pull the weight from the servers
+    // pull the weight from the servers, only the keys missed in the cache if
+    // any
     auto val = new std::vector<float>();
+    auto key = feaid;
+    auto pulled = val;
+    std::vector<size_t>* miss_pos = NULL;
+    int64_t clock = 0;
+    if (cache_) {
+      clock = cache_->Tick();
+      val->resize(feaid->size());
+      key = std::make_shared<std::vector<FeaID>>();
+      pulled = new std::vector<float>();
+      miss_pos = new std::vector<size_t>();
+      cache_->Get(clock, *feaid, val, key.get(), miss_pos);
+    }
     ps::SyncOpts pull_w_opt;
+    time.pull = GetTime();
 
     // this callback will be called when the weight has been actually pulled
     // back
     int k = wl.file[0].k;
-    pull_w_opt.callback = [this, data, feaid, val, k, wl]() {
+    pull_w_opt.callback = [this, data, feaid, val, k, wl, time,
+                           key, pulled, miss_pos, clock]() mutable {
       double start = GetTime();
+      time.pull = start - time.pull;
+      if (cache_) {
+        // merge the pulled weights
+        cache_->Put(clock, *key, pulled->data());
+        for (size_t i = 0; i < miss_pos->size(); ++i) {
+          (*val)[(*miss_pos)[i]] = (*pulled)[i];
+        }
+        delete pulled;
+        delete miss_pos;
+      }
       // eval the objective, and report progress to the scheduler
       auto loss = CreateLoss<float>(conf_.loss());
-      loss->Init(data->GetBlock(), *val, nt_);
+      loss->Init(data->GetBlock(), *val, pool_);
       Progress prog; loss->Evaluate(&prog); ReportToScheduler(prog.data);
       if (wl.type == Workload::PRED) {
         loss->Predict(PredictStream(conf_.predict_out(), wl), conf_.prob_predict());
@@ -268,31 +721,74 @@ class AsgdWorker : public solver::MinibatchWorker {
         // calculate and push the gradients
         loss->CalcGrad(val);
 
-        ps::SyncOpts push_grad_opt;
-        // filters to reduce network traffic
-        SetFilters(train, &push_grad_opt);
-        // this callback will be called when the gradients have been actually
-        // pushed
-        push_grad_opt.callback = [this]() { FinishMinibatch(); };
-        kv_.ZPush(
-            feaid, std::shared_ptr<std::vector<float>>(val), push_grad_opt);
+        time.compute = GetTime() - start;
+        if (agg_) {
+          // push only if enough minibatches have been aggregated
+          auto agg_key = std::make_shared<std::vector<FeaID>>();
+          auto agg_val = std::make_shared<std::vector<float>>();
+          int n = agg_->Add(
+              *feaid, *val, NULL, agg_key.get(), agg_val.get());
+          delete val;
+          if (n) {
+            Push(agg_key, agg_val, time, n);
+          } else {
+            FinishMinibatch(time, 0);
+          }
+        } else {
+          Push(feaid, std::shared_ptr<std::vector<float>>(val), time);
+        }
       } else {
-        FinishMinibatch();
         delete val;
+        time.compute = GetTime() - start;
+        FinishMinibatch(time);
       }
       delete loss;
       delete data;
-      workload_time_ += GetTime() - start;
     };
-    kv_.ZPull(feaid, val, pull_w_opt);
+    if (key->empty()) {
+      pull_w_opt.callback();
+    } else {
+      kv_.ZPull(key, pulled, pull_w_opt);
+    }
+  }
+
+  virtual void FinishWorkload(const Workload& wl) {
+    // push the remaining aggregated gradients
+    auto key = std::make_shared<std::vector<FeaID>>();
+    auto grad = std::make_shared<std::vector<float>>();
+    int n = agg_ ? agg_->Flush(key.get(), grad.get()) : 0;
+    if (!n) return;
+    ps::SyncOpts opts;
+    SetFilters(true, &opts);
+    kv_.Wait(kv_.ZPush(key, grad, opts));
+    FinishPush(n);
   }
+
  private:
+  // push the gradients of num_mb minibatches, then finish the minibatch
+  void Push(const std::shared_ptr<std::vector<FeaID>>& key,
+            const std::shared_ptr<std::vector<float>>& grad,
+            MinibatchTime time, int num_mb = 1) {
+    ps::SyncOpts push_grad_opt;
+    // filters to reduce network traffic
+    SetFilters(true, &push_grad_opt);
+    // this callback will be called when the gradients have been actually
+    // pushed
+    time.push = GetTime();
+    push_grad_opt.callback = [this, time, num_mb]() mutable {
+      time.push = GetTime() - time.push;
+      FinishMinibatch(time, num_mb);
+    };
+    kv_.ZPush(key, grad, push_grad_opt);
+  }
+
   void SetFilters(bool push, ps::SyncOpts* opts) {
     if (conf_.fixed_bytes() > 0) {
       opts->AddFilter(ps::Filter::FIXING_FLOAT)->set_num_bytes(
           conf_.fixed_bytes());
     }
-    if (conf_.key_cache()) {
+    // the aggregated keys never match the pulled ones, caching them is useless
+    if (conf_.key_cache() && !agg_) {
       opts->AddFilter(ps::Filter::KEY_CACHING)->set_clear_cache(push);
     }
     if (conf_.msg_compression()) {
@@ -300,8 +796,9 @@ class AsgdWorker : public solver::MinibatchWorker {
     }
   }
   Config conf_;
-  int nt_ = 2;
   ps::KVWorker<float> kv_;
+  WeightCache<FeaID, float>* cache_ = NULL;
+  GradAggregator<FeaID, float>* agg_ = NULL;
 };
 
 
@@ -310,7 +807,12 @@ class AsgdWorker : public solver::MinibatchWorker {
  */
 class AsgdScheduler : public solver::MinibatchScheduler {
  public:
-  AsgdScheduler(const Config& conf) { Init(conf); }
+  AsgdScheduler(const Config& conf) {
+    Init(conf);
+    if (conf.latency_histogram()) {
+      latency_ = new LatencyMonitor(Progress().data.size(), conf.print_sec());
+    }
+  }
   virtual ~AsgdScheduler() { }
 
   virtual std::string ProgHeader() { return Progress::HeadStr(); }
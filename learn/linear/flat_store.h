@@ -0,0 +1,666 @@
+/**
+ * @file   flat_store.h
+ * @brief  A flat key-value store for the model on server nodes
+ */
+#pragma once
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include "ps.h"
+#include "base/count_min_sketch.h"
+#include "base/eviction.h"
+#include "base/thread_pool.h"
+#include "base/parallel_sort.h"
+#include "base/model_file.h"
+namespace dmlc {
+namespace linear {
+
+/**
+ * \brief An open addressing hash table storing the entries of the linear
+ * methods, used in place of the generic store of ps::OnlineServer
+ *
+ * - The keys are stored in a flat array with linear probing, and the values in
+ *   the struct-of-arrays layout: the i-th 4-byte word of all entries is a
+ *   separated array. There is no per-key memory allocation, which costs more
+ *   than the entry itself for large models.
+ * - The table grows incrementally. When it is too full, a twice larger table
+ *   is allocated, and each following request moves a few entries from the old
+ *   table, so no request is stalled by rehashing all keys.
+ * - A request is processed as a batch over its sorted key list, the slots
+ *   several keys ahead are prefetched to hide the memory latency.
+ *
+ * The entries are updated through the Handle as ps::OnlineServer, but a push
+ * request is passed to the handle as a whole: the entries of all keys are
+ * gathered into a contiguous array, updated by the batch Handle::Push, and then
+ * scattered back. So the handle can vectorize the update.
+ *
+ * Optionally, a key is admitted only after it has been pushed min_count times,
+ * which is counted by a count-min sketch. Most keys of hashed features appear
+ * only a few times, and creating entries for them costs most of the memory. The
+ * pushes of a key not admitted only increase its count, and its pulls return
+ * 0.
+ *
+ * Optionally, stale or zero entries are evicted by an EvictionPolicy, which
+ * needs one more byte per slot. The sweep of the table is done incrementally
+ * by the push requests. A removed slot is filled by shifting the following
+ * slots backward, so no tombstone is left.
+ *
+ * With more than one thread, the keys are divided into stripes by hashing, and
+ * each stripe has its own table, sketch, buffers and a copy of the handle. A
+ * request is split by stripes and the stripes are processed in parallel by a
+ * thread pool. A stripe is only touched by one thread, and requests are still
+ * processed one by one, so no lock is needed and the updates of a key keep the
+ * request order. The handle must allow Push and Pull on different copies
+ * concurrently. Handle::Start is called on all copies, and Handle::Finish only
+ * on the first one.
+ *
+ * \tparam Entry the entry, a POD whose size is a multiple of 4 bytes
+ * \tparam Handle the handle, which also needs a batch Push(const ps::Key* key,
+ * size_t n, const float* grad, size_t k, Entry* val)
+ */
+template <typename Entry, typename Handle>
+class FlatStore : public ps::KVStore {
+ public:
+  /**
+   * \brief constructor
+   *
+   * @param handle the handle
+   * @param pull_val_len the number of values pulled for each key
+   * @param id the customer id, the same one as ps::OnlineServer uses
+   */
+  FlatStore(const Handle& handle, int pull_val_len = 1,
+            int id = ps::NextCustomerID())
+      : ps::KVStore(id), k_(pull_val_len) {
+    CHECK_GT(k_, 0);
+    stripes_.push_back(new Stripe(handle, false));
+  }
+  virtual ~FlatStore() {
+    for (auto st : stripes_) delete st;
+    delete evict_; delete pool_;
+  }
+
+  /**
+   * \brief processes requests with num_threads threads. It must be called
+   * before inserting any key, and before SetAdmission
+   */
+  void SetThreads(int num_threads) {
+    CHECK_EQ(size(), (size_t)0);
+    num_threads = std::max(num_threads, 1);
+    delete pool_; pool_ = NULL;
+    if (num_threads > 1) pool_ = new ThreadPool(num_threads);
+    Handle h = stripes_[0]->handle;
+    for (auto st : stripes_) delete st;
+    stripes_.clear();
+    for (int i = 0; i < num_threads; ++i) {
+      stripes_.push_back(new Stripe(h, evict_));
+    }
+  }
+
+  /**
+   * \brief only creates an entry for a key after it is pushed min_count times
+   *
+   * @param min_count the minimal count, <= 1 means admitting all keys
+   * @param sketch_size the number of counters to count the keys, divided among
+   * the stripes
+   */
+  void SetAdmission(int min_count, size_t sketch_size) {
+    min_count_ = min_count;
+    for (auto st : stripes_) {
+      delete st->sketch; st->sketch = NULL;
+      if (min_count > 1) {
+        st->sketch = new CountMinSketch(sketch_size / stripes_.size());
+      }
+    }
+  }
+
+  /**
+   * \brief evicts entries according to the policy. It must be called before
+   * inserting any key
+   *
+   * @param evict the policy, which will be deleted by this store
+   * @param on_evict called for each evicted entry. It is called by several
+   * threads concurrently if there are more than one thread
+   */
+  void SetEviction(EvictionPolicy* evict,
+                   const std::function<void(const Entry&)>& on_evict) {
+    CHECK_EQ(size(), (size_t)0);
+    delete evict_;
+    evict_ = evict->enabled() ? evict : NULL;
+    if (!evict_) delete evict;
+    on_evict_ = on_evict;
+    Clear();
+  }
+
+  /**
+   * \brief a training data pass starts. It can be called by any thread
+   */
+  void StartIter() { if (evict_) evict_->StartIter(); }
+
+  /**
+   * \brief blocks the requests until Unlock, such as to fork a consistent
+   * snapshot. A request being processed is finished first
+   */
+  void Lock() { mu_.lock(); }
+  void Unlock() { mu_.unlock(); }
+
+  virtual void Clear() {
+    for (auto st : stripes_) st->Clear(evict_);
+  }
+
+  virtual void HandlePush(ps::Message* msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Start(true, msg);
+    ps::SArray<ps::Key> key(msg->key);
+    size_t n = key.size();
+    if (n > 0) {
+      CHECK_EQ(msg->value.size(), (size_t)1);
+      ps::SArray<float> val(msg->value[0]);
+      size_t k = val.size() / n;
+      CHECK_EQ(val.size(), k * n);
+      bool sweep = evict_ && evict_->Tick();
+      if (stripes_.size() == 1) {
+        Push(stripes_[0], key.data(), val.data(), n, k, sweep);
+      } else {
+        Split(key.data(), val.data(), n, k);
+        ForEachStripe([this, k, sweep](Stripe* st) {
+            Push(st, st->key_buf.data(), st->grad_buf.data(), st->pos.size(), k,
+                 sweep);
+          });
+      }
+    }
+    stripes_[0]->handle.Finish();
+  }
+
+  virtual void HandlePull(ps::Message* msg) {
+    std::lock_guard<std::mutex> lk(mu_);
+    Start(false, msg);
+    ps::SArray<ps::Key> key(msg->key);
+    size_t n = key.size();
+    ps::SArray<float> val(n * k_);
+    if (stripes_.size() == 1) {
+      Pull(stripes_[0], key.data(), n, NULL, val.data());
+    } else {
+      Split(key.data(), NULL, n, 0);
+      float* out = val.data();
+      ForEachStripe([this, out](Stripe* st) {
+          Pull(st, st->key_buf.data(), st->pos.size(), st->pos.data(), out);
+        });
+    }
+    msg->clear_value();
+    msg->add_value(val);
+    stripes_[0]->handle.Finish();
+  }
+
+  virtual void Load(Stream* fi) { Load(fi, 0, kEmpty, nullptr); }
+
+  /**
+   * \brief loads the entries saved by Save, but keeps only the keys in [begin,
+   * end), such as the ones of this server when the model was saved by a
+   * different number of servers
+   *
+   * @param drop if not empty, called on each entry loaded and then dropped
+   */
+  void Load(Stream* fi, ps::Key begin, ps::Key end,
+            const std::function<void(const Entry&)>& drop) {
+    std::lock_guard<std::mutex> lk(mu_);
+    ps::Key key;
+    Entry e;
+    while (fi->Read(&key, sizeof(key)) == sizeof(key)) {
+      e.Load(fi);
+      if (!InRange(key, begin, end)) {
+        if (drop) drop(e);
+        continue;
+      }
+      Stripe* st = stripes_[StripeOf(key)];
+      Reserve(st, 1);
+      FindOrInsert(st, key).Set(e);
+    }
+  }
+
+  virtual void Save(Stream* fo) const {
+    Entry e;
+    auto save = [fo, &e](const Table& t, size_t begin) {
+      for (size_t i = begin; i < t.capacity(); ++i) {
+        if (t.key[i] == kEmpty) continue;
+        Slot{const_cast<Table*>(&t), i}.Get(&e);
+        if (e.Empty()) continue;
+        fo->Write(&t.key[i], sizeof(ps::Key));
+        e.Save(fo);
+      }
+    };
+    for (const auto st : stripes_) {
+      save(*st->cur, 0);
+      if (st->old) save(*st->old, st->pos_old);
+      if (st->has_special) {
+        Slot{const_cast<Table*>(&st->special), 0}.Get(&e);
+        if (!e.Empty()) {
+          ps::Key key = kEmpty;
+          fo->Write(&key, sizeof(key));
+          e.Save(fo);
+        }
+      }
+    }
+  }
+
+  /**
+   * \brief saves the non-empty entries into a ModelFile, see base/model_file.h
+   *
+   * The Entry needs static InitCols(std::vector<ModelColumn>*) to define the
+   * columns, SaveCols(ModelColumn*) const and LoadCols(const float* const*,
+   * const uint32_t*).
+   *
+   * @param name the name of the index file
+   * @param num_threads the number of threads sorting and writing, including
+   * the calling one. 1 creates no thread
+   */
+  void SaveFile(const std::string& name, int num_threads) const {
+    std::vector<std::pair<ps::Key, Slot>> kv;
+    Entry e;
+    auto add = [&kv, &e](const Table& t, size_t begin) {
+      for (size_t i = begin; i < t.capacity(); ++i) {
+        if (t.key[i] == kEmpty) continue;
+        Slot s{const_cast<Table*>(&t), i};
+        s.Get(&e);
+        if (!e.Empty()) kv.push_back(std::make_pair(t.key[i], s));
+      }
+    };
+    for (const auto st : stripes_) {
+      add(*st->cur, 0);
+      if (st->old) add(*st->old, st->pos_old);
+      if (st->has_special) {
+        Slot s{const_cast<Table*>(&st->special), 0};
+        s.Get(&e);
+        if (!e.Empty()) kv.push_back(std::make_pair(kEmpty, s));
+      }
+    }
+    ThreadPool pool(num_threads);
+    ParallelSort(&kv, &pool, [](const std::pair<ps::Key, Slot>& a,
+                                const std::pair<ps::Key, Slot>& b) {
+                   return a.first < b.first;
+                 });
+    std::vector<uint64_t> key(kv.size());
+    for (size_t i = 0; i < kv.size(); ++i) key[i] = kv[i].first;
+    std::vector<ModelColumn> cols;
+    Entry::InitCols(&cols);
+    ModelFile::Write(name, key, cols, num_threads, [&kv](
+        size_t begin, size_t end, std::vector<ModelColumn>* cols) {
+      Entry e;
+      for (size_t i = begin; i < end; ++i) {
+        kv[i].second.Get(&e);
+        e.SaveCols(cols->data());
+      }
+    });
+  }
+
+  /**
+   * \brief loads the ModelFiles saved by SaveFile, but keeps only the keys in
+   * [begin, end). The chunks of all files are read concurrently, and the ones
+   * out of the range are skipped
+   *
+   * @param names the names of the index files
+   * @param begin the first key
+   * @param end the key after the last one
+   * @param num_threads the number of threads reading chunks
+   */
+  void LoadFile(const std::vector<std::string>& names, ps::Key begin,
+                ps::Key end, int num_threads) {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<ModelColumn> cols;
+    Entry::InitCols(&cols);
+    size_t ns = stripes_.size();
+    std::vector<std::mutex> mu(ns);
+    std::atomic<int> tid(0);
+    ModelFile::Read(ModelFile::ChunkFiles(names, begin, end), num_threads, [&](
+        size_t, const ModelChunk& chunk) {
+      // count the keys of each stripe, ns marks a key out of the range
+      size_t n = chunk.size();
+      std::vector<uint32_t> sid(n);
+      std::vector<size_t> cnt(ns + 1, 0);
+      for (size_t i = 0; i < n; ++i) {
+        ps::Key key = chunk.key()[i];
+        sid[i] = InRange(key, begin, end) ? StripeOf(key) : ns;
+        ++ cnt[sid[i]];
+      }
+      // insert the keys stripe by stripe, starting from different stripes in
+      // different threads to reduce the contention
+      int t = tid ++;
+      Entry e;
+      for (size_t j = 0; j < ns; ++j) {
+        size_t s = (t + j) % ns;
+        if (cnt[s] == 0) continue;
+        Stripe* st = stripes_[s];
+        std::lock_guard<std::mutex> lk(mu[s]);
+        Reserve(st, cnt[s]);
+        ModelRowIter it(chunk, cols);
+        for (size_t i = 0; it.Next(); ++i) {
+          if (sid[i] != s) continue;
+          e.LoadCols(it.val(), it.len());
+          FindOrInsert(st, it.key()).Set(e);
+        }
+      }
+    });
+  }
+
+  /**
+   * \brief returns the number of keys stored
+   */
+  size_t size() const {
+    size_t n = 0;
+    for (const auto st : stripes_) {
+      n += st->cur->size + (st->old ? st->old->size : 0) + st->has_special;
+    }
+    return n;
+  }
+
+ private:
+  static const int kNumWords = sizeof(Entry) / sizeof(uint32_t);
+  static_assert(sizeof(Entry) == kNumWords * sizeof(uint32_t),
+                "the size of Entry must be a multiple of 4 bytes");
+  /// \brief the key marks an empty slot
+  static const ps::Key kEmpty = static_cast<ps::Key>(-1);
+  /// \brief the number of keys prefetched ahead
+  static const size_t kPrefetch = 8;
+  /// \brief the minimal number of entries moved from the old table each time
+  static const size_t kMinStep = 1024;
+  static const size_t kMinCapacity = 1024;
+  /// \brief grow the table if the load factor exceeds it
+  static constexpr double kMaxLoad = .7;
+  static const size_t kNoSweep = static_cast<size_t>(-1);
+
+  struct Table {
+    Table(size_t cap, bool marked) : key(cap, kEmpty), mask(cap - 1) {
+      CHECK_EQ(cap & mask, (size_t)0) << "capacity must be a power of 2";
+      for (auto& v : val) v.resize(cap);
+      if (marked) mark.resize(cap, 0);
+    }
+    size_t capacity() const { return key.size(); }
+    size_t Home(ps::Key k) const {
+      uint64_t h = k * 0x9E3779B97F4A7C15ULL;
+      return (h ^ (h >> 32)) & mask;
+    }
+    // returns the slot storing k, or the empty slot where k should be inserted
+    size_t Probe(ps::Key k) const {
+      size_t i = Home(k);
+      while (key[i] != k && key[i] != kEmpty) i = (i + 1) & mask;
+      return i;
+    }
+    // removes the key at slot i, and moves the following keys backward if
+    // they are not at their home slots
+    void Erase(size_t i) {
+      for (size_t j = (i + 1) & mask; key[j] != kEmpty; j = (j + 1) & mask) {
+        // keep j if its home is in (i, j] cyclically
+        size_t h = Home(key[j]);
+        if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) continue;
+        key[i] = key[j];
+        for (auto& v : val) v[i] = v[j];
+        if (mark.size()) mark[i] = mark[j];
+        i = j;
+      }
+      key[i] = kEmpty; -- size;
+    }
+    std::vector<ps::Key> key;
+    std::vector<uint32_t> val[kNumWords];
+    std::vector<uint8_t> mark;
+    size_t mask;
+    size_t size = 0;
+  };
+
+  // the position of an entry. t is NULL if not found
+  struct Slot {
+    Table* t;
+    size_t i;
+    void Get(Entry* e) const {
+      uint32_t v[kNumWords];
+      for (int j = 0; j < kNumWords; ++j) v[j] = t->val[j][i];
+      memcpy(e, v, sizeof(Entry));
+    }
+    void Set(const Entry& e) const {
+      uint32_t v[kNumWords];
+      memcpy(v, &e, sizeof(Entry));
+      for (int j = 0; j < kNumWords; ++j) t->val[j][i] = v[j];
+    }
+  };
+
+  // the keys in a stripe, only accessed by one thread at a time
+  struct Stripe {
+    Stripe(const Handle& h, bool marked)
+        : handle(h), cur(new Table(kMinCapacity, marked)),
+          special(1, marked) { }
+    ~Stripe() { delete cur; delete old; delete sketch; }
+    void Clear(bool marked) {
+      delete cur; delete old; old = NULL;
+      cur = new Table(kMinCapacity, marked);
+      special = Table(1, marked);
+      has_special = false;
+      sweep_pos = kNoSweep;
+    }
+    Handle handle;
+    // the current table, and the old one which is being moved into cur
+    Table* cur;
+    Table* old = NULL;
+    // the slots of old before pos_old have been moved
+    size_t pos_old = 0;
+    // the entry of the key kEmpty
+    Table special;
+    bool has_special = false;
+    // buffers for a request. pos are the positions of the keys in the request
+    std::vector<Slot> slots;
+    std::vector<Entry> entries;
+    std::vector<ps::Key> key_buf;
+    std::vector<float> grad_buf;
+    std::vector<size_t> pos;
+    CountMinSketch* sketch = NULL;
+    size_t sweep_pos = kNoSweep;
+  };
+
+  // the maximal key is also in the last range, which ends at it
+  static bool InRange(ps::Key k, ps::Key begin, ps::Key end) {
+    return k >= begin && (k < end || end == static_cast<ps::Key>(-1));
+  }
+
+  size_t StripeOf(ps::Key k) const {
+    if (stripes_.size() == 1) return 0;
+    // use other bits than Table::Home
+    return ((k * 0xD6E8FEB86659FD93ULL) >> 32) % stripes_.size();
+  }
+
+  // splits the keys, and the values if val is not NULL, of a request into the
+  // buffers of the stripes. the keys in a stripe are still sorted
+  void Split(const ps::Key* key, const float* val, size_t n, size_t k) {
+    for (auto st : stripes_) {
+      st->key_buf.clear(); st->grad_buf.clear(); st->pos.clear();
+    }
+    for (size_t i = 0; i < n; ++i) {
+      Stripe* st = stripes_[StripeOf(key[i])];
+      st->key_buf.push_back(key[i]);
+      st->pos.push_back(i);
+      if (val) {
+        st->grad_buf.insert(st->grad_buf.end(), val + i * k, val + (i + 1) * k);
+      }
+    }
+  }
+
+  void Start(bool push, ps::Message* msg) {
+    for (auto st : stripes_) {
+      st->handle.Start(push, msg->task.time(), msg->task.cmd(), (void*)msg);
+    }
+  }
+
+  // runs fn on all stripes in parallel
+  void ForEachStripe(const std::function<void(Stripe*)>& fn) {
+    pool_->ParallelFor(stripes_.size(), [this, &fn](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) fn(stripes_[i]);
+      });
+  }
+
+  // pushes n keys with k gradients each. key and val may point to the buffers
+  // of st
+  void Push(Stripe* st, const ps::Key* key, const float* val, size_t n,
+            size_t k, bool start_sweep) {
+    if (evict_) {
+      if (start_sweep) StartSweep(st);
+      Sweep(st, std::max(2 * n, (size_t)kMinStep));
+    }
+    if (n == 0) return;
+    // the slots are not moved until the next Reserve or Sweep
+    Reserve(st, n);
+    st->slots.resize(n); st->entries.resize(n);
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (i + kPrefetch < n) Prefetch(st, key[i + kPrefetch]);
+      Slot s = Find(st, key[i]);
+      if (!s.t) {
+        if (st->sketch && st->sketch->Add(key[i]) < min_count_) continue;
+        s = Insert(st, key[i], s.i);
+      }
+      if (m < i) {
+        // some keys are not admitted, compact the admitted ones
+        if (key != st->key_buf.data()) {
+          st->key_buf.assign(key, key + n);
+          st->grad_buf.assign(val, val + n * k);
+          key = st->key_buf.data(); val = st->grad_buf.data();
+        }
+        st->key_buf[m] = key[i];
+        std::copy(val + i * k, val + (i + 1) * k, st->grad_buf.data() + m * k);
+      }
+      st->slots[m] = s;
+      s.Get(&st->entries[m]);
+      if (evict_) s.t->mark[s.i] = evict_->Touch(s.t->mark[s.i]);
+      ++ m;
+    }
+    if (m > 0) st->handle.Push(key, m, val, k, st->entries.data());
+    for (size_t i = 0; i < m; ++i) st->slots[i].Set(st->entries[i]);
+  }
+
+  // pulls n keys, the values of the i-th key are written at the pos[i]-th
+  // position of out, or the i-th if pos is NULL
+  void Pull(Stripe* st, const ps::Key* key, size_t n, const size_t* pos,
+            float* out) {
+    Entry e, empty;
+    for (size_t i = 0; i < n; ++i) {
+      if (i + kPrefetch < n) Prefetch(st, key[i + kPrefetch]);
+      Slot s = Find(st, key[i]);
+      if (s.t) s.Get(&e);
+      ps::Blob<float> send(out + (pos ? pos[i] : i) * k_, k_);
+      st->handle.Pull(key[i], s.t ? e : empty, send);
+    }
+  }
+
+  Slot Find(Stripe* st, ps::Key k) {
+    if (k == kEmpty) return Slot{st->has_special ? &st->special : NULL, 0};
+    if (st->old) {
+      // the entries before pos_old have been moved into cur
+      size_t i = st->old->Probe(k);
+      if (st->old->key[i] == k && i >= st->pos_old) return Slot{st->old, i};
+    }
+    size_t i = st->cur->Probe(k);
+    return Slot{st->cur->key[i] == k ? st->cur : NULL, i};
+  }
+
+  // call Reserve before inserting new keys
+  Slot FindOrInsert(Stripe* st, ps::Key k) {
+    Slot s = Find(st, k);
+    return s.t ? s : Insert(st, k, s.i);
+  }
+
+  // insert k, which is not found, at the slot i returned by Find
+  Slot Insert(Stripe* st, ps::Key k, size_t i) {
+    Slot s;
+    if (k == kEmpty) {
+      st->has_special = true; s = Slot{&st->special, 0};
+    } else {
+      s = Slot{st->cur, i};
+      st->cur->key[i] = k; ++ st->cur->size;
+    }
+    s.Set(Entry());
+    if (evict_) s.t->mark[s.i] = evict_->Touch(0);
+    return s;
+  }
+
+  void Prefetch(Stripe* st, ps::Key k) const {
+    const Table* t = st->cur;
+    size_t i = t->Home(k);
+    __builtin_prefetch(t->key.data() + i);
+    for (int j = 0; j < kNumWords; ++j) {
+      __builtin_prefetch(t->val[j].data() + i);
+    }
+  }
+
+  // make sure n keys can be inserted, and move entries from the old table
+  void Reserve(Stripe* st, size_t n) {
+    size_t step = std::max(2 * n, kMinStep);
+    if (st->old) Migrate(st, step);
+    if (st->cur->size + n <= st->cur->capacity() * kMaxLoad) return;
+    if (st->old) Migrate(st, st->old->capacity());
+    size_t cap = st->cur->capacity() * 2;
+    while (st->cur->size + n > cap * kMaxLoad) cap *= 2;
+    st->old = st->cur; st->pos_old = 0;
+    st->cur = new Table(cap, evict_);
+    Migrate(st, step);
+  }
+
+  // move the entries in the next num slots of the old table
+  void Migrate(Stripe* st, size_t num) {
+    Table* old = st->old, *cur = st->cur;
+    size_t& pos = st->pos_old;
+    size_t end = std::min(pos + num, old->capacity());
+    for (; pos < end; ++pos) {
+      ps::Key k = old->key[pos];
+      if (k == kEmpty) continue;
+      size_t i = cur->Probe(k);
+      cur->key[i] = k;
+      for (int j = 0; j < kNumWords; ++j) cur->val[j][i] = old->val[j][pos];
+      if (evict_) cur->mark[i] = old->mark[pos];
+      ++ cur->size; -- old->size;
+    }
+    if (pos == old->capacity()) { delete old; st->old = NULL; }
+  }
+
+  // starts a new sweep, the previous one is finished first
+  void StartSweep(Stripe* st) {
+    if (st->old) Migrate(st, st->old->capacity());
+    Sweep(st, st->cur->capacity());
+    st->sweep_pos = 0;
+  }
+
+  // checks the next num slots in the sweep. the special key is never evicted
+  void Sweep(Stripe* st, size_t num) {
+    if (st->old || st->sweep_pos == kNoSweep) return;
+    Table* cur = st->cur;
+    size_t& pos = st->sweep_pos;
+    size_t end = std::min(pos + num, cur->capacity());
+    Entry e;
+    while (pos < end) {
+      if (cur->key[pos] == kEmpty) { ++ pos; continue; }
+      Slot{cur, pos}.Get(&e);
+      if (evict_->Sweep(&cur->mark[pos], e.Empty())) {
+        if (on_evict_) on_evict_(e);
+        // check this slot again, another key may be moved into it
+        cur->Erase(pos);
+      } else {
+        ++ pos;
+      }
+    }
+    if (pos == cur->capacity()) pos = kNoSweep;
+  }
+
+  int k_;
+  std::vector<Stripe*> stripes_;
+  ThreadPool* pool_ = NULL;
+  std::mutex mu_;
+  // admission
+  int min_count_ = 0;
+  // eviction
+  EvictionPolicy* evict_ = NULL;
+  std::function<void(const Entry&)> on_evict_;
+};
+
+template <typename Entry, typename Handle>
+const ps::Key FlatStore<Entry, Handle>::kEmpty;
+template <typename Entry, typename Handle>
+const size_t FlatStore<Entry, Handle>::kMinStep;
+
+}  // namespace linear
+}  // namespace dmlc
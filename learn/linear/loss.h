@@ -27,14 +27,14 @@ class ScalarLoss {
    *
    * @param data X and Y
    * @param w weight
-   * @param nt num of threads
+   * @param pool the thread pool for computation
    */
   void Init(const RowBlock<unsigned>& data,
-            const std::vector<V>& w, int nt) {
+            const std::vector<V>& w, ThreadPool* pool) {
     data_ = data;
+    pool_ = pool;
     Xw_.resize(data_.size);
-    SpMV::Times(data_, w, &Xw_, nt_);
-    nt_ = nt;
+    SpMV::Times(data_, w, &Xw_, pool_);
     init_ = true;
   }
 
@@ -66,7 +66,7 @@ class ScalarLoss {
   bool init_;
   RowBlock<unsigned> data_;
   std::vector<V> Xw_;  // X * w
-  int nt_;
+  ThreadPool* pool_;
 };
 
 /**
@@ -77,10 +77,10 @@ class BinClassLoss : public ScalarLoss<V> {
  public:
   using ScalarLoss<V>::data_;
   using ScalarLoss<V>::Xw_;
-  using ScalarLoss<V>::nt_;
+  using ScalarLoss<V>::pool_;
   virtual void Evaluate(Progress* prog) {
     ScalarLoss<V>::Evaluate(prog);
-    BinClassEval<V> eval(data_.label, Xw_.data(), Xw_.size(), nt_);
+    BinClassEval<V> eval(data_.label, Xw_.data(), Xw_.size(), pool_);
     prog->auc()     = eval.AUC();
     prog->acc()     = eval.Accuracy(0);
   }
@@ -94,24 +94,25 @@ class LogitLoss : public BinClassLoss<V> {
  public:
   using ScalarLoss<V>::data_;
   using ScalarLoss<V>::Xw_;
-  using ScalarLoss<V>::nt_;
+  using ScalarLoss<V>::pool_;
   using ScalarLoss<V>::init_;
 
   virtual void Evaluate(Progress* prog) {
     BinClassLoss<V>::Evaluate(prog);
-    BinClassEval<V> eval(data_.label, Xw_.data(), Xw_.size(), nt_);
+    BinClassEval<V> eval(data_.label, Xw_.data(), Xw_.size(), pool_);
     prog->objv() = eval.LogitObjv();
   }
 
   virtual void CalcGrad(std::vector<V>* grad) {
     CHECK(init_);
     std::vector<V> dual(data_.size);
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < data_.size; ++i) {
-      V y = data_.label[i] > 0 ? 1 : -1;
-      dual[i] = - y / ( 1 + exp ( y * Xw_[i] ));
-    }
-    SpMV::TransTimes(data_, dual, grad, nt_);
+    pool_->ParallelFor(data_.size, [this, &dual](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          V y = data_.label[i] > 0 ? 1 : -1;
+          dual[i] = - y / ( 1 + exp ( y * Xw_[i] ));
+        }
+      });
+    SpMV::TransTimes(data_, dual, grad, pool_);
   }
 };
 
@@ -123,36 +124,40 @@ class SquareHingeLoss : public BinClassLoss<V> {
  public:
   using ScalarLoss<V>::data_;
   using ScalarLoss<V>::Xw_;
-  using ScalarLoss<V>::nt_;
+  using ScalarLoss<V>::pool_;
   using ScalarLoss<V>::init_;
 
   virtual void Evaluate(Progress* prog) {
     BinClassLoss<V>::Evaluate(prog);
-    V objv = 0;
-#pragma omp parallel for reduction(+:objv) num_threads(nt_)
-    for (size_t i = 0; i < data_.size; ++i) {
-      V y = data_.label[i] > 0 ? 1 : -1;
-      V tmp = std::max(1 - y * Xw_[i], (V)0);
-      objv += tmp * tmp;
-    }
-    prog->objv() = objv;
+    std::vector<V> objv(pool_->num_threads(), 0);
+    pool_->ParallelFor(data_.size, [this, &objv](int tid, const Range& rg) {
+        V s = 0;
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          V y = data_.label[i] > 0 ? 1 : -1;
+          V tmp = std::max(1 - y * Xw_[i], (V)0);
+          s += tmp * tmp;
+        }
+        objv[tid] = s;
+      });
+    prog->objv() = 0;
+    for (V s : objv) prog->objv() += s;
   }
 
   virtual void CalcGrad(std::vector<V>* grad) {
     CHECK(init_);
 
     std::vector<V> dual(data_.size);
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < data_.size; ++i) {
-      V y = data_.label[i] > 0 ? 1 : -1;
-      dual[i] = y * (y * Xw_[i] > 1.0);
-    }
-    SpMV::TransTimes(data_, dual, grad, nt_);
-
-#pragma omp parallel for num_threads(nt_)
-    for (size_t i = 0; i < grad->size(); ++i) {
-      (*grad)[i] *= -2.0;
-    }
+    pool_->ParallelFor(data_.size, [this, &dual](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          V y = data_.label[i] > 0 ? 1 : -1;
+          dual[i] = y * (y * Xw_[i] > 1.0);
+        }
+      });
+    SpMV::TransTimes(data_, dual, grad, pool_);
+
+    pool_->ParallelFor(grad->size(), [grad](int, const Range& rg) {
+        for (size_t i = rg.begin; i < rg.end; ++i) (*grad)[i] *= -2.0;
+      });
   }
 };
 
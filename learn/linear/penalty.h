@@ -1,4 +1,5 @@
 #pragma once
+#include <cmath>
 #include "dmlc/logging.h"
 namespace dmlc {
 namespace linear {
@@ -33,12 +34,34 @@ class L1L2 {
    * approximated by sqrt(t) or sqrt(\sum_i grad_i^2)
    * \return the new w
    */
-  inline T Solve(T z, T eta) {
+  inline T Solve(T z, T eta) const {
     // soft-thresholding
-    CHECK_GT(eta, 0);
+    DCHECK_GT(eta, 0);
     if (z <= lambda1_ && z >= -lambda1_) return 0;
     return (z > 0 ? z - lambda1_ : z + lambda1_) / (eta + lambda2_);
   }
+
+  /**
+   * \brief Solve n proximal operators, w[i] = Solve(z[i], eta[i]).
+   *
+   * It is branchless so that the compiler can vectorize it. A zero result may
+   * be -0.
+   */
+  inline void Solve(const T* z, const T* eta, size_t n, T* w) const {
+    for (size_t i = 0; i < n; ++i) {
+      T a = std::abs(z[i]) - lambda1_;
+      a = a > 0 ? a : 0;
+      w[i] = std::copysign(a, z[i]) / (eta[i] + lambda2_);
+    }
+  }
+
+  /**
+   * \brief The inverse of Solve, returns a z such that Solve(z, eta) = w
+   */
+  inline T Inverse(T w, T eta) const {
+    if (w == 0) return 0;
+    return w * (eta + lambda2_) + (w > 0 ? lambda1_ : -lambda1_);
+  }
  private:
   T lambda1_, lambda2_;
 };
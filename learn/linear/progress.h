@@ -5,22 +5,24 @@ namespace dmlc {
 namespace linear {
 
 struct Progress {
-  Progress() : data(6) { }
+  Progress() : data(7) { }
 
   static std::string HeadStr() {
-    return "  ttl #ex   inc #ex    |w|_0       logloss  accuracy     AUC";
+    return "  ttl #ex   inc #ex    |w|_0       logloss  accuracy     AUC"
+        "  evict(MB)";
   }
 
   std::string PrintStr() {
     ttl_ex += new_ex();
     nnz_w += new_w();
+    ttl_reclaimed += reclaimed();
 
     if (new_ex() == 0) return "";
 
     char buf[256];
-    snprintf(buf, 256, "%8.3g  %8.3g  %11.6g  %8.6lf  %8.6lf  %8.6lf",
+    snprintf(buf, 256, "%8.3g  %8.3g  %11.6g  %8.6lf  %8.6lf  %8.6lf  %9.3g",
              ttl_ex, new_ex(), nnz_w, objv() / new_ex(),
-             acc() / count(), auc() / count());
+             acc() / count(), auc() / count(), ttl_reclaimed / 1e6);
     return std::string(buf);
   }
 
@@ -32,9 +34,10 @@ struct Progress {
   double& count() { return data[3]; }
   double& new_ex() { return data[4]; }
   double& new_w() { return data[5]; }
+  double& reclaimed() { return data[6]; }
 
   std::vector<double> data;
-  double ttl_ex = 0, nnz_w = 0;
+  double ttl_ex = 0, nnz_w = 0, ttl_reclaimed = 0;
 
 };
 
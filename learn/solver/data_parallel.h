@@ -2,6 +2,7 @@
  * @file   data_parallel.h
  * @brief  Template for the scheduler dispatches data into worker nodes
  */
+#include <deque>
 #include "ps.h"
 #include "base/string_stream.h"
 #include "base/workload.h"
@@ -46,6 +47,12 @@ class DataParScheduler : public ps::App {
    */
   int num_parts_per_file_ = 10;
 
+  /**
+   * \brief the number of data parts in a workload. a worker reads these parts
+   * concurrently.
+   */
+  int num_parts_per_wl_ = 1;
+
   /**
    * \brief batch or online assignment
    *
@@ -71,6 +78,17 @@ class DataParScheduler : public ps::App {
    */
   int straggler_ = 3;
 
+  /**
+   * \brief the number of workloads assigned to a worker ahead of the one it is
+   * processing.
+   *
+   * the worker then can open and start reading the next data part while the
+   * current one drains, which hides the latency of connecting to the (remote)
+   * storage. 0 means assigning a new workload only after the previous one is
+   * finished.
+   */
+  int lookahead_ = 1;
+
   /**
    * \brief whether allow each worker to tell the scheduler which file it can
    * access
@@ -91,7 +109,8 @@ class DataParScheduler : public ps::App {
    * \brief Start dispatching
    */
   void StartDispatch() {
-    pool_.Clear(); pool_.Init(shuffle_, straggler_);
+    pool_.Clear(); pool_.Init(shuffle_, straggler_, num_parts_per_wl_);
+    ahead_mu_.lock(); ahead_.clear(); ahead_mu_.unlock();
 
     if (use_worker_local_data_) {
       // ask the workers to match the files
@@ -131,6 +150,7 @@ class DataParScheduler : public ps::App {
   DataParScheduler() {
     sys_.manager().AddNodeFailureHandler([this](const std::string& id) {
         pool_.Reset(id);
+        ahead_mu_.lock(); ahead_.erase(id); ahead_mu_.unlock();
       });
   }
   virtual ~DataParScheduler() { }
@@ -149,11 +169,23 @@ class DataParScheduler : public ps::App {
       return;
     }
 
-    // a worker finished a workload, assign it a new one if available
+    // a worker finished a workload, assign it new ones if available
     pool_.Finish(id);
-    Workload wl = workload_; pool_.Get(id, &wl);
-    if (wl.Empty()) return;
-    wl.file[0].format = data_format_;
+    std::lock_guard<std::mutex> lk(ahead_mu_);
+    auto& ahead = ahead_[id];
+    // the ones not sent may have been given to others as this worker was slow
+    if (pool_.TakeReleased(id)) ahead.clear();
+    while ((int)ahead.size() <= lookahead_) {
+      Workload wl = workload_; pool_.Get(id, &wl);
+      if (wl.Empty()) break;
+      for (auto& f : wl.file) f.format = data_format_;
+      ahead.push_back(wl);
+    }
+    if (ahead.empty()) return;
+
+    // send the earliest one, and tell the worker what comes next
+    Workload wl = ahead.front(); ahead.pop_front();
+    if (ahead.size()) wl.prefetch = ahead.front().file;
     SendWorkload(id, wl);
   }
 
@@ -166,6 +198,10 @@ class DataParScheduler : public ps::App {
   }
 
   WorkloadPool pool_;
+
+  // workloads assigned to a worker but not sent yet
+  std::unordered_map<std::string, std::deque<Workload>> ahead_;
+  std::mutex ahead_mu_;
 };
 
 
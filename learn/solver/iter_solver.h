@@ -2,6 +2,10 @@
  * @file   iter_solver.h
  * @brief  Template for an iterate solver
  */
+#include <unistd.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <string.h>
 #include "solver/data_parallel.h"
 namespace dmlc {
 namespace solver {
@@ -19,10 +23,12 @@ struct IterCmd : public DataParCmd {
   void set_iter(int iter) { cmd |= (iter+1) << 16; }
   void set_load_model() { cmd |= 1<<1; }
   void set_save_model() { cmd |= 1<<2; }
+  void set_start_iter() { cmd |= 1<<3; }
 
   // accessors
   bool load_model() const { return cmd & 1<<1; }
   bool save_model() const { return cmd & 1<<2; }
+  bool start_iter() const { return cmd & 1<<3; }
   int iter() const { return (cmd >> 16)-1; }
 };
 
@@ -55,6 +61,16 @@ class IterScheduler : public DataParScheduler {
     return Submit(task, ps::kServerGroup);
   }
 
+  /**
+   * \brief Tell all servers that a training iteration starts, return the
+   * timestamp of this request
+   */
+  int StartIter(int iter) {
+    IterCmd cmd; cmd.set_start_iter(); cmd.set_iter(iter);
+    ps::Task task; task.set_cmd(cmd.cmd);
+    return Submit(task, ps::kServerGroup);
+  }
+
   /**
    * \brief Returns the aggregated progress among all woreker/servers since the
    * last time calling this function
@@ -86,6 +102,52 @@ class IterServer : public ps::App {
    */
   virtual void LoadModel(Stream* fi) = 0;
 
+  /**
+   * \brief Save model into files with the given name, such as a ModelFile.
+   * Returns false if not supported, then \ref SaveModel is used.
+   *
+   * @param forked true if called in the forked child of \ref
+   * SaveInBackground, where only the calling thread exists, so no thread can
+   * be created
+   */
+  virtual bool SaveModelFile(const std::string& name, bool forked) const {
+    return false;
+  }
+
+  /**
+   * \brief Load model from the parts saved by one or more servers, keeping
+   * only the keys in [begin, end). Returns false if not supported, then a model
+   * can only be loaded by as many servers as saved it, each of which loads its
+   * own part by \ref LoadModel
+   *
+   * @param parts the filenames of the parts
+   * @param begin the first key of this server
+   * @param end the key after the last one of this server
+   */
+  virtual bool LoadModelParts(const std::vector<std::string>& parts,
+                              ps::Key begin, ps::Key end) {
+    return false;
+  }
+
+  /**
+   * \brief A training iteration starts
+   */
+  virtual void StartIter(int iter) { }
+
+  /**
+   * \brief Blocks (lock = true) or resumes (lock = false) the updates of the
+   * model. A background snapshot is forked while the updates are blocked, so it
+   * is consistent. The default does nothing, then an entry being updated at the
+   * fork may be saved partially updated.
+   */
+  virtual void LockModel(bool lock) { }
+
+  /**
+   * \brief If true, the model is saved by a forked child process in the
+   * background, see \ref SaveInBackground
+   */
+  bool background_save_ = false;
+
   /**
    * \brief Report the progress to the scheduler
    */
@@ -94,30 +156,120 @@ class IterServer : public ps::App {
   // implementation
  public:
   IterServer() {}
-  virtual ~IterServer() {}
+  virtual ~IterServer() { WaitSave(); }
 
   virtual void ProcessRequest(ps::Message* request) {
-    if (request->task.msg().size() == 0) return;
     IterCmd cmd(request->task.cmd());
-    auto filename = ModelName(request->task.msg(), cmd.iter());
-    if (cmd.save_model()) {
-      Stream* fo = CHECK_NOTNULL(Stream::Create(filename.c_str(), "w"));
-      SaveModel(fo);
-      delete fo;
+    if (cmd.start_iter()) { StartIter(cmd.iter()); return; }
+    if (request->task.msg().size() == 0) return;
+    auto base = ModelName(request->task.msg(), cmd.iter());
+    auto filename = PartName(base, ps::NodeInfo::MyRank());
+    if (cmd.save_model() && background_save_) {
+      // wait for the final model, so it is complete once the job finishes
+      SaveInBackground(filename, cmd.iter() < 0);
+    } else if (cmd.save_model()) {
+      Save(filename);
     } else if (cmd.load_model()) {
-      Stream* fi = CHECK_NOTNULL(Stream::Create(filename.c_str(), "r"));
-      LoadModel(fi);
-      delete fi;
+      Load(base);
     }
   }
 
  private:
+  /**
+   * \brief Saves the model by a forked child process
+   *
+   * The child gets a copy-on-write view of the memory at the fork, and writes
+   * it while this process keeps updating the model. So training only pauses
+   * for the fork, which copies the page tables. The pages modified during
+   * saving are copied, so the memory may grow up to twice the model size.
+   *
+   * @param filename the file name
+   * @param wait if true, wait until the child finishes
+   */
+  void SaveInBackground(const std::string& filename, bool wait) {
+    // at most one snapshot at a time
+    WaitSave();
+    LockModel(true);
+    pid_t pid = fork();
+    if (pid == 0) {
+      // only this thread exists in the child, and the locks held by the other
+      // threads at the fork are never released. so neither touch the system
+      // nor create threads, the model is written by this thread alone
+      Save(filename, true);
+      _exit(0);
+    }
+    LockModel(false);
+    CHECK_GT(pid, 0) << "fork failed: " << strerror(errno);
+    save_pid_ = pid;
+    save_file_ = filename;
+    if (wait) WaitSave();
+  }
+
+  void Save(const std::string& filename, bool forked = false) const {
+    if (SaveModelFile(filename, forked)) return;
+    Stream* fo = CHECK_NOTNULL(Stream::Create(filename.c_str(), "w"));
+    SaveModel(fo);
+    delete fo;
+  }
+
+  /**
+   * \brief Loads a model saved by any number of servers
+   *
+   * If the number of servers is unchanged, then so are the key ranges, and only
+   * the part of this server is read. Otherwise all parts are read and filtered
+   * by the key range of this server.
+   */
+  void Load(const std::string& base) {
+    int n = 0;
+    while (true) {
+      Stream* fi = Stream::Create(PartName(base, n).c_str(), "r", true);
+      if (fi == NULL) break;
+      delete fi; ++ n;
+    }
+    CHECK_GT(n, 0) << "cannot find " << PartName(base, 0);
+    int num_servers = ps::NodeInfo::NumServers();
+    std::vector<std::string> parts;
+    if (n == num_servers) {
+      parts.push_back(PartName(base, ps::NodeInfo::MyRank()));
+    } else {
+      for (int i = 0; i < n; ++i) parts.push_back(PartName(base, i));
+    }
+    auto range = ps::NodeInfo::KeyRange();
+    if (LoadModelParts(parts, range.begin(), range.end())) return;
+    CHECK_EQ(n, num_servers) << base << " was saved by " << n
+                             << " servers, which cannot be loaded by "
+                             << num_servers << " servers with this model store";
+    Stream* fi = CHECK_NOTNULL(Stream::Create(parts[0].c_str(), "r"));
+    LoadModel(fi);
+    delete fi;
+  }
+
+  /**
+   * \brief Waits for the child process saving the model, if any
+   */
+  void WaitSave() {
+    if (save_pid_ <= 0) return;
+    int status;
+    while (waitpid(save_pid_, &status, 0) < 0) {
+      CHECK_EQ(errno, EINTR) << "waitpid failed: " << strerror(errno);
+    }
+    save_pid_ = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      LOG(ERROR) << "failed to save " << save_file_;
+    }
+  }
+
   std::string ModelName(const std::string& base, int iter) {
     std::string name = base;
     if (iter >= 0) name += "_iter-" + std::to_string(iter);
-    return name + "_part-" + std::to_string(ps::NodeInfo::MyRank());
+    return name;
+  }
+  std::string PartName(const std::string& name, int rank) {
+    return name + "_part-" + std::to_string(rank);
   }
   ps::Slave<double> reporter_;
+  pid_t save_pid_ = 0;
+  std::string save_file_;
 };
 
 /**
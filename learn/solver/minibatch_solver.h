@@ -3,7 +3,12 @@
  * @brief  Template for an asynchronous minibatch solver
  */
 #include "solver/iter_solver.h"
+#include "solver/ssp_clock.h"
 #include "base/minibatch_iter.h"
+#include "base/semaphore.h"
+#include "base/concurrency_controller.h"
+#include "base/thread_pool.h"
+#include "base/latency_histogram.h"
 namespace dmlc {
 namespace solver {
 
@@ -38,6 +43,18 @@ class MinibatchScheduler : public IterScheduler {
   /// \brief if set, then run a prediction task
   std::string predict_out_;
 
+  /**
+   * \brief if not NULL, prints the latency histograms reported by the workers
+   * and servers. it should be created by the derived class, and will be deleted
+   * by this class
+   */
+  LatencyMonitor* latency_ = NULL;
+
+  /**
+   * \brief the clocks of workers if the bounded delay is used
+   */
+  SSPClock* ssp_ = NULL;
+
   /**
    * \brief a user-defined stop criteria. stop the system if returns true
    *
@@ -68,6 +85,8 @@ class MinibatchScheduler : public IterScheduler {
     data_format_           = conf.data_format();
     num_parts_per_file_    = conf.num_parts_per_file();
     use_worker_local_data_ = conf.local_data();
+    lookahead_             = conf.lookahead();
+    num_parts_per_wl_      = conf.num_parts_per_workload();
     max_data_pass_         = conf.max_data_pass();
     print_sec_             = conf.print_sec();
     save_iter_             = conf.save_iter();
@@ -75,11 +94,17 @@ class MinibatchScheduler : public IterScheduler {
     model_in_              = conf.model_in();
     model_out_             = conf.model_out();
     predict_out_           = conf.predict_out();
+    if (conf.ssp_staleness() >= 0) {
+      ssp_ = new SSPClock(conf.ssp_staleness());
+      sys_.manager().AddNodeFailureHandler([this](const std::string& id) {
+          ssp_->Remove(id);
+        });
+    }
   }
 
  public:
   MinibatchScheduler() { }
-  virtual ~MinibatchScheduler() { }
+  virtual ~MinibatchScheduler() { delete latency_; delete ssp_; }
 
   /// \brief run iterations
   virtual bool Run() {
@@ -142,6 +167,7 @@ class MinibatchScheduler : public IterScheduler {
     if (is_train) {
       data_filename_ = train_data_;
       printf("Training: iter = %d\n", iter);
+      Wait(StartIter(iter));
     } else {
       data_filename_ = val_data_;
       if (type == Workload::PRED) {
@@ -185,6 +211,8 @@ class MinibatchScheduler : public IterScheduler {
   bool ShowProgress(bool is_train) {
     auto prog = GetProgress();
     auto disp = ProgString(prog);
+    auto lat = latency_ ? latency_->PrintStr(prog) : "";
+    if (lat.size()) printf("%5.0lf  %s\n", GetTime() - start_time_, lat.c_str());
     if (disp.empty()) return false;  // no progress...
     printf("%5.0lf  %s\n", GetTime() - start_time_, disp.c_str());
     fflush(stdout);
@@ -219,6 +247,18 @@ class MinibatchWorker : public IterWorker {
    */
   int concurrent_mb_ = 1;
 
+  /**
+   * \brief if true, the number of concurrent minibatches for training is
+   * adapted between \a min_concurrent_mb_ and \a concurrent_mb_ according to
+   * the measured latencies. see \ref ConcurrencyController
+   */
+  bool adaptive_concurrency_ = false;
+
+  /**
+   * \brief minimal concurrent minibatches if \a adaptive_concurrency_ is true
+   */
+  int min_concurrent_mb_ = 1;
+
   /**
    * \brief If > 0, then the minibatch is randomly selected among \a mb_size_ *
    * \a shuffle_ examples.
@@ -241,44 +281,135 @@ class MinibatchWorker : public IterWorker {
    */
   int val_concurrent_mb_ = 10;
 
+  /**
+   * \brief the thread pool shared by all computations of this worker, such as
+   * localizing and computing the gradients of concurrent minibatches. it should
+   * be created by the derived class, and will be deleted by this class
+   */
+  ThreadPool* pool_ = NULL;
+
+  /**
+   * \brief if not NULL, the latencies of all stages are recorded and
+   * periodically reported to the scheduler. it should be created by the derived
+   * class, and will be deleted by this class
+   */
+  LatencyMonitor* latency_ = NULL;
+
+  /**
+   * \brief if not NULL, a worker can start a training minibatch only if it is
+   * not too far ahead of the slowest worker. it should be created by the
+   * derived class, and will be deleted by this class
+   */
+  SSPClock* ssp_ = NULL;
+
   /**
    * \brief the time spent on real workload such as computing gradients. for
    * profiling usage
    */
   double workload_time_ = 0;
 
+  /**
+   * \brief the time spent on each stage of a minibatch, in sec
+   */
+  struct MinibatchTime {
+    /// \brief finding the unique feature ids
+    double localize = 0;
+    /// \brief from sending the pull request to receiving the model
+    double pull = 0;
+    /// \brief evaluating the objective and computing the gradients
+    double compute = 0;
+    /// \brief from sending the gradients to being acknowledged
+    double push = 0;
+  };
+
   /**
    * \brief Process one minibatch
+   *
+   * \param mb the minibatch, only valid during this call
+   * \param wl the workload containing only the part \a mb is read from. it can
+   * be called from several threads at the same time if the workload has
+   * multiple parts
    */
   virtual void ProcessMinibatch(const Minibatch& mb, const Workload& wl) = 0;
 
+  /**
+   * \brief Called when all minibatches of a workload are finished, such as to
+   * push the gradients buffered on this worker. It should return when the work
+   * is done
+   *
+   * \param wl the workload
+   */
+  virtual void FinishWorkload(const Workload& wl) { }
+
+  /**
+   * \brief Mark the gradients of n minibatches have been pushed, which advances
+   * the SSP clock. \ref FinishMinibatch calls it, while \ref FinishWorkload
+   * must call it if it pushes gradients kept locally
+   */
+  void FinishPush(int n) {
+    if (bounded_delay_ && n > 0) ssp_->FinishMinibatch(n);
+  }
+
   /**
    * \brief Mark one minibatch is finished
    *
    * one must call this function when the minibatch is actually done, namely the
-   * gradients have been pushed to the servers nodes
+   * gradients have been pushed to the servers nodes, or kept locally to be
+   * pushed later
+   *
+   * \param time the time spent on this minibatch
+   * \param num_pushed the number of minibatches whose gradients have been
+   * pushed by this one, by which the SSP clock advances. it is 0 if the
+   * gradients are kept locally, and k if the gradients of k minibatches are
+   * pushed together
    */
-  void FinishMinibatch() {
-    // wake the main thread
-    mb_mu_.lock(); -- num_mb_fly_; ++ num_mb_done_; mb_mu_.unlock();
-    mb_cond_.notify_one();
+  void FinishMinibatch(const MinibatchTime& time, int num_pushed = 1) {
+    double comp = time.localize + time.compute;
+    mb_mu_.lock();
+    int done = ++ num_mb_done_;
+    workload_time_ += comp;
+    double wl_time = workload_time_;
+    mb_mu_.unlock();
+
+    if (latency_) {
+      latency_->Add(LatencyMonitor::kLocalize, time.localize);
+      latency_->Add(LatencyMonitor::kPull, time.pull);
+      latency_->Add(LatencyMonitor::kCompute, time.compute);
+      latency_->Add(LatencyMonitor::kPush, time.push);
+      Progress prog;
+      if (latency_->Report(&prog)) ReportToScheduler(prog);
+    }
+
+    FinishPush(num_pushed);
+
+    // adjust the concurrency, and wake the main thread
+    int delta = adaptive_ ? ctrl_.Update(time.pull + time.push, comp) : 0;
+    ReleaseMinibatch(1 + delta);
+    if (-- num_mb_fly_ == 0) {
+      std::lock_guard<std::mutex> lk(mb_mu_);
+      mb_cond_.notify_all();
+    }
 
     // log info
-    double time = (GetTime() - start_);
+    double t = (GetTime() - start_);
     std::string overhead;
-    if (workload_time_ > 0) {
+    if (wl_time > 0) {
       overhead = "overhead " + std::to_string(
-          std::max(time - workload_time_, (double)0) / time * 100) + "%, ";
+          std::max(t - wl_time, (double)0) / t * 100) + "%, ";
     }
-    LOG(INFO) << num_mb_done_ << " done, avg time "
-              << time / num_mb_done_ << ", " << overhead
-              << num_mb_fly_ << " on running";
+    std::string limit;
+    if (adaptive_) limit = ", concurrency " + std::to_string(ctrl_.limit());
+    LOG(INFO) << done << " done, avg time "
+              << t / done << ", " << overhead
+              << num_mb_fly_ << " on running" << limit;
   }
 
   // implementation
  public:
   MinibatchWorker() { }
-  virtual ~MinibatchWorker() { }
+  virtual ~MinibatchWorker() {
+    ClearPrefetch(); delete slots_; delete pool_; delete latency_; delete ssp_;
+  }
 
  protected:
   virtual void Process(const Workload& wl) {
@@ -288,6 +419,13 @@ class MinibatchWorker : public IterWorker {
     float neg_sp  = train ? neg_sampling_ : 1.0;
     int max_mb    = wl.type == Workload::PRED ? 1 :
                     (train ? concurrent_mb_ : val_concurrent_mb_);
+    adaptive_     = train && adaptive_concurrency_;
+    if (adaptive_) {
+      if (!ctrl_inited_) {
+        ctrl_.Init(min_concurrent_mb_, concurrent_mb_); ctrl_inited_ = true;
+      }
+      max_mb = ctrl_.limit();
+    }
     LOG(INFO) << wl.ShortDebugString()
               << ", minibatch = " << mb_size
               << ", concurrency = " <<  max_mb
@@ -298,35 +436,155 @@ class MinibatchWorker : public IterWorker {
     start_ = GetTime();
     workload_time_ = 0;
 
+    // nothing is on processing now, reset the slots
+    delete slots_; slots_ = new Semaphore(max_mb);
+    debt_ = 0;
+
+    bounded_delay_ = train && ssp_;
+    if (bounded_delay_) ssp_->Activate();
+
     CHECK_GE(wl.file.size(), (size_t)1);
-    auto file = wl.file[0];
-    dmlc::data::MinibatchIter<FeaID> reader(
-        file.filename.c_str(), file.k, file.n, file.format.c_str(),
-        mb_size, shuffle, neg_sp);
-    reader.BeforeFirst();
-    while (reader.Next()) {
-      WaitMinibatch(max_mb);
-      ProcessMinibatch(reader.Value(), wl);
-      mb_mu_.lock(); ++ num_mb_fly_; mb_mu_.unlock();
+    std::vector<Reader*> readers;
+    for (const auto& f : wl.file) readers.push_back(CreateReader(f, wl));
+    // start reading the next workload while processing this one
+    ClearPrefetch();
+    Prefetch(wl);
+
+    if (wl.type == Workload::PRED || readers.size() == 1) {
+      // one part by one part to keep the order of predictions
+      for (size_t i = 0; i < readers.size(); ++i) {
+        Read(readers[i], SubWorkload(wl, i));
+      }
+    } else {
+      // read the parts concurrently by independent readers, their minibatches
+      // are interleaved
+      std::vector<std::thread> thr;
+      for (size_t i = 0; i < readers.size(); ++i) {
+        thr.emplace_back([this, &readers, &wl, i]() {
+            Read(readers[i], SubWorkload(wl, i));
+          });
+      }
+      for (auto& t : thr) t.join();
     }
+    for (auto r : readers) delete r;
 
     // wait untill all are done
-    WaitMinibatch(1);
+    std::unique_lock<std::mutex> lk(mb_mu_);
+    mb_cond_.wait(lk, [this] { return num_mb_fly_ == 0; });
+    lk.unlock();
+    FinishWorkload(wl);
+    if (bounded_delay_) ssp_->Deactivate();
+
+    Progress prog;
+    if (latency_ && latency_->Report(&prog, true)) ReportToScheduler(prog);
   }
 
  private:
-  // wait until the currenta number of on processing minibatch < num
-  inline void WaitMinibatch(int num) {
-    std::unique_lock<std::mutex> lk(mb_mu_);
-    mb_cond_.wait(lk, [this, num] {return num_mb_fly_ < num;});
+  using Reader = dmlc::data::MinibatchIter<FeaID>;
+
+  // process all minibatches of a reader
+  void Read(Reader* reader, const Workload& wl) {
+    double t = GetTime();
+    while (reader->Next()) {
+      double t1 = GetTime();
+      if (bounded_delay_) ssp_->StartMinibatch();
+      slots_->Wait();
+      ++ num_mb_fly_;
+      if (latency_) {
+        double t2 = GetTime();
+        latency_->Add(LatencyMonitor::kParse, t1 - t);
+        latency_->Add(LatencyMonitor::kQueue, t2 - t1);
+      }
+      ProcessMinibatch(reader->Value(), wl);
+      t = GetTime();
+    }
   }
 
-  int num_mb_fly_;
+  // give n slots back. if the limit has been decreased, the slots are kept
+  // until the debt is paid
+  void ReleaseMinibatch(int n) {
+    if (n < 0) { debt_ += -n; return; }
+    int d = debt_.load();
+    while (d > 0 && n > 0) {
+      int pay = std::min(d, n);
+      if (debt_.compare_exchange_weak(d, d - pay)) { n -= pay; break; }
+    }
+    if (n > 0) slots_->Post(n);
+  }
+
+  // the workload containing only the i-th part
+  static Workload SubWorkload(const Workload& wl, size_t i) {
+    Workload sub = wl;
+    sub.file = {wl.file[i]};
+    sub.prefetch.clear();
+    return sub;
+  }
+
+  /// \brief a reader being opened in a background thread
+  struct PrefetchReader {
+    Workload::File file;
+    Reader* reader = NULL;
+    std::thread* thr = NULL;
+  };
+
+  // create a reader for the file, the constructed reader starts parsing
+  // immediately in its own thread
+  Reader* NewReader(const Workload::File& file, const Workload& wl) {
+    bool  train   = wl.type == Workload::TRAIN;
+    int   mb_size = train ? mb_size_ : val_mb_size_;
+    int   shuffle = train ? mb_size_ * shuffle_ : 0;
+    float neg_sp  = train ? neg_sampling_ : 1.0;
+    return new Reader(file.filename.c_str(), file.k, file.n,
+                      file.format.c_str(), mb_size, shuffle, neg_sp);
+  }
+
+  // returns the prefetched reader of the file if any, otherwise create one
+  Reader* CreateReader(const Workload::File& file, const Workload& wl) {
+    for (size_t i = 0; i < prefetch_.size(); ++i) {
+      auto p = prefetch_[i];
+      if (!(p->file == file)) continue;
+      p->thr->join();
+      Reader* reader = p->reader;
+      delete p->thr; delete p;
+      prefetch_.erase(prefetch_.begin() + i);
+      return reader;
+    }
+    return NewReader(file, wl);
+  }
+
+  // open the readers of the next workload in background
+  void Prefetch(const Workload& wl) {
+    for (const auto& f : wl.prefetch) {
+      auto p = new PrefetchReader(); p->file = f;
+      p->thr = new std::thread([this, p, wl]() {
+          p->reader = NewReader(p->file, wl);
+        });
+      prefetch_.push_back(p);
+    }
+  }
+
+  // discard prefetched readers which are not used
+  void ClearPrefetch() {
+    for (auto p : prefetch_) {
+      p->thr->join(); delete p->thr; delete p->reader; delete p;
+    }
+    prefetch_.clear();
+  }
+
+  std::atomic<int> num_mb_fly_{0};
   int num_mb_done_;
   std::mutex mb_mu_;
   std::condition_variable mb_cond_;
   double start_;
 
+  // free slots for new minibatches
+  Semaphore* slots_ = NULL;
+  // slots to be taken back because of a decreased limit
+  std::atomic<int> debt_{0};
+  bool adaptive_ = false, ctrl_inited_ = false, bounded_delay_ = false;
+  ConcurrencyController ctrl_;
+  std::vector<PrefetchReader*> prefetch_;
+
 };
 
 }  // namespace solver
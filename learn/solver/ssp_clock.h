@@ -0,0 +1,166 @@
+/**
+ * @file   ssp_clock.h
+ * @brief  Bounded delay among workers (stale synchronous parallel)
+ */
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <limits>
+#include <sstream>
+#include "ps.h"
+namespace dmlc {
+namespace solver {
+
+/**
+ * \brief Bounds how far a worker can run ahead of the slowest one
+ *
+ * The clock of a worker is the number of minibatches it has finished, namely
+ * whose gradients have been pushed. A worker can start a new minibatch only if
+ * the number of its started minibatches is at most \a staleness larger than the
+ * minimal clock of all workers. staleness = 0 is the bulk synchronous minibatch
+ * SGD, while a large staleness is the fully asynchronous one.
+ *
+ * Only the workers processing a training workload are counted. A worker
+ * becomes active when it starts a workload, its clock is then forwarded to the
+ * minimal one of the other active workers, so a worker which has been idle for
+ * a while does not block the others.
+ *
+ * The same object is created on the scheduler, which tracks the clocks, and on
+ * the workers. A worker sends its clock to the scheduler whenever it finishes a
+ * minibatch, and learns the minimal clock from the replies.
+ */
+class SSPClock : public ps::Customer {
+ public:
+  /**
+   * \brief constructor
+   * @param staleness the maximal delay in minibatches
+   */
+  explicit SSPClock(int staleness)
+      : ps::Customer(kCustomerID), staleness_(staleness) {
+    CHECK_GE(staleness, 0);
+  }
+  virtual ~SSPClock() { }
+
+  /**
+   * \brief worker: starts a workload. it blocks until the scheduler replies
+   */
+  void Activate() {
+    Wait(Send(kActive, clock()));
+    std::lock_guard<std::mutex> lk(mu_);
+    started_ = clock_;
+  }
+
+  /**
+   * \brief worker: all minibatches of the workload are finished
+   */
+  void Deactivate() { Wait(Send(kIdle, clock())); }
+
+  /**
+   * \brief worker: blocks until a new minibatch can be started
+   */
+  void StartMinibatch() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (started_ - min_ > staleness_) {
+      // ask the scheduler again if no one finished in a while, the minibatches
+      // blocking me may belong to other workers
+      if (!cond_.wait_for(lk, std::chrono::milliseconds(kPollMs), [this] {
+            return started_ - min_ <= staleness_; })) {
+        int64_t c = clock_;
+        lk.unlock(); Send(kClock, c); lk.lock();
+      }
+    }
+    ++ started_;
+  }
+
+  /**
+   * \brief worker: n minibatches are finished
+   */
+  void FinishMinibatch(int n = 1) {
+    mu_.lock(); int64_t c = clock_ += n; mu_.unlock();
+    Send(kClock, c);
+  }
+
+  /**
+   * \brief scheduler: a worker is dead, stop waiting for it
+   */
+  void Remove(const std::string& id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    workers_.erase(id);
+  }
+
+  // implementation
+  virtual void ProcessRequest(ps::Message* request) {
+    int64_t c = std::stoll(request->task.msg());
+    int64_t min, mine;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      auto& w = workers_[request->sender];
+      int cmd = request->task.cmd();
+      if (cmd == kActive) {
+        w.active = false;
+        int64_t m = MinClock();
+        w.clock = std::max(c, m == kNone ? c : m);
+        w.active = true;
+      } else {
+        w.clock = std::max(w.clock, c);
+        if (cmd == kIdle) w.active = false;
+      }
+      min = MinClock(); mine = w.clock;
+      if (min == kNone) min = mine;
+    }
+    ps::Task res;
+    res.set_msg(std::to_string(min) + " " + std::to_string(mine));
+    Reply(request, res);
+  }
+
+  virtual void ProcessResponse(ps::Message* response) {
+    std::istringstream is(response->task.msg());
+    int64_t min, mine;
+    if (!(is >> min >> mine)) return;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      min_ = std::max(min_, min);
+      clock_ = std::max(clock_, mine);
+    }
+    cond_.notify_all();
+  }
+
+  /// \brief the customer id shared by the scheduler and the workers
+  static const int kCustomerID = 0x55c;
+
+ private:
+  enum Cmd { kActive = 1, kIdle, kClock };
+  static const int64_t kNone = std::numeric_limits<int64_t>::max();
+  enum { kPollMs = 10 };
+
+  int64_t clock() { std::lock_guard<std::mutex> lk(mu_); return clock_; }
+
+  int Send(int cmd, int64_t clock) {
+    ps::Task task; task.set_cmd(cmd); task.set_msg(std::to_string(clock));
+    return Submit(task, ps::SchedulerID());
+  }
+
+  // the minimal clock of the active workers
+  int64_t MinClock() {
+    int64_t min = kNone;
+    for (const auto& w : workers_) {
+      if (w.second.active) min = std::min(min, w.second.clock);
+    }
+    return min;
+  }
+
+  int staleness_;
+  std::mutex mu_;
+  std::condition_variable cond_;
+
+  // worker
+  int64_t clock_ = 0, started_ = 0, min_ = 0;
+
+  // scheduler
+  struct Worker { int64_t clock = 0; bool active = false; };
+  std::unordered_map<std::string, Worker> workers_;
+};
+
+}  // namespace solver
+}  // namespace dmlc
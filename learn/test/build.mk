@@ -1 +1,4 @@
-TEST=build/data_parallel_test build/iter_solver_test
+TEST=build/data_parallel_test build/iter_solver_test build/fm_scorer_bench \
+	build/flat_store_test build/model_file_test build/linear_store_test \
+	build/serving_model_test build/slab_allocator_test build/difacto_loss_test \
+	build/difacto_model_test build/grad_aggregator_test build/difacto_handle_test
@@ -0,0 +1,81 @@
+/**
+ * @file   difacto_handle_test.cc
+ * @brief  Tests of pushing V gradients to the difacto handle
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/difacto_handle_test
+ \endcode
+ */
+#include <stdio.h>
+#include <vector>
+#include "difacto/async_sgd.h"
+
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_w{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_V{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::reclaimed{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::dropped_V{0};
+
+namespace dmlc {
+namespace difacto {
+
+// an entry with V of dim values after the count is pushed
+void Create(FeaID key, int dim, AdaGradHandle<>* h, AdaGradEntry<>* e) {
+  h->Start(true, 0, kPushFeaCnt, NULL);
+  float cnt = 10;
+  h->Push(key, Blob<const float>(&cnt, 1), *e);
+  h->Finish();
+  CHECK_EQ(e->size, dim + 1);
+}
+
+// pushes a gradient with n values, returns w and V after it
+std::vector<float> PushGrad(FeaID key, size_t n, AdaGradHandle<>* h,
+                            AdaGradEntry<>* e) {
+  std::vector<float> grad(n, .5);
+  h->Start(true, 0, 0, NULL);
+  h->Push(key, Blob<const float>(grad.data(), n), *e);
+  h->Finish();
+  return std::vector<float>(e->w(), e->w() + e->size);
+}
+
+// a gradient longer than the entry is dropped and counted if the entries may
+// be evicted, as the entry was created again after the pull
+void TestEvicted() {
+  AdaGradHandle<> h;
+  ISGDHandle::Embedding emb;
+  emb.dim = 2;
+  emb.thr = 0;
+  h.V.push_back(emb);
+  emb.dim = 4;
+  emb.thr = 100;
+  h.V.push_back(emb);
+  h.l1_shrk = false;
+  h.evict = true;
+
+  AdaGradEntry<> e;
+  Create(1, 2, &h, &e);
+  auto before = PushGrad(1, 3, &h, &e);
+  CHECK_EQ(ISGDHandle::dropped_V, 0);
+
+  // the gradient of the larger tier, V is not changed but w is
+  auto after = PushGrad(1, 5, &h, &e);
+  CHECK_EQ(ISGDHandle::dropped_V, 1);
+  CHECK_NE(after[0], before[0]);
+  for (int j = 1; j < 3; ++j) CHECK_EQ(after[j], before[j]);
+
+  // a shorter one, namely w only, updates V as before
+  PushGrad(1, 1, &h, &e);
+  after = PushGrad(1, 3, &h, &e);
+  for (int j = 1; j < 3; ++j) CHECK_NE(after[j], before[j]);
+  CHECK_EQ(ISGDHandle::dropped_V, 1);
+}
+
+}  // namespace difacto
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc::difacto;
+  TestEvicted();
+  printf("passed\n");
+  return 0;
+}
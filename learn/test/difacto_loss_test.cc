@@ -0,0 +1,134 @@
+/**
+ * @file   difacto_loss_test.cc
+ * @brief  Checks the loss and the gradients of difacto against a brute force
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/difacto_loss_test
+ \endcode
+ * The model has keys not pulled, keys without V, keys of each embedding tier,
+ * and keys longer than the largest dim. The gradients overwrite the model, as
+ * in AsyncSGD.
+ */
+#include <stdio.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "base/thread_pool.h"
+#include "difacto/progress.h"
+#include "difacto/loss.h"
+
+namespace dmlc {
+namespace difacto {
+
+void TestLoss(bool binary, int num_threads) {
+  std::mt19937 rng(binary * 7 + num_threads);
+  std::uniform_real_distribution<float> u(-1, 1);
+  Config conf;
+  const int dims[] = {2, 5, 9};
+  const int max_dim = 9;
+  for (int t = 0; t < 3; ++t) {
+    auto e = conf.add_embedding();
+    e->set_dim(dims[t]);
+    e->set_threshold(t * 10);
+  }
+
+  // a random model
+  size_t num_keys = 200, n = 300;
+  std::vector<int> siz(num_keys);
+  std::vector<size_t> pos(num_keys);
+  std::vector<float> model;
+  for (size_t k = 0; k < num_keys; ++k) {
+    int r = rng() % 6;
+    siz[k] = r == 0 ? 0 : r == 1 ? 1 : r == 5 ? max_dim + 3 : 1 + dims[r - 2];
+    pos[k] = model.size();
+    for (int j = 0; j < siz[k]; ++j) model.push_back(u(rng));
+  }
+  auto w = [&](unsigned k) -> double { return siz[k] ? model[pos[k]] : 0; };
+  auto V = [&](unsigned k, int d) -> double {
+    return d < siz[k] - 1 ? model[pos[k] + 1 + d] : 0;
+  };
+
+  // random data
+  std::vector<size_t> offset(1, 0);
+  std::vector<unsigned> index;
+  std::vector<float> value, label(n);
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<unsigned> row;
+    for (int l = rng() % 12; (int)row.size() < l; ) {
+      unsigned k = rng() % num_keys;
+      if (std::find(row.begin(), row.end(), k) == row.end()) row.push_back(k);
+    }
+    std::sort(row.begin(), row.end());
+    for (auto k : row) {
+      index.push_back(k);
+      value.push_back(u(rng) + 1.5);
+    }
+    offset.push_back(index.size());
+    label[i] = rng() % 2;
+  }
+  RowBlock<unsigned> X;
+  X.size = n;
+  X.offset = offset.data();
+  X.label = label.data();
+  X.weight = NULL;
+  X.index = index.data();
+  X.value = binary ? NULL : value.data();
+
+  // the brute force
+  double objv = 0;
+  std::vector<double> grad(model.size());
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<double> xv(max_dim);
+    double xw = 0, xxvv = 0;
+    for (size_t j = offset[i]; j < offset[i+1]; ++j) {
+      double x = X.value ? X.value[j] : 1;
+      xw += x * w(index[j]);
+      for (int d = 0; d < max_dim; ++d) {
+        double v = V(index[j], d);
+        xv[d] += x * v;
+        xxvv += x * x * v * v;
+      }
+    }
+    double py = xw - .5 * xxvv;
+    for (int d = 0; d < max_dim; ++d) py += .5 * xv[d] * xv[d];
+    double y = label[i] > 0 ? 1 : -1;
+    objv += log(1 + exp(- y * py));
+    double p = - y / (1 + exp(y * py));
+    for (size_t j = offset[i]; j < offset[i+1]; ++j) {
+      unsigned k = index[j];
+      if (siz[k] == 0) continue;
+      double x = X.value ? X.value[j] : 1;
+      grad[pos[k]] += p * x;
+      for (int d = 0; d < std::min(siz[k] - 1, max_dim); ++d) {
+        grad[pos[k] + 1 + d] += p * x * (xv[d] - x * V(k, d));
+      }
+    }
+  }
+
+  ThreadPool pool(num_threads);
+  std::vector<float> val = model;
+  Loss<float> loss(X, val, siz, conf, &pool);
+  Progress prog;
+  loss.Evaluate(&prog);
+  CHECK_LE(std::abs(prog.objv() - objv), 1e-4 * objv);
+  loss.CalcGrad(&val);
+  for (size_t i = 0; i < grad.size(); ++i) {
+    CHECK_LE(std::abs(val[i] - grad[i]), 1e-4 * (1 + std::abs(grad[i])))
+        << "position " << i << ": " << val[i] << " vs " << grad[i];
+  }
+}
+
+}  // namespace difacto
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc::difacto;
+  for (int nt : {1, 4}) {
+    TestLoss(false, nt);
+    TestLoss(true, nt);
+    printf("%d thread(s) passed\n", nt);
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file   difacto_model_test.cc
+ * @brief  Tests of reading the difacto models saved in the stream format
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/difacto_model_test
+ \endcode
+ * The records are written by hand in the layout of the former AdaGradEntry,
+ * which packed w_0, sqc_grad_0 and z_0 of a key with size 1 into its two
+ * pointers, so a record has 16 bytes after size.
+ */
+#include <stdio.h>
+#include <vector>
+#include "gflags/gflags.h"
+#include "base/model_parts.h"
+#include "difacto/async_sgd.h"
+
+DEFINE_string(dir, "/tmp", "the directory to write temporary files");
+
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_w{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::new_V{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::reclaimed{0};
+std::atomic<int64_t> dmlc::difacto::ISGDHandle::dropped_V{0};
+
+namespace dmlc {
+namespace difacto {
+
+// a key with size = 1 + V.size()
+struct Record {
+  FeaID key;
+  float w, sqc_grad, z;
+  std::vector<float> V, V_sqc_grad;
+};
+
+// writes a record in the former layout, the padding after w_0 was not
+// initialized
+void WriteOld(const Record& r, Stream* fo) {
+  fo->Write(&r.key, sizeof(r.key));
+  int size = 1 + r.V.size();
+  fo->Write(&size, sizeof(size));
+  if (size == 1) {
+    float w[2] = {r.w, 1e30f}, cg[2] = {r.sqc_grad, r.z};
+    fo->Write(w, sizeof(w));
+    fo->Write(cg, sizeof(cg));
+  } else {
+    fo->Write(&r.w, sizeof(float));
+    fo->Write(r.V.data(), r.V.size() * sizeof(float));
+    float cg[2] = {r.sqc_grad, r.z};
+    fo->Write(cg, sizeof(cg));
+    fo->Write(r.V_sqc_grad.data(), r.V.size() * sizeof(float));
+  }
+}
+
+void CheckEntry(const Record& r, const AdaGradEntry<float>& e) {
+  CHECK_EQ(e.size, (int)r.V.size() + 1) << "key " << r.key;
+  CHECK_EQ(e.w_0(), r.w) << "key " << r.key;
+  CHECK_EQ(e.sqc_grad_0(), r.sqc_grad) << "key " << r.key;
+  CHECK_EQ(e.z_0(), r.z) << "key " << r.key;
+  std::vector<float> v(r.V.size()), cg(r.V.size());
+  e.GetV(v.data(), cg.data());
+  CHECK(v == r.V) << "key " << r.key;
+  CHECK(cg == r.V_sqc_grad) << "key " << r.key;
+}
+
+// reads the records by AdaGradEntry::Load, saves them again, and reads the
+// saved ones
+void TestEntry(const std::vector<Record>& rec, const std::string& file) {
+  std::string file2 = file + "_resaved";
+  {
+    Stream* fi = CHECK_NOTNULL(Stream::Create(file.c_str(), "r"));
+    Stream* fo = CHECK_NOTNULL(Stream::Create(file2.c_str(), "w"));
+    for (const auto& r : rec) {
+      FeaID key;
+      CHECK_EQ(fi->Read(&key, sizeof(key)), sizeof(key));
+      CHECK_EQ(key, r.key);
+      AdaGradEntry<float> e;
+      e.Load(fi);
+      CheckEntry(r, e);
+      fo->Write(&key, sizeof(key));
+      e.Save(fo);
+    }
+    FeaID key;
+    CHECK_EQ(fi->Read(&key, sizeof(key)), 0U);
+    delete fi;
+    delete fo;
+  }
+  Stream* fi = CHECK_NOTNULL(Stream::Create(file2.c_str(), "r"));
+  for (const auto& r : rec) {
+    FeaID key;
+    CHECK_EQ(fi->Read(&key, sizeof(key)), sizeof(key));
+    CHECK_EQ(key, r.key);
+    AdaGradEntry<float> e;
+    e.Load(fi);
+    CheckEntry(r, e);
+  }
+  delete fi;
+}
+
+// reads the records by ModelPartReader, as export_model and predict do
+void TestPartReader(const std::vector<Record>& rec, const std::string& name) {
+  SparseModel model;
+  ModelPartReader("difacto", false, 2).Read(name, &model);
+  std::vector<FeaID> w_key, V_key;
+  std::vector<float> w, V;
+  for (const auto& r : rec) {
+    if (r.w != 0) { w_key.push_back(r.key); w.push_back(r.w); }
+    if (r.V.size()) {
+      V_key.push_back(r.key);
+      V.insert(V.end(), r.V.begin(), r.V.end());
+    }
+  }
+  CHECK(model.w_key == w_key);
+  CHECK(model.w == w);
+  CHECK_EQ(model.dim, 2);
+  CHECK(model.V_key == V_key);
+  CHECK(model.V == V);
+}
+
+}  // namespace difacto
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  using namespace dmlc::difacto;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // keys with and without V, in the order of a sorted store
+  std::vector<Record> rec = {
+    {1, .5, 2, -3, {}, {}},
+    {7, 1, 4, 5, {2, 3}, {6, 7}},
+    {9, -1.5, .25, 8, {}, {}},
+    {12, 0, 1, 2, {}, {}},
+    {20, 2.5, 9, 10, {-1, 4}, {11, 12}},
+  };
+  std::string name = FLAGS_dir + "/difacto_model_test";
+  std::string part = name + "_part-0";
+  Stream* fo = CHECK_NOTNULL(Stream::Create(part.c_str(), "w"));
+  for (const auto& r : rec) WriteOld(r, fo);
+  delete fo;
+
+  TestEntry(rec, part);
+  TestPartReader(rec, name);
+  printf("passed\n");
+  return 0;
+}
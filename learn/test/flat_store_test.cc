@@ -0,0 +1,284 @@
+/**
+ * @file   flat_store_test.cc
+ * @brief  Tests of the flat store of linear servers and its admission
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/flat_store_test
+ \endcode
+ * It checks the store against a std::map while the tables grow, entries are
+ * evicted, keys are admitted, and the model is saved and loaded, with 1 and 4
+ * threads.
+ */
+#include <stdio.h>
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "ps.h"
+#include "base/count_min_sketch.h"
+#include "linear/flat_store.h"
+
+DEFINE_string(dir, "/tmp", "the directory to write temporary files");
+
+namespace dmlc {
+
+// an entry with a weight and the number of pushes
+struct TestEntry {
+  float w = 0;
+  float cnt = 0;
+  TestEntry() { }
+  TestEntry(float _w, float _cnt) : w(_w), cnt(_cnt) { }
+  void Load(Stream* fi) { fi->Read(this, sizeof(*this)); }
+  void Save(Stream* fo) const { fo->Write(this, sizeof(*this)); }
+  bool Empty() const { return w == 0; }
+  static void InitCols(std::vector<ModelColumn>* cols) {
+    cols->emplace_back("w", 1);
+    cols->emplace_back("cnt", 1);
+  }
+  void SaveCols(ModelColumn* cols) const { cols[0].Add(w); cols[1].Add(cnt); }
+  void LoadCols(const float* const* val, const uint32_t* len) {
+    w = val[0][0]; cnt = val[1][0];
+  }
+};
+
+// adds the gradient to the weight
+struct TestHandle {
+  void Start(bool push, int timestamp, int cmd, void* msg) { }
+  void Finish() { }
+  void Push(const ps::Key* key, size_t n, const float* grad, size_t k,
+            TestEntry* val) {
+    for (size_t i = 0; i < n; ++i) { val[i].w += grad[i * k]; ++ val[i].cnt; }
+  }
+  void Pull(ps::Key key, const TestEntry& val, ps::Blob<float>& send) {
+    send[0] = val.w; send[1] = val.cnt;
+  }
+};
+
+typedef linear::FlatStore<TestEntry, TestHandle> Store;
+
+void Push(const std::vector<ps::Key>& keys, const std::vector<float>& grad,
+          Store* store) {
+  ps::SArray<ps::Key> key(keys.size());
+  ps::SArray<float> val(grad.size());
+  std::copy(keys.begin(), keys.end(), key.data());
+  std::copy(grad.begin(), grad.end(), val.data());
+  ps::Message msg;
+  msg.key = ps::SArray<char>(key);
+  msg.add_value(val);
+  store->HandlePush(&msg);
+}
+
+// returns w and cnt of each key
+std::vector<float> Pull(const std::vector<ps::Key>& keys, Store* store) {
+  ps::SArray<ps::Key> key(keys.size());
+  std::copy(keys.begin(), keys.end(), key.data());
+  ps::Message msg;
+  msg.key = ps::SArray<char>(key);
+  store->HandlePull(&msg);
+  ps::SArray<float> val(msg.value[0]);
+  CHECK_EQ(val.size(), keys.size() * 2);
+  return std::vector<float>(val.data(), val.data() + val.size());
+}
+
+// random sorted unique keys, including the maximal key which marks the empty
+// slots
+std::vector<ps::Key> RandKeys(size_t n, ps::Key range, std::mt19937_64* rng) {
+  std::vector<ps::Key> key(n);
+  for (auto& k : key) k = (*rng)() % range;
+  if ((*rng)() % 10 == 0) key.push_back(static_cast<ps::Key>(-1));
+  std::sort(key.begin(), key.end());
+  key.erase(std::unique(key.begin(), key.end()), key.end());
+  return key;
+}
+
+void CheckStore(const std::map<ps::Key, TestEntry>& ref, Store* store) {
+  std::vector<ps::Key> key;
+  size_t num = 0;
+  for (const auto& it : ref) {
+    key.push_back(it.first);
+    num += it.second.cnt > 0;
+  }
+  CHECK_EQ(store->size(), num);
+  auto val = Pull(key, store);
+  for (size_t i = 0; i < key.size(); ++i) {
+    const auto& e = ref.find(key[i])->second;
+    CHECK_EQ(val[2*i], e.w) << "key " << key[i];
+    CHECK_EQ(val[2*i+1], e.cnt) << "key " << key[i];
+  }
+}
+
+// inserts and updates keys while the tables grow several times
+void TestResize(int num_threads) {
+  Store store(TestHandle(), 2);
+  store.SetThreads(num_threads);
+  std::map<ps::Key, TestEntry> ref;
+  std::mt19937_64 rng(0);
+  for (int i = 0; i < 300; ++i) {
+    auto key = RandKeys(1 + rng() % 2000, 1000000, &rng);
+    std::vector<float> grad(key.size());
+    for (size_t j = 0; j < key.size(); ++j) {
+      grad[j] = (float)(rng() % 7) - 3;
+      ref[key[j]].w += grad[j];
+      ++ ref[key[j]].cnt;
+    }
+    Push(key, grad, &store);
+    // pulls in the middle of a migration, some keys are not pushed
+    if (i % 50 == 0) CheckStore(ref, &store);
+  }
+  CheckStore(ref, &store);
+  // keys never pushed
+  auto val = Pull({1000001, 2000000}, &store);
+  for (float v : val) CHECK_EQ(v, 0);
+}
+
+// evicts the zero entries, the rest ones must still be found after they are
+// shifted backward
+void TestErase(int num_threads) {
+  Store store(TestHandle(), 2);
+  store.SetThreads(num_threads);
+  std::atomic<size_t> num_evicted(0);
+  store.SetEviction(new EvictionPolicy(0, 0, true),
+                    [&num_evicted](const TestEntry& e) {
+                      CHECK(e.Empty()); ++ num_evicted;
+                    });
+  std::map<ps::Key, TestEntry> ref;
+  std::mt19937_64 rng(1);
+  // dense keys so that the probing chains are long
+  auto key = RandKeys(100000, 150000, &rng);
+  std::vector<float> grad(key.size());
+  for (size_t j = 0; j < key.size(); ++j) {
+    grad[j] = (float)(rng() % 3);
+    ref[key[j]] = TestEntry(grad[j], 1);
+  }
+  Push(key, grad, &store);
+  // the entries with w == 0 are marked at the first sweep, and evicted at the
+  // second one, which is finished when the third one starts. the special key
+  // is never evicted
+  std::vector<ps::Key> one = {200000};
+  std::vector<float> grad_one = {1};
+  for (int i = 0; i < 3; ++i) {
+    store.StartIter();
+    Push(one, grad_one, &store);
+    auto& e = ref[one[0]]; ++ e.w; ++ e.cnt;
+  }
+  size_t num_zero = 0;
+  for (auto& it : ref) {
+    if (it.second.w == 0 && it.first != static_cast<ps::Key>(-1)) {
+      it.second.cnt = 0; ++ num_zero;
+    }
+  }
+  CHECK_GT(num_zero, (size_t)0);
+  CHECK_EQ(num_evicted, num_zero);
+  CheckStore(ref, &store);
+  // evicted keys are inserted again
+  Push(key, grad, &store);
+  for (size_t j = 0; j < key.size(); ++j) {
+    auto& e = ref[key[j]];
+    e.w += grad[j]; ++ e.cnt;
+  }
+  CheckStore(ref, &store);
+}
+
+// a key is created at its min_count-th push
+void TestAdmission(int num_threads) {
+  int min_count = 3;
+  Store store(TestHandle(), 2);
+  store.SetThreads(num_threads);
+  store.SetAdmission(min_count, 1 << 24);
+  std::map<ps::Key, TestEntry> ref;
+  std::map<ps::Key, int> count;
+  std::mt19937_64 rng(2);
+  for (int i = 0; i < 100; ++i) {
+    auto key = RandKeys(1 + rng() % 500, 5000, &rng);
+    std::vector<float> grad(key.size());
+    for (size_t j = 0; j < key.size(); ++j) {
+      grad[j] = (float)(rng() % 5 + 1);
+      auto& e = ref[key[j]];
+      if (++ count[key[j]] >= min_count) { e.w += grad[j]; ++ e.cnt; }
+    }
+    Push(key, grad, &store);
+  }
+  // the sketch is large enough to count exactly
+  CheckStore(ref, &store);
+}
+
+// saves by one store, and loads the key range [begin, end) by another one with
+// a different number of threads
+void TestSaveFile(int num_threads) {
+  Store store(TestHandle(), 2);
+  store.SetThreads(num_threads);
+  std::map<ps::Key, TestEntry> ref;
+  std::mt19937_64 rng(4);
+  auto key = RandKeys(200000, 1000000, &rng);
+  key.push_back(static_cast<ps::Key>(-1));
+  key.erase(std::unique(key.begin(), key.end()), key.end());
+  std::vector<float> grad(key.size());
+  for (size_t j = 0; j < key.size(); ++j) {
+    grad[j] = (float)(rng() % 3);
+    ref[key[j]] = TestEntry(grad[j], 1);
+  }
+  Push(key, grad, &store);
+  std::string name = FLAGS_dir + "/flat_store_test";
+  store.SaveFile(name, num_threads);
+  CHECK(ModelFile::Is(name));
+
+  ps::Key begin = 300000;
+  for (ps::Key end : {(ps::Key)700000, static_cast<ps::Key>(-1)}) {
+    Store load(TestHandle(), 2);
+    load.SetThreads(5 - num_threads);
+    load.LoadFile({name}, begin, end, num_threads);
+    // the empty entries are not saved, and the maximal key is in the last range
+    auto expect = ref;
+    for (auto& it : expect) {
+      bool in = it.first >= begin &&
+                (it.first < end || end == static_cast<ps::Key>(-1));
+      if (!in || it.second.Empty()) it.second = TestEntry();
+    }
+    CheckStore(expect, &load);
+  }
+}
+
+void TestCountMinSketch() {
+  std::mt19937_64 rng(3);
+  std::map<uint64_t, int> ref;
+  // exact if the sketch is much larger than the number of keys
+  CountMinSketch large(1 << 20);
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t k = rng() % 1000;
+    CHECK_EQ(large.Add(k), ++ ref[k]);
+  }
+  for (const auto& it : ref) CHECK_EQ(large.Count(it.first), it.second);
+  CHECK_EQ(large.Count(1000), 0);
+
+  // never underestimates if it is small
+  CountMinSketch small(256);
+  for (const auto& it : ref) {
+    for (int j = 0; j < it.second; ++j) small.Add(it.first);
+  }
+  for (const auto& it : ref) CHECK_GE(small.Count(it.first), it.second);
+
+  // saturates
+  CountMinSketch sat(64);
+  for (int i = 0; i < 70000; ++i) sat.Add(7);
+  CHECK_EQ(sat.Count(7), 65535);
+  sat.Clear();
+  CHECK_EQ(sat.Count(7), 0);
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  TestCountMinSketch();
+  for (int nt : {1, 4}) {
+    TestResize(nt);
+    TestErase(nt);
+    TestAdmission(nt);
+    TestSaveFile(nt);
+    printf("%d thread(s) passed\n", nt);
+  }
+  return 0;
+}
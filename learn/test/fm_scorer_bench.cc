@@ -0,0 +1,93 @@
+/**
+ * @file   fm_scorer_bench.cc
+ * @brief  Benchmark the latency of FMScorer
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/fm_scorer_bench -dim 16 -num_features 40
+ learn/test/build/fm_scorer_bench -model_in model.serve
+ \endcode
+ * It scores single requests one by one, and reports the latency quantiles.
+ */
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "gflags/gflags.h"
+#include "dmlc/logging.h"
+#include "base/fm_scorer.h"
+
+DEFINE_string(model_in, "", "a model exported by export_model. if empty, a \
+random model is generated");
+DEFINE_int32(dim, 16, "the embedding dimension of the random model");
+DEFINE_int32(num_keys, 1000000, "the number of keys of the random model");
+DEFINE_bool(fp16, false, "store the random model in fp16");
+DEFINE_int32(num_features, 40, "the number of features per request");
+DEFINE_int32(num_requests, 1000000, "the number of requests");
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::mt19937_64 rng(0);
+
+  ServingModel* model = NULL;
+  std::vector<uint64_t> keys;
+  if (FLAGS_model_in.size()) {
+    model = new ServingModel(FLAGS_model_in);
+  } else {
+    SparseModel sparse;
+    sparse.dim = FLAGS_dim;
+    for (int i = 0; i < FLAGS_num_keys; ++i) sparse.w_key.push_back(rng());
+    std::sort(sparse.w_key.begin(), sparse.w_key.end());
+    sparse.w_key.erase(std::unique(sparse.w_key.begin(), sparse.w_key.end()),
+                       sparse.w_key.end());
+    std::uniform_real_distribution<float> u(-.1, .1);
+    for (size_t i = 0; i < sparse.w_key.size(); ++i) {
+      sparse.w.push_back(u(rng));
+      // half of the keys have embeddings
+      if (i % 2) continue;
+      sparse.V_key.push_back(sparse.w_key[i]);
+      for (int j = 0; j < FLAGS_dim; ++j) sparse.V.push_back(u(rng));
+    }
+    keys = sparse.w_key;
+    model = new ServingModel(sparse, FLAGS_fp16);
+  }
+  // the keys of a real model are unknown, so use random keys, most of which
+  // are missed
+  if (keys.empty()) {
+    for (int i = 0; i < FLAGS_num_keys; ++i) keys.push_back(rng());
+  }
+
+  // generate the requests
+  size_t nf = FLAGS_num_features, nr = FLAGS_num_requests;
+  std::vector<uint64_t> key(nf * nr);
+  std::vector<float> val(nf * nr);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = keys[rng() % keys.size()];
+    val[i] = (rng() % 4 + 1) * .5;
+  }
+
+  FMScorer scorer(*model);
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> lat(nr);
+  double sum = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < nr; ++i) {
+    auto t = Clock::now();
+    sum += scorer.Score(key.data() + i * nf, val.data() + i * nf, nf);
+    lat[i] = std::chrono::duration<double, std::micro>(Clock::now() - t).count();
+  }
+  double total = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::sort(lat.begin(), lat.end());
+  auto q = [&lat](double p) { return lat[(size_t)(p * (lat.size() - 1))]; };
+  printf("dim %d, %zu features, %zu requests, %.0f requests per sec\n",
+         model->dim(), nf, nr, nr / total);
+  printf("latency in usec: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",
+         q(.5), q(.9), q(.99), q(.999), lat.back());
+  // avoid optimizing out the scores
+  if (sum == 0) printf("sum of scores %g\n", sum);
+  delete model;
+  return 0;
+}
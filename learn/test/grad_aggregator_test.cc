@@ -0,0 +1,110 @@
+/**
+ * @file   grad_aggregator_test.cc
+ * @brief  Tests of aggregating the gradients of minibatches by count and by a
+ * time window
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/grad_aggregator_test
+ \endcode
+ */
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+#include "base/grad_aggregator.h"
+
+namespace dmlc {
+
+typedef GradAggregator<uint64_t, float> Aggregator;
+
+// the gradient of the t-th minibatch, key k has k % 3 values
+void Grad(int t, std::vector<uint64_t>* key, std::vector<float>* val,
+          std::vector<int>* siz) {
+  key->clear(); val->clear(); siz->clear();
+  for (uint64_t k = t % 2 + 1; k < 20; k += 1 + t % 3) {
+    key->push_back(k);
+    siz->push_back(k % 3);
+    for (uint64_t l = 0; l < k % 3; ++l) val->push_back((float)(t + l));
+  }
+}
+
+// adds num minibatches, sleeping sec after each one, and checks the sum of
+// all pushed gradients. returns the number of minibatches in each push
+std::vector<int> Run(Aggregator* agg, int num, double sec) {
+  std::map<uint64_t, std::vector<float>> expect, sum;
+  std::vector<int> pushed;
+  std::vector<uint64_t> key, agg_key;
+  std::vector<float> val, agg_val;
+  std::vector<int> siz, agg_siz;
+  auto add = [&sum, &agg_key, &agg_val, &agg_siz]() {
+    size_t p = 0;
+    for (size_t i = 0; i < agg_key.size(); ++i) {
+      auto& s = sum[agg_key[i]];
+      s.resize(std::max(s.size(), (size_t)agg_siz[i]), 0);
+      for (int l = 0; l < agg_siz[i]; ++l) s[l] += agg_val[p++];
+    }
+    CHECK_EQ(p, agg_val.size());
+  };
+  for (int t = 0; t < num; ++t) {
+    Grad(t, &key, &val, &siz);
+    size_t p = 0;
+    for (size_t i = 0; i < key.size(); ++i) {
+      auto& e = expect[key[i]];
+      e.resize(std::max(e.size(), (size_t)siz[i]), 0);
+      for (int l = 0; l < siz[i]; ++l) e[l] += val[p++];
+    }
+    int n = agg->Add(key, val, &siz, &agg_key, &agg_val, &agg_siz);
+    if (n) { pushed.push_back(n); add(); }
+    std::this_thread::sleep_for(std::chrono::duration<double>(sec));
+  }
+  int n = agg->Flush(&agg_key, &agg_val, &agg_siz);
+  if (n) { pushed.push_back(n); add(); }
+  CHECK_EQ(agg->Flush(&agg_key, &agg_val, &agg_siz), 0);
+
+  int total = 0;
+  for (int m : pushed) total += m;
+  CHECK_EQ(total, num);
+  CHECK(sum == expect);
+  return pushed;
+}
+
+// pushes every num_mb minibatches
+void TestCount() {
+  Aggregator agg(3, 0);
+  auto pushed = Run(&agg, 10, 0);
+  CHECK_EQ(pushed.size(), 4U);
+  for (int i = 0; i < 3; ++i) CHECK_EQ(pushed[i], 3);
+  CHECK_EQ(pushed[3], 1);
+}
+
+// only the time window bounds the aggregation, so several minibatches are
+// merged even if num_mb is not given
+void TestTimeOnly() {
+  Aggregator agg(0, .1);
+  auto pushed = Run(&agg, 20, .02);
+  CHECK_GE(pushed.size(), 2U);
+  for (size_t i = 0; i + 1 < pushed.size(); ++i) CHECK_GT(pushed[i], 1);
+  // no minibatch is pushed alone before the window closes
+  CHECK_LT(pushed.size(), 20U);
+}
+
+// the count or the time window, whichever comes first
+void TestCountAndTime() {
+  Aggregator slow(1000, .05);
+  for (int n : Run(&slow, 10, .02)) CHECK_LT(n, 10);
+  Aggregator fast(2, 100);
+  for (int n : Run(&fast, 10, 0)) CHECK_EQ(n, 2);
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  TestCount();
+  TestTimeOnly();
+  TestCountAndTime();
+  printf("passed\n");
+  return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file   linear_store_test.cc
+ * @brief  Tests of the linear sgd handles updating the flat store
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/linear_store_test
+ \endcode
+ * It pushes random gradients through a FlatStore with 1 and 4 threads, and
+ * checks the weights against a copy of the handle updating the entries of a
+ * std::map key by key.
+ */
+#include <stdio.h>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "linear/async_sgd.h"
+
+std::atomic<int64_t> dmlc::linear::ISGDHandle::new_w{0};
+std::atomic<int64_t> dmlc::linear::ISGDHandle::reclaimed{0};
+
+namespace dmlc {
+namespace linear {
+
+template <typename Entry, typename Handle>
+void TestHandle(const Handle& h, int num_threads) {
+  FlatStore<Entry, Handle> store(h);
+  store.SetThreads(num_threads);
+  Handle ref_h = h;
+  std::map<FeaID, Entry> ref;
+  std::mt19937_64 rng(0);
+  for (int t = 0; t < 50; ++t) {
+    size_t n = 1 + rng() % 3000;
+    std::vector<FeaID> keys(n);
+    for (auto& k : keys) k = rng() % 10000;
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    n = keys.size();
+    ps::SArray<FeaID> key(n);
+    ps::SArray<float> grad(n);
+    std::copy(keys.begin(), keys.end(), key.data());
+    for (size_t i = 0; i < n; ++i) grad[i] = (float)(rng() % 200) / 100 - 1;
+
+    ps::Message push;
+    push.key = ps::SArray<char>(key);
+    push.add_value(grad);
+    store.HandlePush(&push);
+    ref_h.Start(true, t, 0, &push);
+    for (size_t i = 0; i < n; ++i) {
+      ref_h.Push(key[i], Blob<const float>(&grad[i], 1), ref[key[i]]);
+    }
+    ref_h.Finish();
+
+    ps::Message pull;
+    pull.key = ps::SArray<char>(key);
+    store.HandlePull(&pull);
+    ps::SArray<float> w(pull.value[0]);
+    CHECK_EQ(w.size(), n);
+    for (size_t i = 0; i < n; ++i) {
+      float expect;
+      Blob<float> send(&expect, 1);
+      ref_h.Pull(key[i], ref[key[i]], send);
+      CHECK(std::isfinite(w[i])) << "key " << key[i];
+      CHECK_LE(std::abs(w[i] - expect), 1e-5 * (1 + std::abs(expect)))
+          << "key " << key[i] << ": " << w[i] << " vs " << expect;
+    }
+  }
+}
+
+template <typename Entry, typename Handle>
+void TestHandle(const char* name) {
+  Handle h;
+  h.penalty.set_lambda1(.01);
+  h.penalty.set_lambda2(.1);
+  h.alpha = .5;
+  h.beta = 1;
+  h.Init();
+  for (int nt : {1, 4}) {
+    TestHandle<Entry, Handle>(h, nt);
+    printf("%s with %d thread(s) passed\n", name, nt);
+  }
+}
+
+}  // namespace linear
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc::linear;
+  TestHandle<SGDEntry, SGDHandle>("sgd");
+  TestHandle<AdaGradEntry<>, AdaGradHandle<>>("adagrad");
+  TestHandle<FTRLEntry<>, FTRLHandle<>>("ftrl");
+  return 0;
+}
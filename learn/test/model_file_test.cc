@@ -0,0 +1,113 @@
+/**
+ * @file   model_file_test.cc
+ * @brief  Tests of writing and reading the sharded binary model format
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/model_file_test
+ \endcode
+ */
+#include <stdio.h>
+#include <random>
+#include <vector>
+#include "gflags/gflags.h"
+#include "base/model_file.h"
+
+DEFINE_string(dir, "/tmp", "the directory to write temporary files");
+
+namespace dmlc {
+
+// writes a model with a fixed and a variable width column, then reads it back
+void TestRoundTrip(int num_threads) {
+  std::mt19937_64 rng(0);
+  size_t n = 100000;
+  std::vector<uint64_t> key(n);
+  std::vector<float> w(n);
+  std::vector<std::vector<float>> V(n);
+  uint64_t k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    k += 1 + rng() % 1000;
+    key[i] = k;
+    w[i] = (float)i;
+    V[i].resize(rng() % 4);
+    for (auto& v : V[i]) v = (float)(rng() % 100);
+  }
+  key.back() = static_cast<uint64_t>(-1);
+  std::vector<ModelColumn> cols;
+  cols.emplace_back("w", 1);
+  cols.emplace_back("V", 0);
+  std::string name = FLAGS_dir + "/model_file_test";
+  ModelFile::Write(name, key, cols, num_threads, [&](
+      size_t begin, size_t end, std::vector<ModelColumn>* cols) {
+    for (size_t i = begin; i < end; ++i) {
+      (*cols)[0].Add(w[i]);
+      (*cols)[1].Add(V[i].data(), V[i].size());
+    }
+  });
+  CHECK(ModelFile::Is(name));
+  CHECK(!ModelFile::Is(ModelFile::ChunkName(name, 0)));
+  auto index = ModelFile::ReadIndex(name);
+  CHECK_EQ(index.size(), (size_t)1);
+  CHECK_EQ(index[0].num_keys, n);
+  CHECK_EQ(index[0].min_key, key[0]);
+  CHECK_EQ(index[0].max_key, key.back());
+
+  // the chunk has the maximal key, so it overlaps any range after key[0]
+  CHECK_EQ(ModelFile::ChunkFiles({name}, 0, key[0]).size(), (size_t)0);
+  auto files = ModelFile::ChunkFiles({name}, key.back(), key.back());
+  CHECK_EQ(files.size(), (size_t)1);
+
+  // read the columns in another order
+  std::vector<ModelColumn> rcols;
+  rcols.emplace_back("V", 0);
+  rcols.emplace_back("w", 1);
+  size_t num = 0;
+  ModelFile::Read(files, num_threads, [&](size_t, const ModelChunk& chunk) {
+      CHECK_EQ(chunk.size(), n);
+      CHECK_EQ(chunk.num_cols(), 2);
+      CHECK_EQ(chunk.Find("x"), -1);
+      ModelRowIter it(chunk, rcols);
+      for (size_t i = 0; it.Next(); ++i) {
+        CHECK_EQ(it.key(), key[i]);
+        CHECK_EQ(it.len()[0], V[i].size());
+        for (size_t j = 0; j < V[i].size(); ++j) {
+          CHECK_EQ(it.val()[0][j], V[i][j]);
+        }
+        CHECK_EQ(it.len()[1], 1U);
+        CHECK_EQ(it.val()[1][0], w[i]);
+        ++ num;
+      }
+    });
+  CHECK_EQ(num, n);
+}
+
+// an empty model has one empty chunk
+void TestEmpty() {
+  std::string name = FLAGS_dir + "/model_file_test_empty";
+  std::vector<ModelColumn> cols;
+  cols.emplace_back("w", 1);
+  ModelFile::Write(name, {}, cols, 2, [](
+      size_t begin, size_t end, std::vector<ModelColumn>*) {
+      CHECK_EQ(begin, end);
+    });
+  auto index = ModelFile::ReadIndex(name);
+  CHECK_EQ(index.size(), (size_t)1);
+  CHECK_EQ(index[0].num_keys, 0U);
+  CHECK_EQ(ModelFile::ChunkFiles({name}, 0, static_cast<uint64_t>(-1)).size(),
+           (size_t)0);
+  ModelChunk chunk(ModelFile::ChunkName(name, 0));
+  CHECK_EQ(chunk.size(), (size_t)0);
+  CHECK(!ModelRowIter(chunk, cols).Next());
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  TestRoundTrip(1);
+  TestRoundTrip(4);
+  TestEmpty();
+  printf("passed\n");
+  return 0;
+}
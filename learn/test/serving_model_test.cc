@@ -0,0 +1,131 @@
+/**
+ * @file   serving_model_test.cc
+ * @brief  Tests of the lookups in the serving model
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/serving_model_test
+ \endcode
+ */
+#include <stdio.h>
+#include <map>
+#include <random>
+#include <vector>
+#include "gflags/gflags.h"
+#include "base/serving_model.h"
+
+DEFINE_string(dir, "/tmp", "the directory to write temporary files");
+
+namespace dmlc {
+
+// checks the lookups of all keys in the model and of the keys in absent
+void CheckModel(const SparseModel& ref, const ServingModel& model, bool fp16,
+                const std::vector<uint64_t>& absent) {
+  float tol = fp16 ? 1e-3 : 0;
+  CHECK_EQ(model.num_w(), ref.w_key.size());
+  CHECK_EQ(model.num_V(), ref.V_key.size());
+  CHECK_EQ(model.dim(), ref.dim);
+  for (size_t i = 0; i < ref.w_key.size(); ++i) {
+    float w = ref.w[i];
+    CHECK_LE(std::abs(model.w(ref.w_key[i]) - w), tol * std::abs(w))
+        << "key " << ref.w_key[i];
+  }
+  std::vector<float> buf(ref.dim);
+  for (size_t i = 0; i < ref.V_key.size(); ++i) {
+    const float* v = model.V(ref.V_key[i], buf.data());
+    CHECK(v != NULL) << "key " << ref.V_key[i];
+    for (int j = 0; j < ref.dim; ++j) {
+      float e = ref.V[i * ref.dim + j];
+      CHECK_LE(std::abs(v[j] - e), tol * std::abs(e)) << "key " << ref.V_key[i];
+    }
+  }
+  for (uint64_t k : absent) {
+    CHECK_EQ(model.w(k), 0) << "key " << k;
+    CHECK(model.V(k, buf.data()) == NULL) << "key " << k;
+  }
+}
+
+void CheckModel(const SparseModel& ref, const std::vector<uint64_t>& absent) {
+  for (bool fp16 : {false, true}) {
+    CheckModel(ref, ServingModel(ref, fp16), fp16, absent);
+  }
+}
+
+// the keys at both ends of the key space, so a bucket covers 2^64 keys if
+// shift = 0
+void TestExtremeKeys() {
+  const uint64_t kMax = static_cast<uint64_t>(-1);
+  SparseModel m;
+  m.dim = 3;
+  m.w_key = {0, 1, 1ULL << 63, kMax - 1, kMax};
+  m.w = {1, 2, 3, 4, 5};
+  m.V_key = {0, kMax};
+  m.V = {1, 2, 3, 4, 5, 6};
+  CheckModel(m, {2, 1ULL << 62, kMax - 2});
+
+  // a single key
+  for (uint64_t k : {(uint64_t)0, kMax}) {
+    SparseModel s;
+    s.w_key = {k};
+    s.w = {1};
+    CheckModel(s, {k ^ 1, k ^ (1ULL << 63)});
+  }
+}
+
+// random keys in several ranges, so the shift varies
+void TestRandom() {
+  std::mt19937_64 rng(0);
+  for (int bits : {10, 32, 64}) {
+    std::map<uint64_t, float> w;
+    for (int i = 0; i < 100000; ++i) {
+      uint64_t k = bits == 64 ? rng() : rng() & ((1ULL << bits) - 1);
+      w[k] = (float)(rng() % 1000 + 1);
+    }
+    SparseModel m;
+    m.dim = 2;
+    for (const auto& it : w) {
+      m.w_key.push_back(it.first);
+      m.w.push_back(it.second);
+      if (it.first % 3 == 0) {
+        m.V_key.push_back(it.first);
+        m.V.push_back(it.second);
+        m.V.push_back(-it.second);
+      }
+    }
+    std::vector<uint64_t> absent;
+    while (absent.size() < 1000) {
+      uint64_t k = rng();
+      if (!w.count(k) && k % 3 != 0) absent.push_back(k);
+    }
+    CheckModel(m, absent);
+  }
+}
+
+// an empty model, and one mapped from a file
+void TestFile() {
+  SparseModel empty;
+  CheckModel(empty, {0, 1, static_cast<uint64_t>(-1)});
+
+  SparseModel m;
+  m.dim = 1;
+  m.w_key = {0, 7, static_cast<uint64_t>(-1)};
+  m.w = {1, 2, 3};
+  m.V_key = {7};
+  m.V = {4};
+  std::string file = FLAGS_dir + "/serving_model_test";
+  ServingModel::Write(file, m, false);
+  CHECK(ServingModel::Is(file));
+  CheckModel(m, ServingModel(file), false, {1, 8});
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  TestExtremeKeys();
+  TestRandom();
+  TestFile();
+  printf("passed\n");
+  return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file   slab_allocator_test.cc
+ * @brief  Tests of the slab allocator shared by threads
+ * on wormhole's root directory:
+ \code
+ make test
+ learn/test/build/slab_allocator_test
+ \endcode
+ * Several threads allocate and free blocks of random sizes, and free some
+ * blocks allocated by the others, then the contents are checked.
+ */
+#include <stdio.h>
+#include <random>
+#include <thread>
+#include <vector>
+#include "base/slab_allocator.h"
+
+namespace dmlc {
+
+FloatSlabs slabs;
+
+struct Block {
+  int n;
+  uint32_t h;
+};
+
+// fills a block with values derived from its handle
+void Fill(const Block& b) {
+  float* p = slabs.Get(b.n, b.h);
+  for (int j = 0; j < b.n; ++j) p[j] = (float)(b.h % 100000 + j);
+}
+
+void Check(const Block& b) {
+  const float* p = slabs.Get(b.n, b.h);
+  for (int j = 0; j < b.n; ++j) {
+    CHECK_EQ(p[j], (float)(b.h % 100000 + j)) << "block " << b.h;
+  }
+}
+
+void TestThreads(int num_threads) {
+  // the blocks each thread leaves to the next one
+  std::vector<std::vector<Block>> left(num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([t, &left]() {
+        std::mt19937 rng(t);
+        std::vector<Block> live;
+        for (int i = 0; i < 200000; ++i) {
+          if (live.size() < 1000 || rng() % 2) {
+            Block b;
+            b.n = 1 + rng() % 17;
+            b.h = slabs.Alloc(b.n);
+            Fill(b);
+            live.push_back(b);
+          } else {
+            size_t k = rng() % live.size();
+            Check(live[k]);
+            slabs.Free(live[k].n, live[k].h);
+            live[k] = live.back();
+            live.pop_back();
+          }
+        }
+        left[t] = live;
+      });
+  }
+  for (auto& t : threads) t.join();
+  threads.clear();
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([t, num_threads, &left]() {
+        for (const auto& b : left[(t + 1) % num_threads]) {
+          Check(b);
+          slabs.Free(b.n, b.h);
+        }
+      });
+  }
+  for (auto& t : threads) t.join();
+}
+
+// the blocks allocated in a row by a thread are contiguous
+void TestContiguous() {
+  int n = 18;
+  uint32_t h = slabs.Alloc(n);
+  for (int i = 1; i < 1000; ++i) CHECK_EQ(slabs.Alloc(n), h + i);
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  TestContiguous();
+  for (int nt : {1, 4, 20}) {
+    TestThreads(nt);
+    printf("%d thread(s) passed\n", nt);
+  }
+  size_t bytes = slabs.bytes();
+  // the freed blocks are reused, so no page is added
+  TestThreads(4);
+  CHECK_EQ(slabs.bytes(), bytes);
+  return 0;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file   export_model.cc
+ * @brief  Export a model saved by the linear method or difacto into a compact
+ * ServingModel for prediction
+ */
+#include "gflags/gflags.h"
+#include "dmlc/io.h"
+#include "dmlc/logging.h"
+#include "base/model_parts.h"
+#include "base/serving_model.h"
+
+DEFINE_string(model_in, "", "the model saved by training without the _part-k \
+suffix, such as model_iter-3");
+DEFINE_string(model_out, "", "the output filename");
+DEFINE_string(model_type, "linear", "linear or difacto. only used for the \
+models not saved in the binary format");
+DEFINE_bool(fp16, false, "store the values in fp16 rather than float");
+DEFINE_bool(l1_shrk, true, "difacto only. drop the embedding of a key whose \
+w is 0, as difacto does not use it if l1_shrk is true");
+DEFINE_int32(num_threads, 2, "the number of threads");
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  InitLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(FLAGS_model_in.size()) << "missing model_in";
+  CHECK(FLAGS_model_out.size()) << "missing model_out";
+
+  SparseModel model;
+  ModelPartReader(FLAGS_model_type, FLAGS_l1_shrk, FLAGS_num_threads).Read(
+      FLAGS_model_in, &model);
+  ServingModel::Write(FLAGS_model_out, model, FLAGS_fp16);
+  LOG(INFO) << "exported " << model.w_key.size() << " weights and "
+            << model.V_key.size() << " embeddings with dim " << model.dim
+            << " into " << FLAGS_model_out;
+  return 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file   predict.cc
+ * @brief  Predict with a linear or difacto model on a single machine
+ */
+#include <stdio.h>
+#include <limits>
+#include <thread>
+#include "gflags/gflags.h"
+#include "dmlc/io.h"
+#include "dmlc/data.h"
+#include "dmlc/logging.h"
+#include "dmlc/timer.h"
+#include "data/libsvm_parser.h"
+#include "base/adfea_parser.h"
+#include "base/criteo_parser.h"
+#include "base/crb_parser.h"
+#include "base/thread_pool.h"
+#include "base/model_parts.h"
+#include "base/serving_model.h"
+#include "base/fm_scorer.h"
+
+DEFINE_string(model_in, "", "a model exported by export_model, or a model \
+saved by training without the _part-k suffix");
+DEFINE_string(model_type, "linear", "linear or difacto. only used for the \
+models saved by training not in the binary format");
+DEFINE_bool(l1_shrk, true, "difacto only. do not use the embedding of a key \
+whose w is 0");
+DEFINE_string(data_in, "stdin", "input filename name or stdin");
+DEFINE_string(data_format, "libsvm", "libsvm, criteo, criteo_test, adfea or \
+crb");
+DEFINE_string(pred_out, "stdout", "output filename name or stdout");
+DEFINE_bool(binary, false, "write the predictions as float32 rather than text \
+lines");
+DEFINE_bool(prob_predict, false, "output the probabilities rather than the \
+raw predictions");
+DEFINE_uint64(max_key, std::numeric_limits<uint64_t>::max(), "the max_key \
+used by training. a feature id is mapped to id % max_key if it is set, or its \
+bytes are reversed otherwise");
+DEFINE_int32(num_threads, 0, "the number of threads, 0 means all cores");
+
+namespace dmlc {
+
+/**
+ * \brief predicts the examples in a row block, with a FMScorer per thread
+ */
+class Predictor {
+ public:
+  Predictor(const ServingModel& model, int num_threads, uint64_t max_key,
+            bool prob)
+      : scorer_(num_threads, FMScorer(model)), key_(num_threads),
+        max_key_(max_key), prob_(prob) { }
+
+  void Predict(const RowBlock<uint64_t>& blk, ThreadPool* pool,
+               std::vector<float>* pred) {
+    pred->resize(blk.size);
+    pool->ParallelFor(blk.size, [this, &blk, pred](int t, const Range& rg) {
+        auto& key = key_[t];
+        for (size_t i = rg.begin; i < rg.end; ++i) {
+          size_t os = blk.offset[i], n = blk.offset[i+1] - os;
+          key.resize(n);
+          for (size_t j = 0; j < n; ++j) {
+            key[j] = FMScorer::Key(blk.index[os + j], max_key_);
+          }
+          float p = scorer_[t].Score(
+              key.data(), blk.value ? blk.value + os : NULL, n);
+          (*pred)[i] = prob_ ? FMScorer::Prob(p) : p;
+        }
+      }, 256);
+  }
+
+ private:
+  std::vector<FMScorer> scorer_;
+  // the keys of an example
+  std::vector<std::vector<uint64_t>> key_;
+  uint64_t max_key_;
+  bool prob_;
+};
+
+/**
+ * \brief writes the predictions in text, formatted by several threads
+ */
+void WriteText(const std::vector<float>& pred, ThreadPool* pool,
+               std::vector<std::string>* buf, Stream* fo) {
+  size_t n = pred.size(), ns = buf->size();
+  pool->ParallelFor(ns, [&pred, buf, n, ns](int, const Range& rg) {
+      char str[32];
+      for (size_t s = rg.begin; s < rg.end; ++s) {
+        auto& b = (*buf)[s];
+        b.clear();
+        for (size_t i = n * s / ns; i < n * (s + 1) / ns; ++i) {
+          b.append(str, snprintf(str, sizeof(str), "%g\n", pred[i]));
+        }
+      }
+    });
+  for (const auto& b : *buf) fo->Write(b.data(), b.size());
+}
+
+}  // namespace dmlc
+
+int main(int argc, char *argv[]) {
+  using namespace dmlc;
+  using namespace dmlc::data;
+  InitLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(FLAGS_model_in.size()) << "missing model_in";
+  int nt = FLAGS_num_threads > 0 ? FLAGS_num_threads :
+           std::max((int)std::thread::hardware_concurrency(), 1);
+
+  // load the model
+  double start = GetTime();
+  ServingModel* model = NULL;
+  if (ServingModel::Is(FLAGS_model_in)) {
+    model = new ServingModel(FLAGS_model_in);
+  } else {
+    SparseModel sparse;
+    ModelPartReader(FLAGS_model_type, FLAGS_l1_shrk, nt).Read(
+        FLAGS_model_in, &sparse);
+    model = new ServingModel(sparse, false);
+  }
+  LOG(INFO) << "loaded " << model->num_w() << " weights and "
+            << model->num_V() << " embeddings in " << GetTime() - start
+            << " sec";
+
+  // the parser runs in a separated thread
+  using IndexType = uint64_t;
+  auto type = FLAGS_data_format;
+  auto uri = FLAGS_data_in.c_str();
+  ParserImpl<IndexType>* parser = NULL;
+  if (type == "libsvm") {
+    parser = new LibSVMParser<IndexType>(
+        InputSplit::Create(uri, 0, 1, "text"), nt);
+  } else if (type == "criteo") {
+    parser = new CriteoParser<IndexType>(
+        InputSplit::Create(uri, 0, 1, "text"), true);
+  } else if (type == "criteo_test") {
+    parser = new CriteoParser<IndexType>(
+        InputSplit::Create(uri, 0, 1, "text"), false);
+  } else if (type == "adfea") {
+    parser = new AdfeaParser<IndexType>(InputSplit::Create(uri, 0, 1, "text"));
+  } else if (type == "crb") {
+    parser = new CRBParser<IndexType>(
+        InputSplit::Create(uri, 0, 1, "recordio"));
+  } else {
+    LOG(FATAL) << "unknown format " << type;
+  }
+  parser = new ThreadedParser<IndexType>(parser);
+
+  // predict block by block, so the predictions are in the input order
+  start = GetTime();
+  Stream* fo = CHECK_NOTNULL(Stream::Create(FLAGS_pred_out.c_str(), "w"));
+  ThreadPool pool(nt);
+  Predictor predictor(*model, nt, FLAGS_max_key, FLAGS_prob_predict);
+  std::vector<float> pred;
+  std::vector<std::string> buf(nt * 4);
+  size_t num_ex = 0;
+  parser->BeforeFirst();
+  while (parser->Next()) {
+    predictor.Predict(parser->Value(), &pool, &pred);
+    if (FLAGS_binary) {
+      fo->Write(pred.data(), pred.size() * sizeof(float));
+    } else {
+      WriteText(pred, &pool, &buf, fo);
+    }
+    num_ex += pred.size();
+  }
+  double sec = GetTime() - start;
+  LOG(INFO) << "predicted " << num_ex << " examples in " << sec << " sec, "
+            << num_ex / sec << " examples per sec";
+
+  delete fo;
+  delete parser;
+  delete model;
+  return 0;
+}